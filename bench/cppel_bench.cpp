@@ -0,0 +1,785 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#define CPPEL_TRACK_ALLOCATIONS
+#include <cppel/allocation.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <cppel/adapter.hpp>
+#include <cppel/batch.hpp>
+#include <cppel/binary_document.hpp>
+#include <cppel/bundle.hpp>
+#include <cppel/columnar.hpp>
+#include <cppel/dependency.hpp>
+#include <cppel/expression.hpp>
+#include <cppel/native.hpp>
+#include <cppel/parser.hpp>
+#include <cppel/query.hpp>
+#if __cplusplus >= 201703L
+#include <cppel/static_expression.hpp>
+#endif
+#include <cppel/tokenizer.hpp>
+
+/**
+ * usage:
+ *    cppel_bench [--filter <substr>] [--min-time <seconds>] [--baseline <file>] [--tolerance <ratio>] [--out <file>]
+ *
+ * results are printed as json, when a baseline produced by a previous run is given
+ * every case slower than baseline * (1 + tolerance), or doing more heap allocations
+ * per op than the baseline, is reported and the exit code is 1
+ */
+
+using json = nlohmann::json;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string filter;
+  double min_time = 0.2;
+  std::string baseline;
+  double tolerance = 0.1;
+  std::string out;
+};
+
+struct BenchCase {
+  std::string name;
+  std::function<void()> setup;
+  std::function<void()> run;
+};
+
+volatile size_t sink = 0;
+
+void do_not_optimize(const json &value) {
+  sink = sink + value.size();
+}
+
+/**
+ * add the native/ case of an expression compiled by cppel_codegen, its result is checked against the interpreter
+ */
+void add_native_case(std::vector<BenchCase> &cases,
+                     const std::string &name,
+                     const std::string &expr_str,
+                     const std::function<void()> &setup,
+                     const std::shared_ptr<const json> &data,
+                     cppel::Parser &parser,
+                     cppel::Parser &native_parser) {
+  std::shared_ptr<cppel::Expression> interpreted = std::make_shared<cppel::Expression>(parser.parse(expr_str));
+  std::shared_ptr<cppel::Expression> native = std::make_shared<cppel::Expression>(native_parser.parse(expr_str));
+  if (!std::dynamic_pointer_cast<const cppel::NativeNode>(native->get_root())) {
+    std::cerr << "no native function of " << expr_str << std::endl;
+    return;
+  }
+  cases.push_back({name, [setup, interpreted, native, data]() {
+    if (setup) {
+      setup();
+    }
+    if (interpreted->evaluate(*data) != native->evaluate(*data)) {
+      std::cerr << "native result of " << native->get_expr_str() << " differs" << std::endl;
+      std::exit(1);
+    }
+  }, [native, data]() {
+    cppel::EvaluationContext context(*data);
+    do_not_optimize(native->evaluate(context));
+  }});
+}
+
+#if __cplusplus >= 201703L
+/**
+ * add the static/ case of an expression parsed at compile time, its result is checked against the interpreter
+ */
+template<typename StaticExpr>
+void add_static_case(std::vector<BenchCase> &cases,
+                     const std::string &name,
+                     const StaticExpr &static_expr,
+                     const std::function<void()> &setup,
+                     const std::shared_ptr<const json> &data,
+                     cppel::Parser &parser) {
+  std::shared_ptr<cppel::Expression> interpreted =
+      std::make_shared<cppel::Expression>(parser.parse(std::string(static_expr.get_expr_str())));
+  cases.push_back({name, [setup, interpreted, static_expr, data]() {
+    if (setup) {
+      setup();
+    }
+    if (interpreted->evaluate(*data) != static_expr.evaluate(*data)) {
+      std::cerr << "static result of " << static_expr.get_expr_str() << " differs" << std::endl;
+      std::exit(1);
+    }
+  }, [static_expr, data]() {
+    cppel::EvaluationContext context(*data);
+    do_not_optimize(static_expr.evaluate(context));
+  }});
+}
+#endif
+
+json run_case(const BenchCase &bench_case, const Options &options) {
+  if (bench_case.setup) {
+    bench_case.setup();
+  }
+  // warm up and calibrate the iteration count to reach min_time
+  uint64_t iterations = 1;
+  double elapsed = 0;
+  while (true) {
+    Clock::time_point start = Clock::now();
+    for (uint64_t i = 0; i < iterations; ++i) {
+      bench_case.run();
+    }
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (elapsed >= options.min_time || iterations >= (1ull << 40)) {
+      break;
+    }
+    uint64_t next = elapsed > 0 ? static_cast<uint64_t>(iterations * options.min_time * 1.2 / elapsed) : iterations * 10;
+    iterations = std::max(iterations * 2, std::min(next, iterations * 100));
+  }
+
+  // allocations are deterministic, a few more runs are enough
+  const uint64_t allocation_runs = std::min<uint64_t>(iterations, 16);
+  cppel::AllocationScope allocation_scope;
+  for (uint64_t i = 0; i < allocation_runs; ++i) {
+    bench_case.run();
+  }
+  cppel::AllocationStats allocations = allocation_scope.get();
+
+  json result;
+  result["name"] = bench_case.name;
+  result["iterations"] = iterations;
+  result["ns_per_op"] = elapsed * 1e9 / iterations;
+  result["ops_per_sec"] = iterations / elapsed;
+  result["allocs_per_op"] = static_cast<double>(allocations.count) / allocation_runs;
+  result["bytes_per_op"] = static_cast<double>(allocations.bytes) / allocation_runs;
+  return result;
+}
+
+std::string long_expression(const int terms) {
+  std::string expr_str;
+  for (int i = 0; i < terms; ++i) {
+    if (i > 0) {
+      expr_str += " && ";
+    }
+    expr_str += "(order.items[" + std::to_string(i % 8) + "].price * 2 + 3.5 >= 'abc' || #this?.name != null)";
+  }
+  return expr_str;
+}
+
+struct Item {
+  int id;
+  int price;
+  std::string name;
+};
+
+struct Order {
+  std::vector<Item> items;
+};
+
+struct Customer {
+  std::vector<Order> orders;
+};
+
+Order make_order(const int size) {
+  cppel::adapter<Item>().field("id", &Item::id).field("price", &Item::price).field("name", &Item::name);
+  cppel::adapter<Order>().field("items", &Order::items);
+  Order order;
+  for (int i = 0; i < size; ++i) {
+    order.items.push_back({i, i % 100, "item" + std::to_string(i)});
+  }
+  return order;
+}
+
+Customer make_customer(const int size) {
+  make_order(0);
+  cppel::adapter<Customer>().field("orders", &Customer::orders);
+  Customer customer;
+  for (int i = 0; i < size; ++i) {
+    customer.orders.push_back(make_order(4));
+  }
+  return customer;
+}
+
+json make_array(const int size) {
+  json items = json::array();
+  for (int i = 0; i < size; ++i) {
+    items.push_back({{"id", i}, {"price", i % 100}, {"name", "item" + std::to_string(i)}});
+  }
+  return {{"items", items}};
+}
+
+std::vector<BenchCase> make_cases() {
+  std::vector<BenchCase> cases;
+  // native functions linked from native_rules.txt are only used by the native/ cases
+  static cppel::Parser parser;
+  parser.set_use_native(false);
+  static cppel::Parser native_parser;
+
+  // lexing
+  for (int terms : {10, 100}) {
+    std::string expr_str = long_expression(terms);
+    cases.push_back({"lex/terms_" + std::to_string(terms), nullptr, [expr_str]() {
+      cppel::Tokenizer tokenizer(expr_str);
+      size_t count = 0;
+      while (tokenizer.next_token().kind_ != cppel::Token::Kind::END) {
+        ++count;
+      }
+      sink = sink + count;
+    }});
+  }
+
+  // parsing
+  static const std::vector<std::string> corpus = {
+      "user.age >= 18 && user.country == 'US'",
+      "order.total > 100 ? 'big' : 'small'",
+      "user?.profile?.nickname ?: user.name",
+      "#split(user.tags, ',')",
+      "#join(order.items.![name], ';')",
+      "order.items.?[price > 10 && qty < 5]",
+      "order.items.^[sku == 'A-1'].price",
+      "order.items.$[qty > 0]",
+      "(a + b) * c - d / e % 3 ^ 2",
+      "!(flags.disabled || flags.deleted) and score > 0.5",
+      "{1, 2, 3, 4, 5}",
+      "groups.-[members]",
+  };
+  cases.push_back({"parse/corpus_" + std::to_string(corpus.size()), nullptr, []() {
+    for (auto &expr_str : corpus) {
+      cppel::Expression expr = parser.parse(expr_str);
+      sink = sink + expr.get_expr_str().size();
+    }
+  }});
+  // uint64_t storage keeps the bundle 8 bytes aligned
+  static std::vector<uint64_t> bundle_bytes;
+  static size_t bundle_size = 0;
+  cases.push_back({"load/bundle_corpus_" + std::to_string(corpus.size()), []() {
+    cppel::BundleWriter writer;
+    for (auto &expr_str : corpus) {
+      writer.add(parser.parse(expr_str));
+    }
+    std::string bytes = writer.to_bytes();
+    bundle_bytes.resize(bytes.size() / sizeof(uint64_t) + 1);
+    std::memcpy(bundle_bytes.data(), bytes.data(), bytes.size());
+    bundle_size = bytes.size();
+  }, []() {
+    cppel::Bundle bundle(reinterpret_cast<const char *>(bundle_bytes.data()), bundle_size);
+    for (auto &expr : bundle.load_all()) {
+      sink = sink + expr.get_expr_str().size();
+    }
+  }});
+  // the corpus estimated and admitted against a budget, which every expression of it is under
+  static cppel::Parser admitting_parser;
+  cppel::AdmissionPolicy policy;
+  policy.max_cost = 1e9;
+  admitting_parser.set_admission(policy);
+  cases.push_back({"parse/admitted_corpus_" + std::to_string(corpus.size()), nullptr, []() {
+    for (auto &expr_str : corpus) {
+      cppel::Expression expr = admitting_parser.parse(expr_str);
+      sink = sink + expr.get_expr_str().size();
+    }
+  }});
+  cases.push_back({"parse/long_expression_100", nullptr, []() {
+    static const std::string expr_str = long_expression(100);
+    cppel::Expression expr = parser.parse(expr_str);
+    sink = sink + expr.get_expr_str().size();
+  }});
+  // generated rules which only differ in their literals, the cached parser shares one plan between them
+  static std::vector<std::string> rules;
+  for (int i = 0; i < 1000; ++i) {
+    rules.push_back("user.id == " + std::to_string(1000 + i) + " && user.country == 'C" + std::to_string(i) + "'");
+  }
+  static cppel::Parser cached_parser;
+  cached_parser.set_use_native(false);
+  cached_parser.set_cache_capacity(16);
+  for (auto &parse_case : std::vector<std::pair<std::string, cppel::Parser *>>{
+      {"parse/rules_1000", &parser},
+      {"parse/cached_rules_1000", &cached_parser},
+  }) {
+    cppel::Parser *rules_parser = parse_case.second;
+    cases.push_back({parse_case.first, nullptr, [rules_parser]() {
+      for (auto &expr_str : rules) {
+        cppel::Expression expr = rules_parser->parse(expr_str);
+        sink = sink + expr.get_expr_str().size();
+      }
+    }});
+  }
+
+  // evaluation
+  static const json doc = {
+      {"user", {{"name", "Jack"}, {"age", 30}, {"profile", {{"address", {{"city", "Paris"}}}}}}},
+      {"a", 3}, {"b", 4}, {"c", 5.5}, {"d", 7}, {"e", 2},
+      {"names", "Jack,Rose,Tom,Jerry,Alice,Bob,Carol,Dave"},
+      {"list", {"Jack", "Rose", "Tom", "Jerry", "Alice", "Bob", "Carol", "Dave"}},
+  };
+  static const std::string in_set = "user.profile.address.city in {'London', 'Berlin', 'Madrid', 'Rome', 'Vienna', "
+                                   "'Prague', 'Warsaw', 'Lisbon', 'Dublin', 'Oslo', 'Helsinki', 'Athens', 'Brussels', "
+                                   "'Amsterdam', 'Stockholm', 'Paris'}";
+  std::string or_chain;
+  for (auto city : {"London", "Berlin", "Madrid", "Rome", "Vienna", "Prague", "Warsaw", "Lisbon", "Dublin", "Oslo",
+                    "Helsinki", "Athens", "Brussels", "Amsterdam", "Stockholm", "Paris"}) {
+    or_chain += (or_chain.empty() ? "" : " || ") + std::string("user.profile.address.city == '") + city + "'";
+  }
+  struct EvalCase {
+    std::string name;
+    std::string expr_str;
+  };
+  for (auto &eval_case : std::vector<EvalCase>{
+      {"eval/property", "user.profile.address.city"},
+      {"eval/arithmetic", "(a + b) * c - d / e"},
+      {"eval/compare", "user.age >= 18 && user.name == 'Jack'"},
+      {"eval/split", "#split(names, ',')"},
+      {"eval/join", "#join(list, ';')"},
+      {"eval/method", "user.name.toUpperCase().startsWith('JA')"},
+      {"eval/variable", "#x = (a + b) * c; #x * #x - #x / e"},
+      // the chain is parsed to the same set lookup as the in operator
+      {"eval/in_set", in_set},
+      {"eval/or_chain", or_chain},
+  }) {
+    std::shared_ptr<cppel::Expression> expr = std::make_shared<cppel::Expression>(parser.parse(eval_case.expr_str));
+    cases.push_back({eval_case.name, nullptr, [expr]() {
+      cppel::EvaluationContext context(doc);
+      do_not_optimize(expr->evaluate(context));
+    }});
+  }
+  std::shared_ptr<cppel::Expression> prepared =
+      std::make_shared<cppel::Expression>(parser.parse("user.age >= ?1 && user.name == :name"));
+  prepared->bind(1, 18).bind("name", "Jack");
+  cases.push_back({"eval/parameter", nullptr, [prepared]() {
+    cppel::EvaluationContext context(doc);
+    do_not_optimize(prepared->evaluate(context));
+  }});
+  std::shared_ptr<const json> doc_ref(&doc, [](const json *) {});
+  add_native_case(cases, "native/property", "user.profile.address.city", nullptr, doc_ref, parser, native_parser);
+  add_native_case(cases, "native/arithmetic", "(a + b) * c - d / e", nullptr, doc_ref, parser, native_parser);
+  add_native_case(cases, "native/compare", "user.age >= 18 && user.name == 'Jack'", nullptr, doc_ref, parser,
+                  native_parser);
+  add_native_case(cases, "native/in_set", in_set, nullptr, doc_ref, parser, native_parser);
+  add_native_case(cases, "native/variable", "#x = (a + b) * c; #x * #x - #x / e", nullptr, doc_ref, parser,
+                  native_parser);
+#if __cplusplus >= 201703L
+  add_static_case(cases, "static/property", CPPEL_EXPR("user.profile.address.city"), nullptr, doc_ref, parser);
+  add_static_case(cases, "static/arithmetic", CPPEL_EXPR("(a + b) * c - d / e"), nullptr, doc_ref, parser);
+  add_static_case(cases, "static/compare", CPPEL_EXPR("user.age >= 18 && user.name == 'Jack'"), nullptr, doc_ref,
+                  parser);
+#endif
+
+  // failing evaluations, null navigation on a missing field
+  std::shared_ptr<cppel::Expression> missing =
+      std::make_shared<cppel::Expression>(parser.parse("user.profile.missing.city"));
+  cases.push_back({"eval/error_throw", nullptr, [missing]() {
+    cppel::EvaluationContext context(doc);
+    try {
+      do_not_optimize(missing->evaluate(context));
+    } catch (const cppel::EvaluateError &e) {
+      sink = sink + 1;
+    }
+  }});
+  cases.push_back({"eval/error_try", nullptr, [missing]() {
+    cppel::EvaluationContext context(doc);
+    cppel::EvaluateResult result = missing->try_evaluate(context);
+    sink = sink + result.ok();
+  }});
+
+  // rules attached to an entity of 100 fields, a change of one field only affects a few of them
+  static json entity;
+  for (int i = 0; i < 100; ++i) {
+    entity["f" + std::to_string(i)] = {{"value", i}, {"tags", {"a", "b"}}};
+  }
+  static cppel::ExpressionSet rule_set;
+  for (int i = 0; i < 1000; ++i) {
+    rule_set.add(parser.parse("f" + std::to_string(i % 100) + ".value > " + std::to_string(i % 7) + " && f"
+                                  + std::to_string((i * 7) % 100) + ".tags.contains('a')"));
+  }
+  rule_set.evaluate(entity);
+  static const std::vector<std::string> changed = {"/f3/value"};
+  cases.push_back({"incremental/evaluate_1000", nullptr, []() {
+    sink = sink + rule_set.evaluate(entity).size();
+  }});
+  cases.push_back({"incremental/update_1000", nullptr, []() {
+    sink = sink + rule_set.update(entity, changed).size();
+  }});
+
+  // standing queries over 1000 sensors, an in-process producer patches the temperature of 100 of them per batch
+  static cppel::QueryEngine engine;
+  static std::vector<cppel::Expression> queries;
+  for (int i = 0; i < 50; ++i) {
+    queries.push_back(parser.parse(i % 2 ? "temperature > " + std::to_string(i) : "#avg(readings) > " + std::to_string(i)));
+    engine.subscribe(queries.back(), [](const cppel::QueryEvent &event) { sink = sink + event.query; });
+  }
+  for (int i = 0; i < 1000; ++i) {
+    engine.put("sensor" + std::to_string(i), {{"temperature", i % 60}, {"readings", {i % 7, i % 11, i % 13}}});
+  }
+  engine.flush();
+  static int tick = 0;
+  cases.push_back({"stream/flush_100_of_1000", nullptr, []() {
+    ++tick;
+    for (int i = 0; i < 100; ++i) {
+      json patch = {{{"op", "replace"}, {"path", "/temperature"}, {"value", (tick + i) % 60}}};
+      engine.patch("sensor" + std::to_string((tick * 100 + i) % 1000), patch);
+    }
+    sink = sink + engine.flush();
+  }});
+  // the same batch evaluating every query on the patched documents
+  static std::vector<json> sensors(1000);
+  cases.push_back({"stream/reevaluate_100_of_1000", nullptr, []() {
+    ++tick;
+    for (int i = 0; i < 100; ++i) {
+      json &sensor = sensors[(tick * 100 + i) % 1000];
+      sensor = {{"temperature", (tick + i) % 60}, {"readings", {i % 7, i % 11, i % 13}}};
+      cppel::EvaluationContext context(sensor);
+      for (auto &query : queries) {
+        sink = sink + query.try_evaluate(context).ok();
+      }
+    }
+  }});
+
+  // a lookup in a remote store for 100 documents, each request costs a simulated round trip of 20us
+  static std::vector<json> accounts;
+  for (int i = 0; i < 100; ++i) {
+    accounts.push_back({{"user", {{"id", i % 30}, {"group", i % 4}}}});
+  }
+  static auto round_trip = []() {
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+  };
+  static cppel::Expression lookup = parser.parse("#score(user.id) > 5 && #tier(user.group) == 'gold'");
+  cases.push_back({"batch/per_call_100", nullptr, []() {
+    for (auto &account : accounts) {
+      cppel::EvaluationContext context(account);
+      context.add_function({"score", 1}, [](cppel::Arguments &args) {
+        round_trip();
+        return std::make_shared<json>(args[0]->get<int>() % 10);
+      });
+      context.add_function({"tier", 1}, [](cppel::Arguments &args) {
+        round_trip();
+        return std::make_shared<json>(args[0]->get<int>() == 1 ? "gold" : "silver");
+      });
+      sink = sink + lookup.try_evaluate(context).ok();
+    }
+  }});
+  cases.push_back({"batch/loaded_100", nullptr, []() {
+    cppel::BatchLoader loader;
+    loader.add_function({"score", 1}, [](const std::vector<json> &keys) {
+      round_trip();
+      std::promise<std::vector<json>> values;
+      std::vector<json> scores;
+      for (auto &key : keys) {
+        scores.push_back(key[0].get<int>() % 10);
+      }
+      values.set_value(std::move(scores));
+      return values.get_future();
+    });
+    loader.add_function({"tier", 1}, [](const std::vector<json> &keys) {
+      round_trip();
+      std::promise<std::vector<json>> values;
+      std::vector<json> tiers;
+      for (auto &key : keys) {
+        tiers.push_back(key[0].get<int>() == 1 ? "gold" : "silver");
+      }
+      values.set_value(std::move(tiers));
+      return values.get_future();
+    });
+    cppel::AsyncBatch batch(loader);
+    for (auto &account : accounts) {
+      batch.add(lookup, account);
+    }
+    for (auto &result : batch.run()) {
+      sink = sink + result.ok();
+    }
+  }});
+
+  // a predicate over 100000 rows, one json object per row against typed columns
+  static std::vector<json> order_rows;
+  const char *regions[] = {"EU", "US", "APAC"};
+  for (int i = 0; i < 100000; ++i) {
+    order_rows.push_back({{"price", (i * 7) % 40}, {"qty", (i % 11) * 0.5}, {"region", regions[i % 3]}});
+  }
+  static cppel::ColumnBatch orders = cppel::ColumnBatch::from_json(order_rows, {"price", "qty", "region"});
+  static cppel::Expression order_filter = parser.parse("price > 10 && qty < 5 && region == 'EU'");
+  static cppel::ColumnarFilter columnar_filter(order_filter);
+  cases.push_back({"columnar/rows_100000", nullptr, []() {
+    for (auto &row : order_rows) {
+      cppel::EvaluationContext context(row);
+      sink = sink + order_filter.evaluate_ref(context).get<bool>();
+    }
+  }});
+  cases.push_back({"columnar/filter_100000", []() {
+    cppel::Bitmap selected = columnar_filter.filter(orders);
+    for (size_t row = 0; row < order_rows.size(); ++row) {
+      cppel::EvaluateResult result = order_filter.try_evaluate(order_rows[row]);
+      if (selected.test(row) != (result.ok() && cppel::truthy(&result.value))) {
+        std::cerr << "columnar result of row " << row << " differs" << std::endl;
+        std::exit(1);
+      }
+    }
+  }, []() {
+    sink = sink + columnar_filter.filter(orders).count();
+  }});
+
+  // collections
+  for (int size : {10, 1000, 100000}) {
+    std::shared_ptr<json> data = std::make_shared<json>();
+    auto setup = [data, size]() {
+      if (data->is_null()) {
+        *data = make_array(size);
+      }
+    };
+    for (auto &eval_case : std::vector<EvalCase>{
+        {"eval/selection_", "items.?[price > 50]"},
+        {"eval/projection_", "items.![price * 2]"},
+        {"eval/select_first_", "items.^[id == " + std::to_string(size - 1) + "]"},
+        {"eval/matches_prefix_", "items.?[name matches 'item1.*']"},
+        {"eval/matches_regex_", "items.?[name matches 'item[0-9]*7']"},
+        {"eval/method_", "items.?[name.endsWith('7')]"},
+        {"eval/variable_", "#prices = items.![price]; #max(#prices) - #min(#prices)"},
+    }) {
+      std::shared_ptr<cppel::Expression> expr = std::make_shared<cppel::Expression>(parser.parse(eval_case.expr_str));
+      cases.push_back({eval_case.name + std::to_string(size), setup, [expr, data]() {
+        cppel::EvaluationContext context(*data);
+        do_not_optimize(expr->evaluate(context));
+      }});
+    }
+    // aggregates of a projection accumulated without building the projected array, orderings and groupings
+    for (auto &eval_case : std::vector<EvalCase>{
+        {"eval/sum_projection_", "#sum(items.![price])"},
+        {"eval/max_projection_", "#max(items.![id])"},
+        {"eval/sort_", "#sort(items, price)"},
+        {"eval/top_", "#top(items, 10, price)"},
+        {"eval/distinct_", "#distinct(items.![price])"},
+        {"eval/group_by_", "#groupBy(items, price)"},
+    }) {
+      std::shared_ptr<cppel::Expression> expr = std::make_shared<cppel::Expression>(parser.parse(eval_case.expr_str));
+      cases.push_back({eval_case.name + std::to_string(size), setup, [expr, data]() {
+        cppel::EvaluationContext context(*data);
+        do_not_optimize(expr->evaluate(context));
+      }});
+    }
+    // the same projection counted against limits it doesn't reach
+    std::shared_ptr<cppel::Expression> budgeted = std::make_shared<cppel::Expression>(parser.parse("items.![price * 2]"));
+    cases.push_back({"eval/projection_budgeted_" + std::to_string(size), setup, [budgeted, data]() {
+      cppel::EvaluationContext context(*data);
+      cppel::EvaluationLimits limits;
+      limits.max_steps = 1000000;
+      limits.max_iterations = 1000000;
+      limits.max_bytes = 1 << 30;
+      limits.timeout = std::chrono::seconds(1);
+      context.set_limits(limits);
+      do_not_optimize(budgeted->evaluate(context));
+    }});
+    std::shared_ptr<json> numbers = std::make_shared<json>();
+    auto numbers_setup = [numbers, size]() {
+      if (numbers->is_null()) {
+        json values = json::array();
+        for (int i = 0; i < size; ++i) {
+          values.push_back(i * 0.5);
+        }
+        *numbers = {{"values", values}};
+      }
+    };
+    std::shared_ptr<cppel::Expression> sum_expr = std::make_shared<cppel::Expression>(parser.parse("#sum(values)"));
+    cases.push_back({"eval/sum_array_" + std::to_string(size), numbers_setup, [sum_expr, numbers]() {
+      cppel::EvaluationContext context(*numbers);
+      do_not_optimize(sum_expr->evaluate(context));
+    }});
+
+    std::shared_ptr<cppel::Expression> expr = std::make_shared<cppel::Expression>(parser.parse("items.?[price > 50]"));
+    cases.push_back({"eval/selection_ref_" + std::to_string(size), setup, [expr, data]() {
+      cppel::EvaluationContext context(*data);
+      do_not_optimize(expr->evaluate_ref(context));
+    }});
+    add_native_case(cases, "native/selection_" + std::to_string(size), "items.?[price > 50]", setup, data, parser,
+                    native_parser);
+    add_native_case(cases, "native/method_" + std::to_string(size), "items.?[name.endsWith('7')]", setup, data, parser,
+                    native_parser);
+    add_native_case(cases, "native/projection_" + std::to_string(size), "items.![price * 2]", setup, data, parser,
+                    native_parser);
+#if __cplusplus >= 201703L
+    add_static_case(cases, "static/selection_" + std::to_string(size), CPPEL_EXPR("items.?[price > 50]"), setup, data,
+                    parser);
+    add_static_case(cases, "static/projection_" + std::to_string(size), CPPEL_EXPR("items.![price * 2]"), setup, data,
+                    parser);
+#endif
+
+    // native structs, evaluated through adapters or converted to json first
+    std::shared_ptr<Order> order = std::make_shared<Order>();
+    auto order_setup = [order, size]() {
+      if (order->items.empty()) {
+        *order = make_order(size);
+      }
+    };
+    std::shared_ptr<cppel::Expression> order_expr =
+        std::make_shared<cppel::Expression>(parser.parse("items.?[price < 10].![id]"));
+    cases.push_back({"adapter/filter_" + std::to_string(size), order_setup, [order_expr, order]() {
+      cppel::EvaluationContext context(cppel::adapter<Order>(), order.get());
+      do_not_optimize(order_expr->evaluate(context));
+    }});
+    cases.push_back({"adapter/to_json_filter_" + std::to_string(size), order_setup, [order_expr, order]() {
+      json data = cppel::adapter<Order>().to_json(order.get());
+      do_not_optimize(order_expr->evaluate(data));
+    }});
+
+    // binary documents evaluated in place, against the same data as a json tree
+    auto binary_ref = std::make_shared<std::shared_ptr<cppel::BinaryDocument>>();
+    auto binary_setup = [setup, data, binary_ref]() {
+      setup();
+      if (!*binary_ref) {
+        *binary_ref = std::make_shared<cppel::BinaryDocument>(cppel::BinaryDocument::from_json(*data));
+      }
+    };
+    cases.push_back({"binary/filter_" + std::to_string(size), binary_setup, [order_expr, binary_ref]() {
+      cppel::EvaluationContext context((*binary_ref)->get_adapter(), (*binary_ref)->get_root());
+      do_not_optimize(order_expr->evaluate(context));
+    }});
+    cases.push_back({"binary/json_filter_" + std::to_string(size), setup, [order_expr, data]() {
+      cppel::EvaluationContext context(*data);
+      do_not_optimize(order_expr->evaluate(context));
+    }});
+    // loading the document before evaluating, parsing json text or opening binary bytes
+    auto text = std::make_shared<std::string>();
+    // uint64_t storage keeps the document 8 bytes aligned
+    auto bytes = std::make_shared<std::vector<uint64_t>>();
+    auto bytes_size = std::make_shared<size_t>(0);
+    auto load_setup = [setup, data, text, bytes, bytes_size]() {
+      setup();
+      if (text->empty()) {
+        *text = data->dump();
+        cppel::BinaryDocumentWriter writer(*data);
+        *bytes_size = writer.to_bytes().size();
+        bytes->resize(*bytes_size / sizeof(uint64_t) + 1);
+        std::memcpy(bytes->data(), writer.to_bytes().data(), *bytes_size);
+      }
+    };
+    cases.push_back({"binary/load_filter_" + std::to_string(size), load_setup, [order_expr, bytes, bytes_size]() {
+      cppel::BinaryDocument binary(reinterpret_cast<const char *>(bytes->data()), *bytes_size);
+      cppel::EvaluationContext context(binary.get_adapter(), binary.get_root());
+      do_not_optimize(order_expr->evaluate(context));
+    }});
+    cases.push_back({"binary/json_parse_filter_" + std::to_string(size), load_setup, [order_expr, text]() {
+      json parsed = json::parse(*text);
+      cppel::EvaluationContext context(parsed);
+      do_not_optimize(order_expr->evaluate(context));
+    }});
+  }
+
+  // nested native vectors, every inner array is looked up among the arrays of the evaluation
+  for (int size : {1000, 8000}) {
+    std::shared_ptr<Customer> customer = std::make_shared<Customer>();
+    std::shared_ptr<json> customer_json = std::make_shared<json>();
+    auto customer_setup = [customer, customer_json, size]() {
+      if (customer->orders.empty()) {
+        *customer = make_customer(size);
+        *customer_json = cppel::adapter<Customer>().to_json(customer.get());
+      }
+    };
+    std::shared_ptr<cppel::Expression> nested_expr =
+        std::make_shared<cppel::Expression>(parser.parse("orders.![items.![price]]"));
+    cases.push_back({"adapter/nested_" + std::to_string(size), customer_setup, [nested_expr, customer]() {
+      cppel::EvaluationContext context(cppel::adapter<Customer>(), customer.get());
+      do_not_optimize(nested_expr->evaluate(context));
+    }});
+    cases.push_back({"adapter/json_nested_" + std::to_string(size), customer_setup, [nested_expr, customer_json]() {
+      do_not_optimize(nested_expr->evaluate(*customer_json));
+    }});
+  }
+  return cases;
+}
+
+bool parse_options(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "missing value of " << arg << std::endl;
+      return false;
+    }
+    if (arg == "--filter") {
+      options.filter = argv[++i];
+    } else if (arg == "--min-time") {
+      options.min_time = std::stod(argv[++i]);
+    } else if (arg == "--baseline") {
+      options.baseline = argv[++i];
+    } else if (arg == "--tolerance") {
+      options.tolerance = std::stod(argv[++i]);
+    } else if (arg == "--out") {
+      options.out = argv[++i];
+    } else {
+      std::cerr << "unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * annotate results with the baseline, return the number of regressions
+ */
+int compare_baseline(json &report, const json &baseline, const double tolerance) {
+  int regressions = 0;
+  for (auto &result : report["benchmarks"]) {
+    for (auto &base : baseline["benchmarks"]) {
+      if (base["name"] != result["name"]) {
+        continue;
+      }
+      double ratio = result["ns_per_op"].get<double>() / base["ns_per_op"].get<double>();
+      result["baseline_ns_per_op"] = base["ns_per_op"];
+      result["ratio"] = ratio;
+      bool regression = ratio > 1 + tolerance;
+      if (base.contains("allocs_per_op")) {
+        result["baseline_allocs_per_op"] = base["allocs_per_op"];
+        if (result["allocs_per_op"].get<double>() > base["allocs_per_op"].get<double>() + 0.5) {
+          result["allocation_regression"] = true;
+          regression = true;
+        }
+      }
+      if (regression) {
+        result["regression"] = true;
+        ++regressions;
+      }
+    }
+  }
+  report["regressions"] = regressions;
+  return regressions;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    return 2;
+  }
+
+  json report;
+  report["benchmarks"] = json::array();
+  for (auto &bench_case : make_cases()) {
+    if (!options.filter.empty() && bench_case.name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+    report["benchmarks"].push_back(run_case(bench_case, options));
+    std::cerr << bench_case.name << " done" << std::endl;
+  }
+
+  int regressions = 0;
+  if (!options.baseline.empty()) {
+    std::ifstream in(options.baseline);
+    if (!in) {
+      std::cerr << "can't open baseline " << options.baseline << std::endl;
+      return 2;
+    }
+    regressions = compare_baseline(report, json::parse(in), options.tolerance);
+  }
+
+  if (options.out.empty()) {
+    std::cout << report.dump(2) << std::endl;
+  } else {
+    std::ofstream(options.out) << report.dump(2) << std::endl;
+  }
+  return regressions > 0 ? 1 : 0;
+}
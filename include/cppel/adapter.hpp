@@ -0,0 +1,221 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "context.hpp"
+#include "document.hpp"
+
+/**
+ * evaluate expressions on native structs
+ *
+ *    cppel::adapter<Address>().field("city", &Address::city);
+ *    cppel::adapter<User>().field("age", &User::age).field("address", &User::address);
+ *
+ *    cppel::EvaluationContext context(cppel::adapter<User>(), &user);
+ *    json rlt = expr.evaluate(context);
+ *
+ * fields are arithmetic values, std::string, json, structs with a registered adapter
+ * or std::vector of them. computed fields are given as a function of the struct returning a value
+ * convertible to json. fields are registered once, before evaluating
+ */
+
+namespace cppel {
+
+template<typename T>
+class StructAdapter;
+
+template<typename T>
+class VectorAdapter;
+
+template<typename T>
+StructAdapter<T> &adapter() {
+  static StructAdapter<T> instance;
+  return instance;
+}
+
+template<typename T>
+VectorAdapter<T> &vector_adapter() {
+  static VectorAdapter<T> instance;
+  return instance;
+}
+
+namespace adapter_detail {
+
+template<typename T>
+struct is_plain : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_same<T, std::string>::value
+    || std::is_same<T, json>::value> {
+};
+
+template<typename T>
+const DocumentAdapter *adapter_of(std::false_type) {
+  return &adapter<T>();
+}
+
+template<typename T>
+const DocumentAdapter *adapter_of(std::true_type) {
+  return nullptr;
+}
+
+/**
+ * adapter of values of type T, nullptr for plain values
+ */
+template<typename T>
+struct AdapterOf {
+  static const DocumentAdapter *get() {
+    return adapter_of<T>(is_plain<T>());
+  }
+};
+
+template<typename T>
+struct AdapterOf<std::vector<T>> {
+  static const DocumentAdapter *get() {
+    return &vector_adapter<T>();
+  }
+};
+
+template<typename T>
+const json *value_of(EvaluationContext &context, const T &value, std::true_type) {
+  return context.push_value(json(value));
+}
+
+template<typename T>
+const json *value_of(EvaluationContext &context, const T &value, std::false_type) {
+  return context.push_document(AdapterOf<T>::get(), &value);
+}
+
+/**
+ * value of a field, plain values are converted and other ones are documents
+ */
+template<typename T>
+const json *value_of(EvaluationContext &context, const T &value) {
+  return value_of(context, value, is_plain<T>());
+}
+
+template<typename T>
+json to_json(const T &value, std::true_type) {
+  return json(value);
+}
+
+template<typename T>
+json to_json(const T &value, std::false_type) {
+  return AdapterOf<T>::get()->to_json(&value);
+}
+
+template<typename T>
+json to_json(const T &value) {
+  return to_json(value, is_plain<T>());
+}
+
+} // namespace adapter_detail
+
+template<typename T>
+class StructAdapter : public DocumentAdapter {
+ public:
+  template<typename F>
+  StructAdapter &field(const std::string &name, F T::*member) {
+    Field field;
+    field.get = [member](EvaluationContext &context, const T &object) {
+      return adapter_detail::value_of(context, object.*member);
+    };
+    field.to_json = [member](const T &object) {
+      return adapter_detail::to_json(object.*member);
+    };
+    add_field(name, field);
+    return *this;
+  }
+
+  /**
+   * computed field, getter returns a value convertible to json
+   */
+  template<typename Getter>
+  StructAdapter &field(const std::string &name, Getter getter) {
+    Field field;
+    field.get = [getter](EvaluationContext &context, const T &object) {
+      return context.push_value(json(getter(object)));
+    };
+    field.to_json = [getter](const T &object) {
+      return json(getter(object));
+    };
+    add_field(name, field);
+    return *this;
+  }
+
+  virtual const json *get_property(EvaluationContext &context, const void *object, const std::string &name) const {
+    auto it = index_.find(name);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    return fields_[it->second].second.get(context, *static_cast<const T *>(object));
+  }
+
+  virtual json to_json(const void *object) const {
+    json value = json::object();
+    for (auto &field : fields_) {
+      value[field.first] = field.second.to_json(*static_cast<const T *>(object));
+    }
+    return value;
+  }
+
+ private:
+  struct Field {
+    std::function<const json *(EvaluationContext &, const T &)> get;
+    std::function<json(const T &)> to_json;
+  };
+
+  std::vector<std::pair<std::string, Field>> fields_;
+  std::unordered_map<std::string, size_t> index_;
+
+  void add_field(const std::string &name, const Field &field) {
+    auto it = index_.find(name);
+    if (it != index_.end()) {
+      fields_[it->second].second = field;
+    } else {
+      index_[name] = fields_.size();
+      fields_.push_back(std::make_pair(name, field));
+    }
+  }
+};
+
+template<typename T>
+class VectorAdapter : public DocumentAdapter {
+ public:
+  virtual bool is_array(const void * /*object*/) const {
+    return true;
+  }
+
+  virtual size_t size(const void *object) const {
+    return static_cast<const std::vector<T> *>(object)->size();
+  }
+
+  virtual const DocumentAdapter *get_element_adapter() const {
+    return adapter_detail::AdapterOf<T>::get();
+  }
+
+  virtual const void *get_element_object(const void *object, const size_t index) const {
+    return &(*static_cast<const std::vector<T> *>(object))[index];
+  }
+
+  virtual const json *get_element(EvaluationContext &context, const void *object, const size_t index) const {
+    return adapter_detail::value_of(context, (*static_cast<const std::vector<T> *>(object))[index]);
+  }
+
+  virtual json to_json(const void *object) const {
+    json value = json::array();
+    for (auto &item : *static_cast<const std::vector<T> *>(object)) {
+      value.push_back(adapter_detail::to_json(item));
+    }
+    return value;
+  }
+};
+
+} // namespace cppel
@@ -0,0 +1,230 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/**
+ * heap allocation accounting
+ *
+ * counting needs the global operator new to be replaced, define CPPEL_TRACK_ALLOCATIONS
+ * before including this header in exactly one translation unit of the program:
+ *
+ *    #define CPPEL_TRACK_ALLOCATIONS
+ *    #include <cppel/allocation.hpp>
+ *
+ * without it every counter stays zero and AllocationTracker::installed() is false
+ */
+
+namespace cppel {
+
+struct AllocationStats {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+
+  AllocationStats operator-(const AllocationStats &other) const {
+    AllocationStats stats;
+    stats.count = count - other.count;
+    stats.bytes = bytes - other.bytes;
+    return stats;
+  }
+
+  AllocationStats &operator+=(const AllocationStats &other) {
+    count += other.count;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+class AllocationTracker {
+ public:
+  /**
+   * allocations made by the current thread so far
+   */
+  static AllocationStats current() {
+    return state().stats;
+  }
+
+  static void record(const size_t bytes) {
+    State &s = state();
+    if (s.suspended == 0) {
+      s.stats.count += 1;
+      s.stats.bytes += bytes;
+    }
+  }
+
+  /**
+   * exclude bookkeeping of the tracker users, like the profiler, from the counters
+   */
+  class Suspend {
+   public:
+    Suspend() {
+      state().suspended += 1;
+    }
+    ~Suspend() {
+      state().suspended -= 1;
+    }
+  };
+
+  static bool installed() {
+    return installed_flag();
+  }
+
+  static bool install() {
+    installed_flag() = true;
+    return true;
+  }
+
+ private:
+  struct State {
+    AllocationStats stats;
+    int suspended;
+  };
+
+  static State &state() {
+    static thread_local State s = {AllocationStats(), 0};
+    return s;
+  }
+
+  static bool &installed_flag() {
+    static bool installed = false;
+    return installed;
+  }
+};
+
+/**
+ * allocations made by the current thread during the lifetime of the scope
+ */
+class AllocationScope {
+ public:
+  AllocationScope() : start_(AllocationTracker::current()) {}
+
+  AllocationStats get() const {
+    return AllocationTracker::current() - start_;
+  }
+
+ private:
+  AllocationStats start_;
+};
+
+} // namespace cppel
+
+#ifdef CPPEL_TRACK_ALLOCATIONS
+
+static const bool cppel_allocation_tracker_installed = cppel::AllocationTracker::install();
+
+// the replaced operator new allocates with malloc, so the matching operator delete frees with free.
+// gcc can't see through the replacement and reports every inlined pair as mismatched
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 11)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size) {
+  cppel::AllocationTracker::record(size);
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  cppel::AllocationTracker::record(size);
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+#ifdef __cpp_aligned_new
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  cppel::AllocationTracker::record(size);
+  std::size_t align = static_cast<std::size_t>(alignment);
+  // aligned_alloc wants a size multiple of the alignment
+  if (void *ptr = std::aligned_alloc(align, (size + align - 1) / align * align + (size ? 0 : align))) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept {
+  return operator new(size, alignment, tag);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+#endif
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 11)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
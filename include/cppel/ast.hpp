@@ -4,33 +4,154 @@
 
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include "nlohmann/json.hpp"
 #include "context.hpp"
 #include "exception.hpp"
+#include "method.hpp"
+#include "pattern.hpp"
 #include "utils.hpp"
 
 namespace cppel {
 
 using json = nlohmann::json;
 
-class AstNode {
+/**
+ * propagate the failure of a non-throwing evaluation, see EvaluationContext::fail
+ */
+#define CPPEL_CHECK(value) if (!(value)) return nullptr
+
+/**
+ * constant values shared by the nodes, static members of a class template can be
+ * defined in the header without breaking programs with several translation units
+ */
+template<typename T = void>
+class AstValues {
+ protected:
+  static const json value_empty_;
+  static const json value_true_;
+  static const json value_false_;
+  static const json value_zero_;
+};
+
+template<typename T> const json AstValues<T>::value_empty_ = json();
+template<typename T> const json AstValues<T>::value_true_ = json(true);
+template<typename T> const json AstValues<T>::value_false_ = json(false);
+template<typename T> const json AstValues<T>::value_zero_ = json(0);
+
+/**
+ * kind of a node, which passes over the tree switch on instead of comparing names
+ */
+enum class NodeKind {
+  OTHER,
+  LITERAL_NONE,
+  LITERAL_BOOL,
+  LITERAL_INT,
+  LITERAL_FLOAT,
+  LITERAL_STRING,
+  ASSIGN,
+  SEQUENCE,
+  ELVIS,
+  TERNARY,
+  OP_NOT,
+  OP_OR,
+  OP_AND,
+  OP_GT,
+  OP_GE,
+  OP_LT,
+  OP_LE,
+  OP_EQ,
+  OP_NE,
+  OP_MATCHES,
+  OP_IN,
+  OP_PLUS,
+  OP_MINUS,
+  OP_MULTIPLY,
+  OP_DIVIDE,
+  OP_MODULUS,
+  OP_POWER,
+  FUNCTION,
+  VARIABLE,
+  PARAMETER,
+  METHOD,
+  PROPERTY,
+  PROJECTION,
+  FLAT,
+  SELECTION,
+  INDEXER,
+  INLINE_LIST,
+  INLINE_MAP,
+  COMPOUND_EXPRESSION,
+  NATIVE,
+};
+
+class AstNode : public AstValues<> {
  public:
   AstNode(const size_t start_pos, const size_t end_pos)
       : start_pos_(start_pos), end_pos_(end_pos) {}
+  AstNode(const size_t start_pos, const size_t end_pos, const std::vector<std::shared_ptr<AstNode>> &children)
+      : start_pos_(start_pos), end_pos_(end_pos) {
+    for (auto child : children) {
+      if (child) {
+        children_.push_back(child);
+      }
+    }
+  }
   virtual ~AstNode() {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  /**
+   * evaluate the node, instrumented only when a profiler is attached to the context
+   * @param context
+   * @return
+   */
+  const json *evaluate(EvaluationContext &context) {
+    return context.resolve(navigate(context));
+  }
+
+  /**
+   * evaluate the node without converting a native object it returns, see DocumentAdapter
+   * @param context
+   * @return
+   */
+  const json *navigate(EvaluationContext &context) {
+    if (context.has_budget() && !context.on_step()) {
+      return context.fail_budget(get_start_pos());
+    }
+    if (context.get_profiler()) {
+      Profiler::Scope scope(*context.get_profiler(), this, get_name());
+      return do_evaluate(context);
+    }
+    return do_evaluate(context);
+  }
+
+  virtual const json *do_evaluate(EvaluationContext & /*context*/) {
     return &value_empty_;
   }
 
-  size_t get_start_pos() {
+  virtual const char *get_name() const {
+    return "AstNode";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OTHER;
+  }
+
+  const std::vector<std::shared_ptr<AstNode>> &get_children() const {
+    return children_;
+  }
+
+  size_t get_start_pos() const {
     return start_pos_;
   }
 
-  size_t get_end_pos() {
+  size_t get_end_pos() const {
     return end_pos_;
   }
 
@@ -38,23 +159,22 @@ class AstNode {
   size_t start_pos_;
   size_t end_pos_;
   std::vector<std::shared_ptr<AstNode>> children_;
-
- protected:
-  static const json value_empty_;
-  static const json value_true_;
-  static const json value_false_;
 };
 
-const json AstNode::value_empty_ = json();
-const json AstNode::value_true_ = json(true);
-const json AstNode::value_false_ = json(false);
-
 class LiteralNone : public AstNode {
  public:
   LiteralNone(const size_t start_pos, const size_t end_pos)
       : AstNode(start_pos, end_pos) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "LiteralNone";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::LITERAL_NONE;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext & /*context*/) {
     return &value_empty_;
   }
 };
@@ -64,7 +184,19 @@ class LiteralBool : public AstNode {
   LiteralBool(const size_t start_pos, const size_t end_pos, const bool value)
       : AstNode(start_pos, end_pos), value_(value) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "LiteralBool";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::LITERAL_BOOL;
+  }
+
+  const json &get_value() const {
+    return value_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext & /*context*/) {
     return &value_;
   }
 
@@ -77,7 +209,19 @@ class LiteralInt : public AstNode {
   LiteralInt(const size_t start_pos, const size_t end_pos, const int value)
       : AstNode(start_pos, end_pos), value_(value) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "LiteralInt";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::LITERAL_INT;
+  }
+
+  const json &get_value() const {
+    return value_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext & /*context*/) {
     return &value_;
   }
 
@@ -90,7 +234,19 @@ class LiteralFloat : public AstNode {
   LiteralFloat(const size_t start_pos, const size_t end_pos, const float value)
       : AstNode(start_pos, end_pos), value_(value) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "LiteralFloat";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::LITERAL_FLOAT;
+  }
+
+  const json &get_value() const {
+    return value_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext & /*context*/) {
     return &value_;
   }
 
@@ -103,7 +259,19 @@ class LiteralString : public AstNode {
   LiteralString(const size_t start_pos, const size_t end_pos, const std::string &value)
       : AstNode(start_pos, end_pos), value_(value) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "LiteralString";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::LITERAL_STRING;
+  }
+
+  const json &get_value() const {
+    return value_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext & /*context*/) {
     return &value_;
   }
 
@@ -117,24 +285,72 @@ class Assign : public AstNode {
          const size_t end_pos,
          const std::shared_ptr<AstNode> assignee,
          const std::shared_ptr<AstNode> assigned_value) :
-      AstNode(start_pos, end_pos), assignee_(assignee), assigned_value_(assigned_value) {}
+      AstNode(start_pos, end_pos, {assignee, assigned_value}), assignee_(assignee), assigned_value_(assigned_value) {}
+
+  virtual const char *get_name() const {
+    return "Assign";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::ASSIGN;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context);
 
  private:
   std::shared_ptr<AstNode> assignee_;
   std::shared_ptr<AstNode> assigned_value_;
 };
 
+/**
+ * expressions separated by ;, evaluated in order, the value is the one of the last
+ */
+class Sequence : public AstNode {
+ public:
+  Sequence(const size_t start_pos,
+           const size_t end_pos,
+           const std::vector<std::shared_ptr<AstNode>> exprs) :
+      AstNode(start_pos, end_pos, exprs), exprs_(exprs) {}
+
+  virtual const char *get_name() const {
+    return "Sequence";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::SEQUENCE;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    for (size_t i = 0; i + 1 < exprs_.size(); ++i) {
+      CPPEL_CHECK(exprs_[i]->navigate(context));
+    }
+    return exprs_.back()->navigate(context);
+  }
+
+ private:
+  std::vector<std::shared_ptr<AstNode>> exprs_;
+};
+
 class Elvis : public AstNode {
  public:
   Elvis(const size_t start_pos,
         const size_t end_pos,
         const std::shared_ptr<AstNode> if_value,
         const std::shared_ptr<AstNode> else_value) :
-      AstNode(start_pos, end_pos), if_value_(if_value), else_value_(else_value) {}
+      AstNode(start_pos, end_pos, {if_value, else_value}), if_value_(if_value), else_value_(else_value) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "Elvis";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::ELVIS;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *first = if_value_->evaluate(context);
-    if (first && !first->is_null()) {
+    CPPEL_CHECK(first);
+    if (!first->is_null()) {
       return first;
     }
     return else_value_->evaluate(context);
@@ -152,13 +368,23 @@ class Ternary : public AstNode {
           const std::shared_ptr<AstNode> condition,
           const std::shared_ptr<AstNode> if_true_value,
           const std::shared_ptr<AstNode> if_false_value) :
-      AstNode(start_pos, end_pos),
+      AstNode(start_pos, end_pos, {condition, if_true_value, if_false_value}),
       condition_(condition),
       if_true_value_(if_true_value),
       if_false_value_(if_false_value) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    return truthy(condition_->evaluate(context)) ?
+  virtual const char *get_name() const {
+    return "Ternary";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::TERNARY;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *condition = condition_->evaluate(context);
+    CPPEL_CHECK(condition);
+    return truthy(condition) ?
            if_true_value_->evaluate(context) :
            if_false_value_->evaluate(context);
   }
@@ -174,10 +400,20 @@ class OpNot : public AstNode {
   OpNot(const size_t start_pos,
         const size_t end_pos,
         const std::shared_ptr<AstNode> expr) :
-      AstNode(start_pos, end_pos), expr_(expr) {}
+      AstNode(start_pos, end_pos, {expr}), expr_(expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    return truthy(expr_->evaluate(context)) ? &value_false_ : &value_true_;
+  virtual const char *get_name() const {
+    return "OpNot";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_NOT;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *value = expr_->evaluate(context);
+    CPPEL_CHECK(value);
+    return truthy(value) ? &value_false_ : &value_true_;
   }
 
  private:
@@ -191,11 +427,25 @@ class OpOr : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = truthy(lh_expr_->evaluate(context)) || truthy(rh_expr_->evaluate(context));
-    return value ? &value_true_ : &value_false_;
+  virtual const char *get_name() const {
+    return "OpOr";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_OR;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    if (truthy(lh_value)) {
+      return &value_true_;
+    }
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    return truthy(rh_value) ? &value_true_ : &value_false_;
   }
 
  private:
@@ -209,11 +459,25 @@ class OpAnd : public AstNode {
         const size_t end_pos,
         const std::shared_ptr<AstNode> lh_expr,
         const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = truthy(lh_expr_->evaluate(context)) && truthy(rh_expr_->evaluate(context));
-    return value ? &value_true_ : &value_false_;
+  virtual const char *get_name() const {
+    return "OpAnd";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_AND;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    if (!truthy(lh_value)) {
+      return &value_false_;
+    }
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    return truthy(rh_value) ? &value_true_ : &value_false_;
   }
 
  private:
@@ -227,10 +491,22 @@ class OpGT : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpGT";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = *(lh_expr_->evaluate(context)) > *(rh_expr_->evaluate(context));
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_GT;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    bool value = *lh_value > *rh_value;
     return value ? &value_true_ : &value_false_;
   }
 
@@ -245,10 +521,22 @@ class OpGE : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpGE";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = *(lh_expr_->evaluate(context)) >= *(rh_expr_->evaluate(context));
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_GE;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    bool value = *lh_value >= *rh_value;
     return value ? &value_true_ : &value_false_;
   }
 
@@ -263,10 +551,22 @@ class OpLT : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpLT";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = *(lh_expr_->evaluate(context)) < *(rh_expr_->evaluate(context));
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_LT;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    bool value = *lh_value < *rh_value;
     return value ? &value_true_ : &value_false_;
   }
 
@@ -281,10 +581,22 @@ class OpLE : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = *(lh_expr_->evaluate(context)) <= *(rh_expr_->evaluate(context));
+  virtual const char *get_name() const {
+    return "OpLE";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_LE;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    bool value = *lh_value <= *rh_value;
     return value ? &value_true_ : &value_false_;
   }
 
@@ -299,10 +611,22 @@ class OpEQ : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = *(lh_expr_->evaluate(context)) == *(rh_expr_->evaluate(context));
+  virtual const char *get_name() const {
+    return "OpEQ";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_EQ;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    bool value = *lh_value == *rh_value;
     return value ? &value_true_ : &value_false_;
   }
 
@@ -317,10 +641,22 @@ class OpNE : public AstNode {
        const size_t end_pos,
        const std::shared_ptr<AstNode> lh_expr,
        const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    bool value = *(lh_expr_->evaluate(context)) != *(rh_expr_->evaluate(context));
+  virtual const char *get_name() const {
+    return "OpNE";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_NE;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    bool value = *lh_value != *rh_value;
     return value ? &value_true_ : &value_false_;
   }
 
@@ -329,23 +665,173 @@ class OpNE : public AstNode {
   std::shared_ptr<AstNode> rh_expr_;
 };
 
+/**
+ * whole string regex match, a literal pattern is compiled once when the node is built and
+ * other ones are looked up in the PatternCache. values which aren't strings don't match
+ */
+class OpMatches : public AstNode {
+ public:
+  OpMatches(const size_t start_pos,
+            const size_t end_pos,
+            const std::shared_ptr<AstNode> lh_expr,
+            const std::shared_ptr<AstNode> rh_expr) :
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {
+    const LiteralString *literal = dynamic_cast<const LiteralString *>(rh_expr.get());
+    if (literal) {
+      try {
+        pattern_ = std::make_shared<Pattern>(literal->get_value().get_ref<const std::string &>());
+      } catch (const std::regex_error &e) {
+        CPPEL_THROW(ParseError("invalid pattern at " + std::to_string(rh_expr->get_start_pos()) + ": " + e.what()));
+      }
+    }
+  }
+
+  virtual const char *get_name() const {
+    return "OpMatches";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_MATCHES;
+  }
+
+  /**
+   * pattern compiled at parse time, nullptr when the pattern isn't a literal
+   */
+  const std::shared_ptr<const Pattern> &get_pattern() const {
+    return pattern_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    std::shared_ptr<const Pattern> pattern = pattern_;
+    if (!pattern) {
+      const json *rh_value = rh_expr_->evaluate(context);
+      CPPEL_CHECK(rh_value);
+      if (!rh_value->is_string()) {
+        return context.fail(ErrorCode::INVALID_PATTERN, "pattern should be a string at ", rh_expr_->get_start_pos());
+      }
+      try {
+        pattern = PatternCache::instance().get(rh_value->get_ref<const std::string &>());
+      } catch (const std::regex_error &e) {
+        return context.fail(ErrorCode::INVALID_PATTERN, "invalid pattern at ", rh_expr_->get_start_pos());
+      }
+    }
+    bool value = lh_value->is_string() && pattern->matches(lh_value->get_ref<const std::string &>());
+    return value ? &value_true_ : &value_false_;
+  }
+
+ private:
+  std::shared_ptr<AstNode> lh_expr_;
+  std::shared_ptr<AstNode> rh_expr_;
+  std::shared_ptr<const Pattern> pattern_;
+};
+
+/**
+ * membership in a list, a list of literals like {'US', 'CA'} is hashed once when the node is built
+ * and other lists are scanned
+ */
+class OpIn : public AstNode {
+ public:
+  OpIn(const size_t start_pos,
+       const size_t end_pos,
+       const std::shared_ptr<AstNode> lh_expr,
+       const std::shared_ptr<AstNode> rh_expr) :
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {
+    if (rh_expr->get_kind() != NodeKind::INLINE_LIST) {
+      return;
+    }
+    json values = json::array();
+    for (auto &item : rh_expr->get_children()) {
+      const json *value = literal_value(item.get());
+      if (!value) {
+        return;
+      }
+      values.push_back(*value);
+    }
+    set_ = std::make_shared<JsonSet>(values);
+  }
+
+  virtual const char *get_name() const {
+    return "OpIn";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_IN;
+  }
+
+  /**
+   * set built at parse time, nullptr when the list isn't made of literals
+   */
+  const std::shared_ptr<const JsonSet> &get_set() const {
+    return set_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
+    if (set_) {
+      return set_->contains(lh_value) ? &value_true_ : &value_false_;
+    }
+    const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
+    if (!rh_value->is_array()) {
+      return context.fail(ErrorCode::NOT_ARRAY, "in should do with array at ", rh_expr_->get_start_pos());
+    }
+    for (auto &item : *rh_value) {
+      if (item == *lh_value) {
+        return &value_true_;
+      }
+    }
+    return &value_false_;
+  }
+
+ private:
+  std::shared_ptr<AstNode> lh_expr_;
+  std::shared_ptr<AstNode> rh_expr_;
+  std::shared_ptr<const JsonSet> set_;
+
+  static const json *literal_value(const AstNode *node) {
+    if (const LiteralString *literal = dynamic_cast<const LiteralString *>(node)) {
+      return &literal->get_value();
+    } else if (const LiteralInt *literal = dynamic_cast<const LiteralInt *>(node)) {
+      return &literal->get_value();
+    } else if (const LiteralFloat *literal = dynamic_cast<const LiteralFloat *>(node)) {
+      return &literal->get_value();
+    } else if (const LiteralBool *literal = dynamic_cast<const LiteralBool *>(node)) {
+      return &literal->get_value();
+    }
+    return nullptr;
+  }
+};
+
 class OpPlus : public AstNode {
  public:
   OpPlus(const size_t start_pos,
          const size_t end_pos,
          const std::shared_ptr<AstNode> lh_expr,
          const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
-
-  virtual const json *evaluate(EvaluationContext &context) {
-    const json lh_value = lh_expr_ ? *lh_expr_->evaluate(context) : json(0);
-    const json rh_value = rh_expr_ ? *rh_expr_->evaluate(context) : json(0);
-    if (lh_value.is_string() && rh_value.is_string()) {
-      return context.push_ref(std::make_shared<json>(lh_value.get<std::string>() + rh_value.get<std::string>()));
-    } else if (lh_value.is_number_integer() && rh_value.is_number_integer()) {
-      return context.push_ref(std::make_shared<json>(lh_value.get<int>() + rh_value.get<int>()));
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpPlus";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_PLUS;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_ ? lh_expr_->evaluate(context) : &value_zero_;
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_ ? rh_expr_->evaluate(context) : &value_zero_;
+    CPPEL_CHECK(rh_value);
+    if (lh_value->is_string() && rh_value->is_string()) {
+      return context.push_ref(std::make_shared<json>(lh_value->get_ref<const std::string &>() + rh_value->get_ref<const std::string &>()));
+    } else if (lh_value->is_number_integer() && rh_value->is_number_integer()) {
+      return context.push_ref(std::make_shared<json>(lh_value->get<int>() + rh_value->get<int>()));
     } else {
-      return context.push_ref(std::make_shared<json>(lh_value.get<float>() + rh_value.get<float>()));
+      return context.push_ref(std::make_shared<json>(lh_value->get<float>() + rh_value->get<float>()));
     }
   }
 
@@ -360,15 +846,25 @@ class OpMinus : public AstNode {
           const size_t end_pos,
           const std::shared_ptr<AstNode> lh_expr,
           const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpMinus";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    const json lh_value = lh_expr_ ? *lh_expr_->evaluate(context) : json(0);
-    const json rh_value = rh_expr_ ? *rh_expr_->evaluate(context) : json(0);
-    if (lh_value.is_number_integer() && rh_value.is_number_integer()) {
-      return context.push_ref(std::make_shared<json>(lh_value.get<int>() - rh_value.get<int>()));
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_MINUS;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *lh_value = lh_expr_ ? lh_expr_->evaluate(context) : &value_zero_;
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = rh_expr_ ? rh_expr_->evaluate(context) : &value_zero_;
+    CPPEL_CHECK(rh_value);
+    if (lh_value->is_number_integer() && rh_value->is_number_integer()) {
+      return context.push_ref(std::make_shared<json>(lh_value->get<int>() - rh_value->get<int>()));
     } else {
-      return context.push_ref(std::make_shared<json>(lh_value.get<float>() - rh_value.get<float>()));
+      return context.push_ref(std::make_shared<json>(lh_value->get<float>() - rh_value->get<float>()));
     }
   }
 
@@ -383,11 +879,21 @@ class OpMultiply : public AstNode {
              const size_t end_pos,
              const std::shared_ptr<AstNode> lh_expr,
              const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpMultiply";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_MULTIPLY;
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
     const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
     if (lh_value->is_number_integer() && rh_value->is_number_integer()) {
       return context.push_ref(std::make_shared<json>(lh_value->get<int>() * rh_value->get<int>()));
     } else {
@@ -406,11 +912,21 @@ class OpDivide : public AstNode {
            const size_t end_pos,
            const std::shared_ptr<AstNode> lh_expr,
            const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "OpDivide";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_DIVIDE;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
     const json *rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
     if (lh_value->is_number_integer() && rh_value->is_number_integer()) {
       return context.push_ref(std::make_shared<json>(lh_value->get<int>() / rh_value->get<int>()));
     } else {
@@ -429,11 +945,21 @@ class OpModulus : public AstNode {
             const size_t end_pos,
             const std::shared_ptr<AstNode> lh_expr,
             const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpModulus";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_MODULUS;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json* lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
     const json* rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
     return context.push_ref(std::make_shared<json>(lh_value->get<int>() % rh_value->get<int>()));
   }
 
@@ -448,11 +974,21 @@ class OpPower : public AstNode {
           const size_t end_pos,
           const std::shared_ptr<AstNode> lh_expr,
           const std::shared_ptr<AstNode> rh_expr) :
-      AstNode(start_pos, end_pos), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+      AstNode(start_pos, end_pos, {lh_expr, rh_expr}), lh_expr_(lh_expr), rh_expr_(rh_expr) {}
+
+  virtual const char *get_name() const {
+    return "OpPower";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::OP_POWER;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json* lh_value = lh_expr_->evaluate(context);
+    CPPEL_CHECK(lh_value);
     const json* rh_value = rh_expr_->evaluate(context);
+    CPPEL_CHECK(rh_value);
     if (lh_value->is_number_integer() && rh_value->is_number_integer() && rh_value->get<int>() > 0) {
       return context.push_ref(std::make_shared<json>(static_cast<int>(std::pow(lh_value->get<int>(), rh_value->get<int>()))));
     } else {
@@ -471,43 +1007,224 @@ class FunctionNode : public AstNode {
                const size_t end_pos,
                const std::string &function_name,
                const std::vector<std::shared_ptr<AstNode>> exprs) :
-      AstNode(start_pos, end_pos), function_name_(function_name), exprs_(exprs) {}
+      AstNode(start_pos, end_pos, exprs), function_name_(function_name), exprs_(exprs) {
+    aggregate_ = PresetFunction::find_aggregate(function_name, aggregate_kind_);
+    if (aggregate_ && exprs.size() == 1 && exprs[0]->get_kind() == NodeKind::COMPOUND_EXPRESSION
+        && !exprs[0]->get_children().empty() && exprs[0]->get_children().back()->get_kind() == NodeKind::PROJECTION) {
+      projected_ = exprs[0];
+    }
+    ordering_ = (function_name == "sort" && (exprs.size() == 1 || exprs.size() == 2))
+        || (function_name == "top" && (exprs.size() == 2 || exprs.size() == 3));
+    grouping_ = (function_name == "distinct" && exprs.size() == 1) || (function_name == "groupBy" && exprs.size() == 2);
+  }
+
+  virtual const char *get_name() const {
+    return "FunctionNode";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::FUNCTION;
+  }
 
-    Function function = context.get_function(std::make_pair(function_name_, exprs_.size()));
+  const std::string &get_function_name() const {
+    return function_name_;
+  }
+
+  /**
+   * #sort or #top, whose key argument is evaluated on each item rather than once
+   */
+  bool is_ordering() const {
+    return ordering_;
+  }
+
+  /**
+   * #distinct or #groupBy, whose key argument is evaluated on each item rather than once
+   */
+  bool is_grouping() const {
+    return grouping_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+
+    const Function *function = context.find_function(std::make_pair(function_name_, exprs_.size()));
+    if (!function) {
+      if (ordering_) {
+        return evaluate_ordering(context);
+      }
+      if (grouping_) {
+        return evaluate_grouping(context);
+      }
+      BatchLoader *loader = context.get_loader();
+      if (loader && loader->has_function(std::make_pair(function_name_, exprs_.size()))) {
+        return evaluate_loaded(context, *loader);
+      }
+      return context.fail(ErrorCode::UNKNOWN_FUNCTION, "unknown function at ", get_start_pos());
+    }
+    if (aggregate_) {
+      const PresetFunction::Preset *preset = function->target<PresetFunction::Preset>();
+      if (preset && *preset == aggregate_) {
+        return evaluate_aggregate(context);
+      }
+    }
 
     std::vector<const json*> args;
     for (auto expr : exprs_) {
-      args.push_back(expr->evaluate(context));
+      const json *arg = expr->evaluate(context);
+      CPPEL_CHECK(arg);
+      args.push_back(arg);
     }
-    return context.push_ref(function(args));
+    return context.push_ref((*function)(args));
   }
 
  private:
   std::string function_name_;
   std::vector<std::shared_ptr<AstNode>> exprs_;
+  PresetFunction::Preset aggregate_ = nullptr;
+  aggregate::Kind aggregate_kind_ = aggregate::Kind::SUM;
+  // argument ending with a projection, like items.![price], aggregated without building the array
+  std::shared_ptr<AstNode> projected_;
+  bool ordering_ = false;
+  bool grouping_ = false;
+
+  const json *evaluate_aggregate(EvaluationContext &context);
+  const json *evaluate_ordering(EvaluationContext &context);
+  const json *evaluate_grouping(EvaluationContext &context);
+
+  /**
+   * call of a batch function. a pending call is recorded by the loader and stops the evaluation,
+   * so that no branch is taken on a value which isn't loaded yet
+   */
+  const json *evaluate_loaded(EvaluationContext &context, BatchLoader &loader) {
+    std::vector<const json *> args;
+    for (auto &expr : exprs_) {
+      const json *arg = expr->evaluate(context);
+      CPPEL_CHECK(arg);
+      args.push_back(arg);
+    }
+    const json *value = loader.load(std::make_pair(function_name_, exprs_.size()), args);
+    if (!value) {
+      return context.fail(ErrorCode::PENDING, "pending function at ", get_start_pos());
+    }
+    return value;
+  }
 };
 
+/**
+ * #root, #this or a variable, which is either assigned by the expression or given to the context.
+ * variables are read from the slot bound by bind_variables
+ */
 class VariableNode : public AstNode {
  public:
   VariableNode(const size_t start_pos,
                const size_t end_pos,
                const std::string &variable_name) :
-      AstNode(start_pos, end_pos), variable_name_(variable_name) {}
+      AstNode(start_pos, end_pos), variable_name_(variable_name),
+      kind_(variable_name == "root" ? Kind::ROOT : variable_name == "this" ? Kind::THIS : Kind::SLOT) {}
+
+  virtual const char *get_name() const {
+    return "VariableNode";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::VARIABLE;
+  }
+
+  const std::string &get_variable_name() const {
+    return variable_name_;
+  }
+
+  /**
+   * neither #root nor #this
+   */
+  bool is_slot() const {
+    return kind_ == Kind::SLOT;
+  }
+
+  size_t get_slot() const {
+    return slot_;
+  }
+
+  void set_slot(const size_t slot) {
+    slot_ = slot;
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    if (variable_name_ == "root") {
-      return context.get_root_data();
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    switch (kind_) {
+      case Kind::ROOT:return context.get_root_data();
+      case Kind::THIS:return context.get_active_data();
+      default:break;
     }
-    if (variable_name_ == "this") {
-      return context.get_active_data();
+    const json *value = context.get_slot(slot_);
+    if (!value) {
+      return context.fail(ErrorCode::UNKNOWN_VARIABLE, "unexpected variable at", get_start_pos());
     }
-    CPPEL_THROW(EvaluateError("unexpected variable at" + std::to_string(get_start_pos())));
+    return value;
   }
 
  private:
+  enum class Kind {
+    ROOT,
+    THIS,
+    SLOT,
+  };
+
   std::string variable_name_;
+  Kind kind_;
+  size_t slot_ = static_cast<size_t>(-1);
+};
+
+/**
+ * the value is kept unconverted, like a native object, until the variable is used
+ */
+inline const json *Assign::do_evaluate(EvaluationContext &context) {
+  const json *value = assigned_value_->navigate(context);
+  CPPEL_CHECK(value);
+  context.set_slot(static_cast<const VariableNode *>(assignee_.get())->get_slot(), value);
+  return value;
+}
+
+/**
+ * placeholder like ?1 or :name whose value is bound to the expression, see Expression::bind.
+ * literals of an expression parsed with the cache of the Parser become parameters named $0, $1 ...
+ */
+class ParameterNode : public AstNode {
+ public:
+  ParameterNode(const size_t start_pos,
+                const size_t end_pos,
+                const std::string &parameter_name) :
+      AstNode(start_pos, end_pos), parameter_name_(parameter_name) {}
+
+  virtual const char *get_name() const {
+    return "ParameterNode";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::PARAMETER;
+  }
+
+  const std::string &get_parameter_name() const {
+    return parameter_name_;
+  }
+
+  size_t get_slot() const {
+    return slot_;
+  }
+
+  void set_slot(const size_t slot) {
+    slot_ = slot;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *value = context.get_parameter(slot_);
+    if (!value) {
+      return context.fail(ErrorCode::UNKNOWN_VARIABLE, "unbound parameter at ", get_start_pos());
+    }
+    return value;
+  }
+
+ private:
+  std::string parameter_name_;
+  size_t slot_ = static_cast<size_t>(-1);
 };
 
 class MethodNode : public AstNode {
@@ -517,22 +1234,56 @@ class MethodNode : public AstNode {
              const bool null_safe,
              const std::string &method_name,
              const std::vector<std::shared_ptr<AstNode>> exprs) :
-      AstNode(start_pos, end_pos), null_safe_(null_safe), method_name_(method_name), exprs_(exprs) {}
+      AstNode(start_pos, end_pos, exprs), null_safe_(null_safe), method_name_(method_name), exprs_(exprs),
+      method_(MethodTable::instance().find(method_name, exprs.size())) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
-    std::vector<const json*> args;
-    for (auto expr : exprs_) {
-      args.push_back(expr->evaluate(context));
-    }
-    // TODO: Method call
+  virtual const char *get_name() const {
+    return "MethodNode";
+  }
 
-    return &value_empty_;
+  virtual NodeKind get_kind() const {
+    return NodeKind::METHOD;
+  }
+
+  bool is_null_safe() const {
+    return null_safe_;
+  }
+
+  const std::string &get_method_name() const {
+    return method_name_;
+  }
+
+  /**
+   * builtin method resolved when the node is built, nullptr when there is none
+   */
+  const Method *get_method() const {
+    return method_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    const json *root = context.get_active_data();
+    if (root->is_null()) {
+      if (null_safe_) {
+        return &value_empty_;
+      }
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", get_start_pos());
+    }
+    if (!method_) {
+      return context.fail(ErrorCode::UNKNOWN_METHOD, "unknown method at ", get_start_pos());
+    }
+    const json *args[Method::MAX_ARGS] = {};
+    for (size_t i = 0; i < exprs_.size(); ++i) {
+      args[i] = exprs_[i]->evaluate(context);
+      CPPEL_CHECK(args[i]);
+    }
+    return call_method(context, method_, context.resolve(root), args, get_start_pos());
   }
 
  private:
   bool null_safe_;
   std::string method_name_;
   std::vector<std::shared_ptr<AstNode>> exprs_;
+  const Method *method_;
 };
 
 class PropertyNode : public AstNode {
@@ -543,16 +1294,39 @@ class PropertyNode : public AstNode {
                const std::string &property_name) :
       AstNode(start_pos, end_pos), null_safe_(null_safe), property_name_(property_name) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "PropertyNode";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::PROPERTY;
+  }
+
+  bool is_null_safe() const {
+    return null_safe_;
+  }
+
+  const std::string &get_property_name() const {
+    return property_name_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *root = context.get_active_data();
     if (root->is_null()) {
       if (null_safe_) {
         return &value_empty_;
       } else {
-        CPPEL_THROW(EvaluateError("unexpected null at" + std::to_string(get_start_pos())));
+        return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", get_start_pos());
       }
     }
 
+    Document document;
+    if (context.find_document(root, document)) {
+      const json *value = document.is_value ? nullptr
+                                            : document.adapter->get_property(context, document.object, property_name_);
+      return value ? value : &value_empty_;
+    }
+
     if (root->contains(property_name_)) {
       return &root->at(property_name_);
     } else {
@@ -571,24 +1345,55 @@ class Projection : public AstNode {
              const size_t end_pos,
              const bool null_safe,
              const std::shared_ptr<AstNode> expr) :
-      AstNode(start_pos, end_pos), null_safe_(null_safe), expr_(expr) {}
+      AstNode(start_pos, end_pos, {expr}), null_safe_(null_safe), expr_(expr) {}
+
+  virtual const char *get_name() const {
+    return "Projection";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::PROJECTION;
+  }
+
+  bool is_null_safe() const {
+    return null_safe_;
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  const std::shared_ptr<AstNode> &get_expr() const {
+    return expr_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *root = context.get_active_data();
     if (root->is_null()) {
       if (null_safe_) {
         return &value_empty_;
       } else {
-        CPPEL_THROW(EvaluateError("unexpected null at" + std::to_string(get_start_pos())));
+        return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", get_start_pos());
       }
     }
+    root = context.resolve_iterable(root);
 
     std::shared_ptr<json> result = std::make_shared<json>();
+    uint64_t iterated = 0;
+    bool pending = false;
     for (auto it = root->begin(); it != root->end(); ++it) {
+      if (context.has_budget() && !context.within_budget(iterated++, result->size() * sizeof(json))) {
+        return context.fail_budget(get_start_pos());
+      }
       context.push_data(&(*it));
-      result->push_back(*(expr_->evaluate(context)));
+      const json *item = expr_->evaluate(context);
       context.pop_data();
+      if (!item) {
+        // the other items don't depend on a pending call, their calls are loaded in the same round
+        CPPEL_CHECK(context.is_pending());
+        pending = true;
+        continue;
+      }
+      result->push_back(*item);
     }
+    context.on_iterate(root->size());
+    CPPEL_CHECK(!pending);
     return context.push_ref(result);
   }
 
@@ -603,30 +1408,50 @@ class Flat : public AstNode {
        const size_t end_pos,
        const bool null_safe,
        const std::shared_ptr<AstNode> expr) :
-      AstNode(start_pos, end_pos), null_safe_(null_safe), expr_(expr) {}
+      AstNode(start_pos, end_pos, {expr}), null_safe_(null_safe), expr_(expr) {}
+
+  virtual const char *get_name() const {
+    return "Flat";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::FLAT;
+  }
+
+  bool is_null_safe() const {
+    return null_safe_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *root = context.get_active_data();
     if (root->is_null()) {
       if (null_safe_) {
         return &value_empty_;
       } else {
-        CPPEL_THROW(EvaluateError("unexpected null at" + std::to_string(get_start_pos())));
+        return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", get_start_pos());
       }
     }
+    root = context.resolve_iterable(root);
 
     std::shared_ptr<json> result = std::make_shared<json>();
+    uint64_t iterated = 0;
     for (auto it = root->begin(); it != root->end(); ++it) {
+      if (context.has_budget() && !context.within_budget(iterated, result->size() * sizeof(json))) {
+        return context.fail_budget(get_start_pos());
+      }
       context.push_data(&(*it));
       const json* items = expr_->evaluate(context);
+      context.pop_data();
+      CPPEL_CHECK(items);
       if (!items->is_array()) {
-        CPPEL_THROW(EvaluateError("flat should do with array" + std::to_string(get_start_pos())));
+        return context.fail(ErrorCode::NOT_ARRAY, "flat should do with array", get_start_pos());
       }
       for (auto sub_it = items->begin(); sub_it != items->end(); ++sub_it) {
         result->push_back(*sub_it);
       }
-      context.pop_data();
+      iterated += 1 + items->size();
     }
+    context.on_iterate(iterated);
     return context.push_ref(result);
   }
 
@@ -647,49 +1472,89 @@ class Selection : public AstNode {
             const bool null_safe,
             const SelectType type,
             const std::shared_ptr<AstNode> expr) :
-      AstNode(start_pos, end_pos), null_safe_(null_safe), type_(type), expr_(expr) {}
+      AstNode(start_pos, end_pos, {expr}), null_safe_(null_safe), type_(type), expr_(expr) {}
+
+  virtual const char *get_name() const {
+    return "Selection";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::SELECTION;
+  }
+
+  bool is_null_safe() const {
+    return null_safe_;
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  SelectType get_select_type() const {
+    return type_;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *root = context.get_active_data();
     if (root->is_null()) {
       if (null_safe_) {
         return &value_empty_;
       } else {
-        CPPEL_THROW(EvaluateError("unexpected null at" + std::to_string(get_start_pos())));
+        return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", get_start_pos());
       }
     }
+    root = context.resolve_iterable(root);
 
     if (type_ == SelectType::FIRST) {
       bool found = false;
+      uint64_t iterated = 0;
       auto it = root->begin();
       while (it != root->end() && !found) {
+        if (context.has_budget() && !context.within_budget(iterated, 0)) {
+          return context.fail_budget(get_start_pos());
+        }
         context.push_data(&(*it));
-        if (!(found = truthy(expr_->evaluate(context)))) {
+        ++iterated;
+        const json *matched = expr_->evaluate(context);
+        context.pop_data();
+        CPPEL_CHECK(matched);
+        if (!(found = truthy(matched))) {
           ++it;
         }
-        context.pop_data();
       }
+      context.on_iterate(iterated);
       return found ? &(*it) : &value_empty_;
     } else if (type_ == SelectType::LAST) {
       bool found = false;
+      uint64_t iterated = 0;
       auto it = root->rbegin();
       while (it != root->rend() && !found) {
+        if (context.has_budget() && !context.within_budget(iterated, 0)) {
+          return context.fail_budget(get_start_pos());
+        }
         context.push_data(&(*it));
-        if (!(found = truthy(expr_->evaluate(context)))) {
+        ++iterated;
+        const json *matched = expr_->evaluate(context);
+        context.pop_data();
+        CPPEL_CHECK(matched);
+        if (!(found = truthy(matched))) {
           ++it;
         }
-        context.pop_data();
       }
+      context.on_iterate(iterated);
       return found ? &(*it) : &value_empty_;
     } else {
       std::shared_ptr<json> result = std::make_shared<json>();
+      uint64_t iterated = 0;
       for (auto it = root->begin(); it != root->end(); ++it) {
-        context.push_data(&(*it));
-        if (truthy(expr_->evaluate(context))) {
-          result->push_back(*it);
+        if (context.has_budget() && !context.within_budget(iterated++, result->size() * sizeof(json))) {
+          return context.fail_budget(get_start_pos());
         }
+        context.push_data(&(*it));
+        const json *matched = expr_->evaluate(context);
         context.pop_data();
+        CPPEL_CHECK(matched);
+        if (truthy(matched)) {
+          result->push_back(context.take_value(&(*it)));
+        }
       }
+      context.on_iterate(root->size());
       return context.push_ref(result);
     }
   }
@@ -705,25 +1570,51 @@ class Indexer : public AstNode {
   Indexer(const size_t start_pos,
           const size_t end_pos,
           const std::shared_ptr<AstNode> expr) :
-      AstNode(start_pos, end_pos), expr_(expr) {}
+      AstNode(start_pos, end_pos, {expr}), expr_(expr) {}
+
+  virtual const char *get_name() const {
+    return "Indexer";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::INDEXER;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     const json *root = context.get_active_data();
     if (root->is_null()) {
-      CPPEL_THROW(EvaluateError("unexpected null at" + std::to_string(get_start_pos())));
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", get_start_pos());
     }
     const json* index_value = expr_->evaluate(context);
+    CPPEL_CHECK(index_value);
+    Document document;
+    if (context.find_document(root, document) && !document.is_value && !document.is_array()) {
+      if (!index_value->is_string()) {
+        return context.fail(ErrorCode::INVALID_ARGUMENT, "key must be a string at", get_start_pos());
+      }
+      const json *value = document.adapter->get_property(context, document.object, index_value->get<std::string>());
+      if (!value) {
+        return context.fail(ErrorCode::MISSING_KEY, "unexpected indexer at", get_start_pos());
+      }
+      return value;
+    }
+    root = context.resolve_iterable(root);
+    if ((root->is_string() || root->is_array()) && !index_value->is_number_integer()) {
+      return context.fail(ErrorCode::INVALID_ARGUMENT, "index must be an integer at", get_start_pos());
+    } else if (root->is_object() && !index_value->is_string()) {
+      return context.fail(ErrorCode::INVALID_ARGUMENT, "key must be a string at", get_start_pos());
+    }
     if (root->is_string()) {
-      std::string str = root->get<std::string>();
+      const std::string &str = root->get_ref<const std::string &>();
       int index = index_value->get<int>();
-      if (index >= root->size()) {
-        CPPEL_THROW(EvaluateError("string out of index at" + std::to_string(get_start_pos())));
+      if (index < 0 || static_cast<size_t>(index) >= str.size()) {
+        return context.fail(ErrorCode::OUT_OF_RANGE, "string out of index at", get_start_pos());
       }
       return context.push_ref(std::make_shared<json>(str.substr(index, 1)));
     } else if (root->is_array()) {
       int index = index_value->get<int>();
-      if (index >= root->size()) {
-        CPPEL_THROW(EvaluateError("array out of index at" + std::to_string(get_start_pos())));
+      if (index < 0 || static_cast<size_t>(index) >= root->size()) {
+        return context.fail(ErrorCode::OUT_OF_RANGE, "array out of index at", get_start_pos());
       }
       return &root->at(index);
     } else if (root->is_object()) {
@@ -731,10 +1622,10 @@ class Indexer : public AstNode {
       if (root->contains(key)) {
         return &root->at(key);
       } else {
-        CPPEL_THROW(EvaluateError("unexpected indexer at" + std::to_string(get_start_pos())));
+        return context.fail(ErrorCode::MISSING_KEY, "unexpected indexer at", get_start_pos());
       }
     }
-    CPPEL_THROW(EvaluateError("can't be index at" + std::to_string(get_start_pos())));
+    return context.fail(ErrorCode::NOT_INDEXABLE, "can't be index at", get_start_pos());
   }
 
  private:
@@ -750,12 +1641,22 @@ class InlineList : public AstNode {
   InlineList(const size_t start_pos,
              const size_t end_pos,
              const std::vector<std::shared_ptr<AstNode>> exprs) :
-      AstNode(start_pos, end_pos), exprs_(exprs) {}
+      AstNode(start_pos, end_pos, exprs), exprs_(exprs) {}
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual const char *get_name() const {
+    return "InlineList";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::INLINE_LIST;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     std::shared_ptr<json> array = std::make_shared<json>();
     for (auto expr : exprs_) {
-      array->push_back(*(expr->evaluate(context)));
+      const json *item = expr->evaluate(context);
+      CPPEL_CHECK(item);
+      array->push_back(*item);
     }
     return context.push_ref(array);
   }
@@ -773,13 +1674,23 @@ class InlineMap : public AstNode {
   InlineMap(const size_t start_pos,
             const size_t end_pos,
             const std::vector<std::shared_ptr<AstNode>> exprs) :
-      AstNode(start_pos, end_pos), exprs_(exprs) {}
+      AstNode(start_pos, end_pos, exprs), exprs_(exprs) {}
+
+  virtual const char *get_name() const {
+    return "InlineMap";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::INLINE_MAP;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
     std::shared_ptr<json> map = std::make_shared<json>();
-    for (int i = 0; i < exprs_.size(); i += 2) {
+    for (size_t i = 0; i < exprs_.size(); i += 2) {
       const json* key = exprs_[i]->evaluate(context);
+      CPPEL_CHECK(key);
       const json* value = exprs_[i + 1]->evaluate(context);
+      CPPEL_CHECK(value);
       if (key->is_number_integer()) {
         map->at(key->get<int>()) = *value;
       } else {
@@ -798,19 +1709,38 @@ class CompoundExpression : public AstNode {
   CompoundExpression(const size_t start_pos,
                      const size_t end_pos,
                      const std::vector<std::shared_ptr<AstNode>> exprs) :
-      AstNode(start_pos, end_pos), exprs_(exprs) {}
+      AstNode(start_pos, end_pos, exprs), exprs_(exprs) {}
+
+  virtual const char *get_name() const {
+    return "CompoundExpression";
+  }
 
-  virtual const json *evaluate(EvaluationContext &context) {
+  virtual NodeKind get_kind() const {
+    return NodeKind::COMPOUND_EXPRESSION;
+  }
+
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    return navigate_parts(context, exprs_.size());
+  }
+
+  /**
+   * navigate the first count parts of the expression
+   * @param context
+   * @param count
+   * @return
+   */
+  const json *navigate_parts(EvaluationContext &context, const size_t count) {
     const json *root = context.get_active_data();
     if (root->is_null()) {
-      CPPEL_THROW(EvaluateError("unexpected null at " + std::to_string(get_start_pos())));
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at ", get_start_pos());
     }
 
     const json* result = root;
-    for (auto expr : exprs_) {
+    for (size_t i = 0; i < count; ++i) {
       context.push_data(result);
-      result = expr->evaluate(context);
+      result = exprs_[i]->navigate(context);
       context.pop_data();
+      CPPEL_CHECK(result);
     }
 
     return result;
@@ -820,4 +1750,250 @@ class CompoundExpression : public AstNode {
   std::vector<std::shared_ptr<AstNode>> exprs_;
 };
 
+/**
+ * preset aggregate, a projection is accumulated item by item like Projection::do_evaluate
+ * without building the projected array. values which aren't numbers fail with INVALID_ARGUMENT
+ */
+inline const json *FunctionNode::evaluate_aggregate(EvaluationContext &context) {
+  aggregate::Accumulator accumulator(aggregate_kind_);
+  if (!projected_) {
+    const json *list = exprs_[0]->evaluate(context);
+    CPPEL_CHECK(list);
+    if (!accumulator.add_all(*list)) {
+      return context.fail(ErrorCode::INVALID_ARGUMENT, accumulator.get_error(), get_start_pos());
+    }
+    return context.push_value(accumulator.result());
+  }
+  CompoundExpression *compound = static_cast<CompoundExpression *>(projected_.get());
+  const Projection *projection = static_cast<const Projection *>(compound->get_children().back().get());
+  const json *root = compound->navigate_parts(context, compound->get_children().size() - 1);
+  CPPEL_CHECK(root);
+  if (root->is_null()) {
+    if (!projection->is_null_safe()) {
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", projection->get_start_pos());
+    }
+    accumulator.add_all(*root);
+    return context.fail(ErrorCode::INVALID_ARGUMENT, accumulator.get_error(), get_start_pos());
+  }
+  root = context.resolve_iterable(root);
+
+  bool pending = false;
+  uint64_t iterated = 0;
+  for (auto it = root->begin(); it != root->end(); ++it) {
+    if (context.has_budget() && !context.within_budget(iterated++, 0)) {
+      return context.fail_budget(projection->get_start_pos());
+    }
+    context.push_data(&(*it));
+    const json *item = projection->get_expr()->evaluate(context);
+    context.pop_data();
+    if (!item) {
+      CPPEL_CHECK(context.is_pending());
+      pending = true;
+      continue;
+    }
+    if (!accumulator.add(*item)) {
+      return context.fail(ErrorCode::INVALID_ARGUMENT, accumulator.get_error(), get_start_pos());
+    }
+  }
+  context.on_iterate(root->size());
+  CPPEL_CHECK(!pending);
+  return context.push_value(accumulator.result());
+}
+
+/**
+ * #sort(list[, key]) orders the items by ascending key and #top(list, k[, key]) keeps the k items
+ * with the greatest keys, in descending order. the key is evaluated once per item with the item
+ * as #this, the item itself by default. ties keep the order of the list, only the kept items are copied
+ */
+inline const json *FunctionNode::evaluate_ordering(EvaluationContext &context) {
+  using Key = std::pair<const json *, size_t>;
+  bool top = function_name_ == "top";
+  const json *list = exprs_[0]->navigate(context);
+  CPPEL_CHECK(list);
+  list = context.resolve_iterable(list);
+  if (!list->is_array()) {
+    return context.fail(ErrorCode::NOT_ARRAY, "sort should do with array at ", get_start_pos());
+  }
+  size_t count = list->size();
+  if (top) {
+    const json *k = exprs_[1]->evaluate(context);
+    CPPEL_CHECK(k);
+    if (!k->is_number_integer()) {
+      return context.fail(ErrorCode::INVALID_ARGUMENT, "top should be given an integer count at ",
+                          exprs_[1]->get_start_pos());
+    }
+    int64_t k_value = k->get<int64_t>();
+    count = k_value <= 0 ? 0 : std::min(count, static_cast<size_t>(k_value));
+  }
+
+  AstNode *key_expr = exprs_.size() == (top ? 3u : 2u) ? exprs_.back().get() : nullptr;
+  std::vector<Key> keys;
+  keys.reserve(list->size());
+  for (size_t i = 0; i < list->size(); ++i) {
+    if (context.has_budget() && !context.within_budget(i, keys.size() * sizeof(Key))) {
+      return context.fail_budget(get_start_pos());
+    }
+    const json *item = &(*list)[i];
+    const json *key;
+    if (key_expr) {
+      context.push_data(item);
+      key = key_expr->evaluate(context);
+      context.pop_data();
+      CPPEL_CHECK(key);
+    } else {
+      key = context.resolve(item);
+    }
+    keys.emplace_back(key, i);
+  }
+  context.on_iterate(list->size());
+
+  if (top) {
+    auto descending = [](const Key &lh, const Key &rh) {
+      return *rh.first < *lh.first || (!(*lh.first < *rh.first) && lh.second < rh.second);
+    };
+    if (count < keys.size()) {
+      std::nth_element(keys.begin(), keys.begin() + count, keys.end(), descending);
+    }
+    std::sort(keys.begin(), keys.begin() + count, descending);
+  } else {
+    std::sort(keys.begin(), keys.end(), [](const Key &lh, const Key &rh) {
+      return *lh.first < *rh.first || (!(*rh.first < *lh.first) && lh.second < rh.second);
+    });
+  }
+
+  json result = json::array();
+  json::array_t &items = result.get_ref<json::array_t &>();
+  items.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    items.push_back(context.take_value(&(*list)[keys[i].second]));
+  }
+  return context.push_value(std::move(result));
+}
+
+/**
+ * #distinct(list) keeps the first of the equal items and #groupBy(list, key) gathers the items
+ * by key into an object. the key is evaluated once per item with the item as #this. both hash the
+ * values, groups and items keep the order of the list. keys which aren't strings are serialized once
+ * grouped, so different keys serialized alike, like 1 and '1', fail with INVALID_ARGUMENT
+ */
+inline const json *FunctionNode::evaluate_grouping(EvaluationContext &context) {
+  const json *list = exprs_[0]->navigate(context);
+  CPPEL_CHECK(list);
+  list = context.resolve_iterable(list);
+  if (!list->is_array()) {
+    return context.fail(ErrorCode::NOT_ARRAY,
+                        exprs_.size() == 1 ? "distinct should do with array at " : "groupBy should do with array at ",
+                        get_start_pos());
+  }
+
+  if (exprs_.size() == 1) {
+    std::unordered_set<const json *, JsonHash, JsonEqual> seen(list->size());
+    json result = json::array();
+    json::array_t &items = result.get_ref<json::array_t &>();
+    uint64_t iterated = 0;
+    for (auto it = list->begin(); it != list->end(); ++it) {
+      if (context.has_budget() && !context.within_budget(iterated++, items.size() * sizeof(json))) {
+        return context.fail_budget(get_start_pos());
+      }
+      const json *item = context.resolve(&(*it));
+      if (seen.insert(item).second) {
+        items.push_back(*item);
+      }
+    }
+    context.on_iterate(list->size());
+    return context.push_value(std::move(result));
+  }
+
+  AstNode *key_expr = exprs_[1].get();
+  // the index points into the keys of the groups, which a deque doesn't move
+  std::unordered_map<const json *, size_t, JsonHash, JsonEqual> index;
+  std::deque<std::pair<json, json>> groups;
+  uint64_t iterated = 0;
+  for (auto it = list->begin(); it != list->end(); ++it) {
+    // every item iterated so far was copied into a group
+    if (context.has_budget() && !context.within_budget(iterated, iterated * sizeof(json))) {
+      return context.fail_budget(get_start_pos());
+    }
+    ++iterated;
+    context.push_data(&(*it));
+    const json *key = key_expr->evaluate(context);
+    context.pop_data();
+    CPPEL_CHECK(key);
+    key = context.resolve(key);
+    auto found = index.find(key);
+    if (found == index.end()) {
+      groups.emplace_back(*key, json::array());
+      found = index.emplace(&groups.back().first, groups.size() - 1).first;
+    }
+    groups[found->second].second.push_back(context.take_value(&(*it)));
+  }
+  context.on_iterate(list->size());
+
+  json result = json::object();
+  json::object_t &object = result.get_ref<json::object_t &>();
+  for (auto &group : groups) {
+    std::string name = group.first.is_string() ? group.first.get<std::string>() : group.first.dump();
+    if (!object.emplace(std::move(name), std::move(group.second)).second) {
+      return context.fail(ErrorCode::INVALID_ARGUMENT, "groupBy keys serialized alike at ", get_start_pos());
+    }
+  }
+  return context.push_value(std::move(result));
+}
+
+/**
+ * give the variables of a tree their slot, in the order they first appear
+ * @param node
+ * @param variables names of the slots
+ */
+inline void bind_variables(AstNode *node, Variables &variables) {
+  VariableNode *variable = dynamic_cast<VariableNode *>(node);
+  if (variable && variable->is_slot()) {
+    auto it = std::find(variables.begin(), variables.end(), variable->get_variable_name());
+    variable->set_slot(it - variables.begin());
+    if (it == variables.end()) {
+      variables.push_back(variable->get_variable_name());
+    }
+  }
+  for (auto &child : node->get_children()) {
+    bind_variables(child.get(), variables);
+  }
+}
+
+/**
+ * @return names of the slots, nullptr when the tree has no variable
+ */
+inline std::shared_ptr<const Variables> bind_variables(const std::shared_ptr<AstNode> &root) {
+  std::shared_ptr<Variables> variables = std::make_shared<Variables>();
+  bind_variables(root.get(), *variables);
+  return variables->empty() ? nullptr : variables;
+}
+
+/**
+ * give the parameters of a tree their slot, in the order they first appear
+ * @param node
+ * @param parameters names of the slots
+ */
+inline void bind_parameters(AstNode *node, Parameters &parameters) {
+  ParameterNode *parameter = dynamic_cast<ParameterNode *>(node);
+  if (parameter) {
+    auto it = std::find(parameters.begin(), parameters.end(), parameter->get_parameter_name());
+    parameter->set_slot(it - parameters.begin());
+    if (it == parameters.end()) {
+      parameters.push_back(parameter->get_parameter_name());
+    }
+  }
+  for (auto &child : node->get_children()) {
+    bind_parameters(child.get(), parameters);
+  }
+}
+
+/**
+ * @return names of the slots, nullptr when the tree has no parameter
+ */
+inline std::shared_ptr<const Parameters> bind_parameters(const std::shared_ptr<AstNode> &root) {
+  std::shared_ptr<Parameters> parameters = std::make_shared<Parameters>();
+  bind_parameters(root.get(), *parameters);
+  return parameters->empty() ? nullptr : parameters;
+}
+
 }  // namespace cppel
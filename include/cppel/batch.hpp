@@ -0,0 +1,102 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "context.hpp"
+#include "expression.hpp"
+#include "loader.hpp"
+
+namespace cppel {
+
+/**
+ * evaluations sharing the requests of their batch functions
+ *
+ * every round evaluates the unfinished evaluations, each one stops at its first call which isn't
+ * loaded and the loader collects its key, then the keys are dispatched as one request per function.
+ * a stopped evaluation is replayed from the start in the next round, with the loaded values. so the
+ * number of requests is the number of calls made one after the other by an evaluation instead of
+ * the number of evaluations, and functions of the context may be called again by the replays
+ */
+class AsyncBatch {
+ public:
+  explicit AsyncBatch(BatchLoader &loader) : loader_(loader) {}
+
+  /**
+   * add an evaluation of expr on context, both must outlive run()
+   * @return index of the result
+   */
+  size_t add(Expression &expr, EvaluationContext &context) {
+    context.set_loader(&loader_);
+    evaluations_.push_back(Evaluation{&expr, &context});
+    return evaluations_.size() - 1;
+  }
+
+  /**
+   * add an evaluation of expr on data, with a context owned by the batch
+   */
+  size_t add(Expression &expr, const json &data) {
+    contexts_.emplace_back(data);
+    return add(expr, contexts_.back());
+  }
+
+  /**
+   * evaluate everything, the evaluations still pending after max_rounds fail with ErrorCode::PENDING
+   * @return results by index
+   */
+  std::vector<EvaluateResult> run(const size_t max_rounds = 16) {
+    std::vector<EvaluateResult> results(evaluations_.size());
+    std::vector<size_t> remaining(evaluations_.size());
+    for (size_t i = 0; i < remaining.size(); ++i) {
+      remaining[i] = i;
+    }
+    rounds_ = 0;
+    while (!remaining.empty() && rounds_ < max_rounds) {
+      ++rounds_;
+      std::vector<size_t> suspended;
+      for (size_t index : remaining) {
+        Evaluation &evaluation = evaluations_[index];
+        uint64_t misses = loader_.get_misses();
+        results[index] = evaluation.expr->try_evaluate(*evaluation.context);
+        if (loader_.get_misses() != misses) {
+          // failed with ErrorCode::PENDING, the result of the replay replaces it
+          suspended.push_back(index);
+        }
+      }
+      remaining.swap(suspended);
+      if (!remaining.empty()) {
+        loader_.dispatch();
+      }
+    }
+    // the evaluations still pending after the last round are replayed with its requests
+    for (size_t index : remaining) {
+      Evaluation &evaluation = evaluations_[index];
+      results[index] = evaluation.expr->try_evaluate(*evaluation.context);
+    }
+    return results;
+  }
+
+  /**
+   * number of rounds of the last run, each one dispatched at most one request per function
+   */
+  size_t get_rounds() const {
+    return rounds_;
+  }
+
+ private:
+  struct Evaluation {
+    Expression *expr;
+    EvaluationContext *context;
+  };
+
+  BatchLoader &loader_;
+  std::vector<Evaluation> evaluations_;
+  std::deque<EvaluationContext> contexts_;
+  size_t rounds_ = 0;
+};
+
+} // namespace cppel
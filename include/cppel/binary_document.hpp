@@ -0,0 +1,522 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "context.hpp"
+#include "document.hpp"
+#include "exception.hpp"
+#include "mapping.hpp"
+
+/**
+ * immutable binary documents
+ *
+ * a json value is written once into a contiguous buffer that expressions are evaluated on in place:
+ *
+ *    header | nodes
+ *
+ * nodes are 8 bytes aligned, a node is its type and count followed by:
+ *   int, uint, float    the 8 bytes value
+ *   string              count bytes and a '\0'
+ *   array               count offsets of the elements
+ *   object              count pairs of key and value offsets, sorted by key
+ *
+ * offsets are from the start of the buffer and equal strings are stored once. the file is
+ * mapped read only, so processes evaluating the same document share one copy
+ */
+
+namespace cppel {
+
+namespace binary {
+
+enum class Type : uint32_t {
+  NONE,
+  FALSE_VALUE,
+  TRUE_VALUE,
+  INT,
+  UINT,
+  FLOAT,
+  STRING,
+  ARRAY,
+  OBJECT,
+};
+
+const uint32_t MAGIC = 0x44425043;  // "CPBD"
+const uint32_t VERSION = 1;
+const uint32_t ENDIAN_MARK = 0x01020304;
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t root;
+  uint64_t size;
+};
+
+struct NodeHeader {
+  Type type;
+  uint32_t count;
+};
+
+struct Member {
+  uint32_t key;
+  uint32_t value;
+};
+
+static_assert(sizeof(Header) % 8 == 0, "header must keep the nodes aligned");
+static_assert(sizeof(NodeHeader) == 8, "node header must keep the values aligned");
+
+inline size_t align8(const size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+} // namespace binary
+
+class BinaryDocumentWriter {
+ public:
+  explicit BinaryDocumentWriter(const json &data) {
+    bytes_.resize(sizeof(binary::Header), '\0');
+    binary::Header header = binary::Header();
+    header.magic = binary::MAGIC;
+    header.version = binary::VERSION;
+    header.byte_order = binary::ENDIAN_MARK;
+    header.root = add_node(data);
+    header.size = bytes_.size();
+    std::memcpy(&bytes_[0], &header, sizeof(header));
+  }
+
+  const std::string &to_bytes() const {
+    return bytes_;
+  }
+
+  void write(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes_.data(), bytes_.size());
+    if (!out) {
+      CPPEL_THROW(LoadError("can't write document " + path));
+    }
+  }
+
+ private:
+  std::string bytes_;
+  std::unordered_map<std::string, uint32_t> string_offsets_;
+
+  uint32_t begin_node(const binary::Type type, const size_t count, const size_t payload_size) {
+    size_t offset = bytes_.size();
+    if (offset + sizeof(binary::NodeHeader) + payload_size > UINT32_MAX) {
+      CPPEL_THROW(LoadError("document larger than 4GB"));
+    }
+    binary::NodeHeader header = {type, static_cast<uint32_t>(count)};
+    bytes_.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    return static_cast<uint32_t>(offset);
+  }
+
+  void end_node() {
+    bytes_.resize(binary::align8(bytes_.size()), '\0');
+  }
+
+  template<typename T>
+  uint32_t add_scalar(const binary::Type type, const T value) {
+    uint32_t offset = begin_node(type, 0, sizeof(value));
+    bytes_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    return offset;
+  }
+
+  uint32_t add_string(const std::string &str) {
+    auto it = string_offsets_.find(str);
+    if (it != string_offsets_.end()) {
+      return it->second;
+    }
+    uint32_t offset = begin_node(binary::Type::STRING, str.size(), str.size() + 1);
+    bytes_.append(str.data(), str.size());
+    bytes_.push_back('\0');
+    end_node();
+    string_offsets_.emplace(str, offset);
+    return offset;
+  }
+
+  /**
+   * children are written before their parent, which refers to them by offset
+   */
+  uint32_t add_node(const json &data) {
+    switch (data.type()) {
+      case json::value_t::boolean:
+        return begin_node(data.get<bool>() ? binary::Type::TRUE_VALUE : binary::Type::FALSE_VALUE, 0, 0);
+      case json::value_t::number_integer:
+        return add_scalar(binary::Type::INT, data.get<int64_t>());
+      case json::value_t::number_unsigned:
+        return add_scalar(binary::Type::UINT, data.get<uint64_t>());
+      case json::value_t::number_float:
+        return add_scalar(binary::Type::FLOAT, data.get<double>());
+      case json::value_t::string:
+        return add_string(data.get_ref<const std::string &>());
+      case json::value_t::array: {
+        std::vector<uint32_t> elements;
+        elements.reserve(data.size());
+        for (auto &element : data) {
+          elements.push_back(add_node(element));
+        }
+        uint32_t offset = begin_node(binary::Type::ARRAY, elements.size(), elements.size() * sizeof(uint32_t));
+        bytes_.append(reinterpret_cast<const char *>(elements.data()), elements.size() * sizeof(uint32_t));
+        end_node();
+        return offset;
+      }
+      case json::value_t::object: {
+        // object_t is a std::map, so the members come sorted by key
+        std::vector<binary::Member> members;
+        members.reserve(data.size());
+        for (auto it = data.begin(); it != data.end(); ++it) {
+          binary::Member member;
+          member.key = add_string(it.key());
+          member.value = add_node(it.value());
+          members.push_back(member);
+        }
+        uint32_t offset = begin_node(binary::Type::OBJECT, members.size(), members.size() * sizeof(binary::Member));
+        bytes_.append(reinterpret_cast<const char *>(members.data()), members.size() * sizeof(binary::Member));
+        end_node();
+        return offset;
+      }
+      default:
+        return begin_node(binary::Type::NONE, 0, 0);
+    }
+  }
+};
+
+/**
+ * evaluates the nodes of a binary document in place, objects are the addresses of the nodes. scalars
+ * are materialized once per document, on the first read, and served by address like parsed json
+ */
+class BinaryDocumentAdapter : public DocumentAdapter {
+ public:
+  BinaryDocumentAdapter(const char *data, const size_t size) : data_(data), size_(size) {}
+
+  BinaryDocumentAdapter(const BinaryDocumentAdapter &) = delete;
+  BinaryDocumentAdapter &operator=(const BinaryDocumentAdapter &) = delete;
+
+  virtual const json *get_property(EvaluationContext &context, const void *object, const std::string &name) const {
+    const binary::NodeHeader *node = as_node(object);
+    if (node->type != binary::Type::OBJECT) {
+      return nullptr;
+    }
+    materialize_once();
+    const binary::Member *members = reinterpret_cast<const binary::Member *>(node + 1);
+    size_t low = 0;
+    size_t high = node->count;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      int cmp = compare(node_at(members[mid].key), name);
+      if (cmp == 0) {
+        return value_of(context, node_at(members[mid].value));
+      } else if (cmp < 0) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return nullptr;
+  }
+
+  virtual bool is_array(const void *object) const {
+    return as_node(object)->type == binary::Type::ARRAY;
+  }
+
+  virtual size_t size(const void *object) const {
+    return as_node(object)->count;
+  }
+
+  virtual const DocumentAdapter *get_element_adapter() const {
+    return this;
+  }
+
+  virtual const void *get_element_object(const void *object, const size_t index) const {
+    return element(as_node(object), index);
+  }
+
+  virtual bool is_element_value(const void *object, const size_t index) const {
+    return !is_container(element(as_node(object), index));
+  }
+
+  virtual const json *get_element(EvaluationContext & /*context*/, const void *object, const size_t index) const {
+    return scalar_of(element(as_node(object), index));
+  }
+
+  virtual json to_json(const void *object) const {
+    const binary::NodeHeader *node = as_node(object);
+    if (node->type == binary::Type::ARRAY) {
+      json value = json::array();
+      value.get_ref<json::array_t &>().reserve(node->count);
+      const uint32_t *elements = payload<uint32_t>(node, node->count);
+      for (uint32_t i = 0; i < node->count; ++i) {
+        value.push_back(to_json(get_node(elements[i])));
+      }
+      return value;
+    } else if (node->type == binary::Type::OBJECT) {
+      json value = json::object();
+      json::object_t &object_value = value.get_ref<json::object_t &>();
+      const binary::Member *members = payload<binary::Member>(node, node->count);
+      for (uint32_t i = 0; i < node->count; ++i) {
+        // members are sorted, each one is inserted at the end of the map
+        const binary::NodeHeader *key = get_node(members[i].key);
+        object_value.emplace_hint(object_value.end(),
+                                  std::string(payload<char>(key, key->count), key->count),
+                                  to_json(get_node(members[i].value)));
+      }
+      return value;
+    }
+    return scalar(node);
+  }
+
+ private:
+  static const uint32_t NO_NODE = 0;
+  static const uint32_t CONTAINER_NODE = UINT32_MAX;
+
+  const char *data_;
+  size_t size_;
+  mutable std::once_flag materialized_;
+  // by offset / 8, the index + 1 in scalars_ of a scalar node, CONTAINER_NODE or NO_NODE (0)
+  mutable std::vector<uint32_t> slots_;
+  mutable std::vector<json> scalars_;
+
+  static const binary::NodeHeader *as_node(const void *object) {
+    return static_cast<const binary::NodeHeader *>(object);
+  }
+
+  static bool is_container(const binary::NodeHeader *node) {
+    return node->type == binary::Type::ARRAY || node->type == binary::Type::OBJECT;
+  }
+
+  const binary::NodeHeader *get_node(const uint32_t offset) const {
+    if (offset % 8 != 0 || static_cast<uint64_t>(offset) + sizeof(binary::NodeHeader) > size_) {
+      CPPEL_THROW(LoadError("node out of document " + std::to_string(offset)));
+    }
+    return reinterpret_cast<const binary::NodeHeader *>(data_ + offset);
+  }
+
+  /**
+   * the values following the node header, checked against the end of the document
+   */
+  template<typename T>
+  const T *payload(const binary::NodeHeader *node, const size_t count) const {
+    const char *begin = reinterpret_cast<const char *>(node + 1);
+    if (static_cast<uint64_t>(begin - data_) + count * sizeof(T) > size_) {
+      CPPEL_THROW(LoadError("node out of document"));
+    }
+    return reinterpret_cast<const T *>(begin);
+  }
+
+  /**
+   * element of an array, the offsets are checked once by materialize()
+   */
+  const binary::NodeHeader *element(const binary::NodeHeader *node, const size_t index) const {
+    materialize_once();
+    return node_at(reinterpret_cast<const uint32_t *>(node + 1)[index]);
+  }
+
+  const binary::NodeHeader *node_at(const uint32_t offset) const {
+    return reinterpret_cast<const binary::NodeHeader *>(data_ + offset);
+  }
+
+  static int compare(const binary::NodeHeader *key, const std::string &name) {
+    const char *str = reinterpret_cast<const char *>(key + 1);
+    size_t length = key->count < name.size() ? key->count : name.size();
+    int cmp = std::char_traits<char>::compare(str, name.data(), length);
+    if (cmp != 0) {
+      return cmp;
+    }
+    return key->count < name.size() ? -1 : (key->count > name.size() ? 1 : 0);
+  }
+
+  const json *value_of(EvaluationContext &context, const binary::NodeHeader *node) const {
+    if (is_container(node)) {
+      return context.push_document(this, node);
+    }
+    return scalar_of(node);
+  }
+
+  const json *scalar_of(const binary::NodeHeader *node) const {
+    return &scalars_[slots_[(reinterpret_cast<const char *>(node) - data_) / 8] - 1];
+  }
+
+  void materialize_once() const {
+    std::call_once(materialized_, [this]() { materialize(); });
+  }
+
+  /**
+   * nodes follow each other from the header to the end of the document. every scalar is converted
+   * once, and every offset is checked to be a node, strings for keys, so reads don't check them again
+   */
+  void materialize() const {
+    slots_.assign(size_ / 8 + 1, 0);
+    scalars_.clear();
+    std::vector<const binary::NodeHeader *> containers;
+    size_t offset = sizeof(binary::Header);
+    while (offset < size_) {
+      const binary::NodeHeader *node = get_node(static_cast<uint32_t>(offset));
+      size_t payload_size = 0;
+      switch (node->type) {
+        case binary::Type::INT:
+        case binary::Type::UINT:
+        case binary::Type::FLOAT:
+          payload_size = 8;
+          break;
+        case binary::Type::STRING:
+          payload_size = static_cast<size_t>(node->count) + 1;
+          break;
+        case binary::Type::ARRAY:
+          payload_size = static_cast<size_t>(node->count) * sizeof(uint32_t);
+          break;
+        case binary::Type::OBJECT:
+          payload_size = static_cast<size_t>(node->count) * sizeof(binary::Member);
+          break;
+        default:
+          break;
+      }
+      payload<char>(node, payload_size);
+      if (is_container(node)) {
+        containers.push_back(node);
+        slots_[offset / 8] = CONTAINER_NODE;
+      } else {
+        scalars_.push_back(scalar(node));
+        slots_[offset / 8] = static_cast<uint32_t>(scalars_.size());
+      }
+      offset = binary::align8(offset + sizeof(binary::NodeHeader) + payload_size);
+    }
+    check_node(reinterpret_cast<const binary::Header *>(data_)->root);
+    for (const binary::NodeHeader *node : containers) {
+      if (node->type == binary::Type::ARRAY) {
+        const uint32_t *elements = reinterpret_cast<const uint32_t *>(node + 1);
+        for (uint32_t i = 0; i < node->count; ++i) {
+          check_node(elements[i]);
+        }
+      } else {
+        const binary::Member *members = reinterpret_cast<const binary::Member *>(node + 1);
+        for (uint32_t i = 0; i < node->count; ++i) {
+          if (check_node(members[i].key)->type != binary::Type::STRING) {
+            CPPEL_THROW(LoadError("key is not a string " + std::to_string(members[i].key)));
+          }
+          check_node(members[i].value);
+        }
+      }
+    }
+  }
+
+  const binary::NodeHeader *check_node(const uint32_t offset) const {
+    if (offset % 8 != 0 || offset / 8 >= slots_.size() || slots_[offset / 8] == NO_NODE) {
+      CPPEL_THROW(LoadError("node out of document " + std::to_string(offset)));
+    }
+    return node_at(offset);
+  }
+
+  json scalar(const binary::NodeHeader *node) const {
+    switch (node->type) {
+      case binary::Type::FALSE_VALUE:
+        return json(false);
+      case binary::Type::TRUE_VALUE:
+        return json(true);
+      case binary::Type::INT:
+        return json(read<int64_t>(node));
+      case binary::Type::UINT:
+        return json(read<uint64_t>(node));
+      case binary::Type::FLOAT:
+        return json(read<double>(node));
+      case binary::Type::STRING:
+        return json(std::string(payload<char>(node, node->count), node->count));
+      default:
+        return json();
+    }
+  }
+
+  template<typename T>
+  T read(const binary::NodeHeader *node) const {
+    T value;
+    std::memcpy(&value, payload<T>(node, 1), sizeof(value));
+    return value;
+  }
+};
+
+/**
+ * read only view of a binary document, backed by a mmap of the file, a buffer it owns
+ * or a buffer owned by the caller
+ *
+ *    cppel::BinaryDocument doc = cppel::BinaryDocument::open("catalog.bin");
+ *    cppel::EvaluationContext context(doc.get_adapter(), doc.get_root());
+ */
+class BinaryDocument {
+ public:
+  /**
+   * the buffer must stay valid and 8 bytes aligned as long as the document is used
+   * @param data
+   * @param size
+   */
+  BinaryDocument(const char *data, const size_t size) : adapter_(std::make_shared<BinaryDocumentAdapter>(data, size)) {
+    validate(data, size);
+  }
+
+  static BinaryDocument open(const std::string &path) {
+    std::shared_ptr<FileMapping> mapping = std::make_shared<FileMapping>(path);
+    BinaryDocument doc(mapping->data(), mapping->size());
+    doc.mapping_ = mapping;
+    return doc;
+  }
+
+  static BinaryDocument from_json(const json &data) {
+    BinaryDocumentWriter writer(data);
+    const std::string &bytes = writer.to_bytes();
+    // uint64_t storage keeps the nodes 8 bytes aligned
+    std::shared_ptr<std::vector<uint64_t>> buffer = std::make_shared<std::vector<uint64_t>>(bytes.size() / 8 + 1);
+    std::memcpy(buffer->data(), bytes.data(), bytes.size());
+    BinaryDocument doc(reinterpret_cast<const char *>(buffer->data()), bytes.size());
+    doc.buffer_ = buffer;
+    return doc;
+  }
+
+  const DocumentAdapter &get_adapter() const {
+    return *adapter_;
+  }
+
+  const void *get_root() const {
+    return root_;
+  }
+
+  json to_json() const {
+    return adapter_->to_json(root_);
+  }
+
+ private:
+  std::shared_ptr<BinaryDocumentAdapter> adapter_;
+  std::shared_ptr<FileMapping> mapping_;
+  std::shared_ptr<std::vector<uint64_t>> buffer_;
+  const void *root_ = nullptr;
+
+  void validate(const char *data, const size_t size) {
+    if (size < sizeof(binary::Header) || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+      CPPEL_THROW(LoadError("invalid document"));
+    }
+    const binary::Header *header = reinterpret_cast<const binary::Header *>(data);
+    if (header->magic != binary::MAGIC || header->byte_order != binary::ENDIAN_MARK) {
+      CPPEL_THROW(LoadError("invalid document magic or byte order"));
+    }
+    if (header->version != binary::VERSION) {
+      CPPEL_THROW(LoadError("unsupported document version " + std::to_string(header->version)));
+    }
+    if (header->size != size) {
+      CPPEL_THROW(LoadError("truncated document"));
+    }
+    if (header->root % 8 != 0 || static_cast<uint64_t>(header->root) + sizeof(binary::NodeHeader) > size) {
+      CPPEL_THROW(LoadError("root out of document"));
+    }
+    root_ = data + header->root;
+  }
+};
+
+} // namespace cppel
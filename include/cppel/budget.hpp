@@ -0,0 +1,174 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include "nlohmann/json.hpp"
+
+namespace cppel {
+
+using json = nlohmann::json;
+
+/**
+ * limits of one evaluation, 0 is unlimited
+ */
+struct EvaluationLimits {
+  // visited nodes
+  uint64_t max_steps = 0;
+  // elements iterated by projections, selections, aggregates...
+  uint64_t max_iterations = 0;
+  // approximate bytes of the temporaries held by the context
+  uint64_t max_bytes = 0;
+  std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0);
+};
+
+/**
+ * usage of an evaluation against its limits. a limit is checked when a node is visited and
+ * for every element of a loop building an array, once one is exceeded every check fails
+ * so that the evaluation unwinds. the clock is only read every 64 steps
+ */
+class Budget {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Limit {
+    NONE,
+    STEPS,
+    ITERATIONS,
+    BYTES,
+    TIME
+  };
+
+  Budget() = default;
+
+  explicit Budget(const EvaluationLimits &limits) :
+      max_steps_(unlimited(limits.max_steps)),
+      max_iterations_(unlimited(limits.max_iterations)),
+      max_bytes_(unlimited(limits.max_bytes)),
+      timeout_(limits.timeout) {}
+
+  /**
+   * reset the usage at the start of an evaluation
+   */
+  void start() {
+    steps_ = 0;
+    iterations_ = 0;
+    bytes_ = 0;
+    exceeded_ = Limit::NONE;
+    if (timeout_.count() > 0) {
+      deadline_ = Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout_);
+    }
+  }
+
+  /**
+   * count a visited node
+   * @return false when a limit is exceeded
+   */
+  bool on_step() {
+    ++steps_;
+    if (steps_ > max_steps_) {
+      return exceed(Limit::STEPS);
+    }
+    if ((steps_ & 63) == 0 && timeout_.count() > 0 && Clock::now() > deadline_) {
+      return exceed(Limit::TIME);
+    }
+    return check(0, 0);
+  }
+
+  /**
+   * check the usage of a loop before its element is evaluated
+   * @param iterating elements iterated by the loop, not counted yet
+   * @param building approximate bytes of the array built by the loop, not counted yet
+   * @return false when a limit is exceeded
+   */
+  bool check(const uint64_t iterating, const uint64_t building) {
+    if (exceeded_ != Limit::NONE) {
+      return false;
+    }
+    if (iterations_ + iterating > max_iterations_) {
+      return exceed(Limit::ITERATIONS);
+    }
+    if (bytes_ + building > max_bytes_) {
+      return exceed(Limit::BYTES);
+    }
+    return true;
+  }
+
+  void on_iterate(const uint64_t count) {
+    iterations_ += count;
+  }
+
+  void on_temporary(const json &value) {
+    bytes_ += approximate_size(value);
+  }
+
+  /**
+   * the temporaries were dropped
+   */
+  void release() {
+    bytes_ = 0;
+  }
+
+  Limit get_exceeded() const {
+    return exceeded_;
+  }
+
+  uint64_t get_steps() const {
+    return steps_;
+  }
+
+  uint64_t get_iterations() const {
+    return iterations_;
+  }
+
+  uint64_t get_bytes() const {
+    return bytes_;
+  }
+
+  /**
+   * size of a value without its nested values, which are counted when they are built
+   */
+  static uint64_t approximate_size(const json &value) {
+    switch (value.type()) {
+      case json::value_t::string:
+        return sizeof(json) + sizeof(std::string) + value.get_ref<const std::string &>().size();
+      case json::value_t::array:
+        return sizeof(json) + sizeof(json::array_t) + value.size() * sizeof(json);
+      case json::value_t::object:
+        // a node of the map holds a key, a value and the links of the tree
+        return sizeof(json) + sizeof(json::object_t)
+            + value.size() * (sizeof(json::object_t::value_type) + 4 * sizeof(void *));
+      default:
+        return sizeof(json);
+    }
+  }
+
+ private:
+  uint64_t max_steps_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_iterations_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_bytes_ = std::numeric_limits<uint64_t>::max();
+  std::chrono::nanoseconds timeout_ = std::chrono::nanoseconds(0);
+  Clock::time_point deadline_;
+  uint64_t steps_ = 0;
+  uint64_t iterations_ = 0;
+  uint64_t bytes_ = 0;
+  Limit exceeded_ = Limit::NONE;
+
+  static uint64_t unlimited(const uint64_t limit) {
+    return limit ? limit : std::numeric_limits<uint64_t>::max();
+  }
+
+  bool exceed(const Limit limit) {
+    if (exceeded_ == Limit::NONE) {
+      exceeded_ = limit;
+    }
+    return false;
+  }
+};
+
+} // namespace cppel
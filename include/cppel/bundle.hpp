@@ -0,0 +1,582 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hpp"
+#include "exception.hpp"
+#include "expression.hpp"
+#include "mapping.hpp"
+#include "native.hpp"
+#include "parser.hpp"
+
+/**
+ * precompiled expressions
+ *
+ * a bundle stores the ast of many expressions so that they can be loaded without lexing and parsing:
+ *
+ *    header | expressions[] | nodes[] | children[] | string pool
+ *
+ * every record has a fixed size and strings are offsets into the pool, loading a bundle
+ * is a mmap of the file, nodes are only constructed when an expression is requested
+ */
+
+namespace cppel {
+
+namespace bundle {
+
+enum class NodeKind : uint8_t {
+  LITERAL_NONE,
+  LITERAL_BOOL,
+  LITERAL_INT,
+  LITERAL_FLOAT,
+  LITERAL_STRING,
+  ASSIGN,
+  ELVIS,
+  TERNARY,
+  OP_NOT,
+  OP_OR,
+  OP_AND,
+  OP_GT,
+  OP_GE,
+  OP_LT,
+  OP_LE,
+  OP_EQ,
+  OP_NE,
+  OP_PLUS,
+  OP_MINUS,
+  OP_MULTIPLY,
+  OP_DIVIDE,
+  OP_MODULUS,
+  OP_POWER,
+  FUNCTION,
+  VARIABLE,
+  METHOD,
+  PROPERTY,
+  PROJECTION,
+  FLAT,
+  SELECTION,
+  INDEXER,
+  INLINE_LIST,
+  INLINE_MAP,
+  COMPOUND_EXPRESSION,
+  OP_MATCHES,
+  OP_IN,
+  SEQUENCE,
+  PARAMETER,
+};
+
+enum NodeFlag : uint8_t {
+  NULL_SAFE = 1,
+  UNARY = 2,
+};
+
+const uint32_t MAGIC = 0x4c455043;  // "CPEL"
+const uint32_t VERSION = 1;
+const uint32_t ENDIAN_MARK = 0x01020304;
+// deepest tree loaded, so that a corrupted bundle can't overflow the stack
+const size_t MAX_DEPTH = 4096;
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t expression_count;
+  uint32_t node_count;
+  uint32_t child_count;
+  uint64_t string_pool_size;
+};
+
+struct ExpressionRecord {
+  uint32_t root;
+  uint32_t str_offset;
+  uint32_t str_length;
+  uint32_t reserved;
+};
+
+struct NodeRecord {
+  uint8_t kind;
+  uint8_t flags;
+  uint16_t reserved;
+  uint32_t child_count;
+  uint32_t first_child;
+  uint32_t start_pos;
+  uint32_t end_pos;
+  uint32_t str_offset;
+  uint32_t str_length;
+  uint32_t padding;
+  int64_t value;
+};
+
+static_assert(sizeof(Header) % 8 == 0, "header must keep the records aligned");
+static_assert(sizeof(ExpressionRecord) % 8 == 0, "expression record must keep the records aligned");
+static_assert(sizeof(NodeRecord) % 8 == 0, "node record must keep the records aligned");
+
+static size_t align8(const size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+} // namespace bundle
+
+class BundleWriter {
+ public:
+  BundleWriter() {}
+
+  /**
+   * add an expression, return its index in the bundle
+   * @param expr
+   * @return
+   */
+  uint32_t add(const Expression &expr) {
+    if (expr.is_literal_parameterized()) {
+      // the values of the literals are bound to the expression, not stored in its shared plan
+      return add(Expression(InternalParser(expr.get_expr_str()).parse(), expr.get_expr_str()));
+    }
+    bundle::ExpressionRecord record = bundle::ExpressionRecord();
+    record.root = add_node(expr.get_root().get());
+    add_string(expr.get_expr_str(), record.str_offset, record.str_length);
+    expressions_.push_back(record);
+    return static_cast<uint32_t>(expressions_.size() - 1);
+  }
+
+  std::string to_bytes() const {
+    bundle::Header header = bundle::Header();
+    header.magic = bundle::MAGIC;
+    header.version = bundle::VERSION;
+    header.byte_order = bundle::ENDIAN_MARK;
+    header.expression_count = static_cast<uint32_t>(expressions_.size());
+    header.node_count = static_cast<uint32_t>(nodes_.size());
+    header.child_count = static_cast<uint32_t>(children_.size());
+    header.string_pool_size = string_pool_.size();
+
+    std::string bytes;
+    append(bytes, &header, sizeof(header));
+    append(bytes, expressions_.data(), expressions_.size() * sizeof(bundle::ExpressionRecord));
+    append(bytes, nodes_.data(), nodes_.size() * sizeof(bundle::NodeRecord));
+    append(bytes, children_.data(), children_.size() * sizeof(uint32_t));
+    bytes.resize(bundle::align8(bytes.size()), '\0');
+    bytes += string_pool_;
+    return bytes;
+  }
+
+  void write(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::string bytes = to_bytes();
+    out.write(bytes.data(), bytes.size());
+    if (!out) {
+      CPPEL_THROW(LoadError("can't write bundle " + path));
+    }
+  }
+
+ private:
+  std::vector<bundle::ExpressionRecord> expressions_;
+  std::vector<bundle::NodeRecord> nodes_;
+  std::vector<uint32_t> children_;
+  std::string string_pool_;
+  std::unordered_map<std::string, uint32_t> string_offsets_;
+
+  static void append(std::string &bytes, const void *data, const size_t size) {
+    bytes.append(static_cast<const char *>(data), size);
+  }
+
+  void add_string(const std::string &str, uint32_t &offset, uint32_t &length) {
+    auto it = string_offsets_.find(str);
+    if (it == string_offsets_.end()) {
+      it = string_offsets_.emplace(str, static_cast<uint32_t>(string_pool_.size())).first;
+      string_pool_ += str;
+    }
+    offset = it->second;
+    length = static_cast<uint32_t>(str.size());
+  }
+
+  uint32_t add_node(const AstNode *node) {
+    const NativeNode *native = dynamic_cast<const NativeNode *>(node);
+    if (native) {
+      return add_node(native->get_interpreted().get());
+    }
+    bundle::NodeRecord record = bundle::NodeRecord();
+    record.kind = static_cast<uint8_t>(kind_of(node));
+    record.start_pos = static_cast<uint32_t>(node->get_start_pos());
+    record.end_pos = static_cast<uint32_t>(node->get_end_pos());
+    write_fields(node, record);
+
+    const std::vector<std::shared_ptr<AstNode>> &children = node->get_children();
+    record.first_child = static_cast<uint32_t>(children_.size());
+    record.child_count = static_cast<uint32_t>(children.size());
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(record);
+    children_.resize(children_.size() + children.size());
+    for (size_t i = 0; i < children.size(); ++i) {
+      uint32_t child = add_node(children[i].get());
+      children_[record.first_child + i] = child;
+    }
+    return index;
+  }
+
+  void write_fields(const AstNode *node, bundle::NodeRecord &record) {
+    using bundle::NodeKind;
+    NodeKind kind = static_cast<NodeKind>(record.kind);
+    if (kind == NodeKind::LITERAL_BOOL) {
+      record.value = static_cast<const LiteralBool *>(node)->get_value().get<bool>() ? 1 : 0;
+    } else if (kind == NodeKind::LITERAL_INT) {
+      record.value = static_cast<const LiteralInt *>(node)->get_value().get<int64_t>();
+    } else if (kind == NodeKind::LITERAL_FLOAT) {
+      double value = static_cast<const LiteralFloat *>(node)->get_value().get<double>();
+      std::memcpy(&record.value, &value, sizeof(value));
+    } else if (kind == NodeKind::LITERAL_STRING) {
+      add_string(static_cast<const LiteralString *>(node)->get_value().get_ref<const std::string &>(),
+                 record.str_offset, record.str_length);
+    } else if (kind == NodeKind::OP_PLUS || kind == NodeKind::OP_MINUS) {
+      record.flags = node->get_children().size() == 1 ? bundle::UNARY : 0;
+    } else if (kind == NodeKind::FUNCTION) {
+      add_string(static_cast<const FunctionNode *>(node)->get_function_name(), record.str_offset, record.str_length);
+    } else if (kind == NodeKind::VARIABLE) {
+      add_string(static_cast<const VariableNode *>(node)->get_variable_name(), record.str_offset, record.str_length);
+    } else if (kind == NodeKind::PARAMETER) {
+      add_string(static_cast<const ParameterNode *>(node)->get_parameter_name(), record.str_offset, record.str_length);
+    } else if (kind == NodeKind::METHOD) {
+      const MethodNode *method = static_cast<const MethodNode *>(node);
+      record.flags = method->is_null_safe() ? bundle::NULL_SAFE : 0;
+      add_string(method->get_method_name(), record.str_offset, record.str_length);
+    } else if (kind == NodeKind::PROPERTY) {
+      const PropertyNode *property = static_cast<const PropertyNode *>(node);
+      record.flags = property->is_null_safe() ? bundle::NULL_SAFE : 0;
+      add_string(property->get_property_name(), record.str_offset, record.str_length);
+    } else if (kind == NodeKind::PROJECTION) {
+      record.flags = static_cast<const Projection *>(node)->is_null_safe() ? bundle::NULL_SAFE : 0;
+    } else if (kind == NodeKind::FLAT) {
+      record.flags = static_cast<const Flat *>(node)->is_null_safe() ? bundle::NULL_SAFE : 0;
+    } else if (kind == NodeKind::SELECTION) {
+      const Selection *selection = static_cast<const Selection *>(node);
+      record.flags = selection->is_null_safe() ? bundle::NULL_SAFE : 0;
+      record.value = static_cast<int64_t>(selection->get_select_type());
+    }
+  }
+
+  static bundle::NodeKind kind_of(const AstNode *node) {
+    static const std::map<NodeKind, bundle::NodeKind> kinds = {
+        {NodeKind::LITERAL_NONE, bundle::NodeKind::LITERAL_NONE},
+        {NodeKind::LITERAL_BOOL, bundle::NodeKind::LITERAL_BOOL},
+        {NodeKind::LITERAL_INT, bundle::NodeKind::LITERAL_INT},
+        {NodeKind::LITERAL_FLOAT, bundle::NodeKind::LITERAL_FLOAT},
+        {NodeKind::LITERAL_STRING, bundle::NodeKind::LITERAL_STRING},
+        {NodeKind::ASSIGN, bundle::NodeKind::ASSIGN},
+        {NodeKind::ELVIS, bundle::NodeKind::ELVIS},
+        {NodeKind::TERNARY, bundle::NodeKind::TERNARY},
+        {NodeKind::OP_NOT, bundle::NodeKind::OP_NOT},
+        {NodeKind::OP_OR, bundle::NodeKind::OP_OR},
+        {NodeKind::OP_AND, bundle::NodeKind::OP_AND},
+        {NodeKind::OP_GT, bundle::NodeKind::OP_GT},
+        {NodeKind::OP_GE, bundle::NodeKind::OP_GE},
+        {NodeKind::OP_LT, bundle::NodeKind::OP_LT},
+        {NodeKind::OP_LE, bundle::NodeKind::OP_LE},
+        {NodeKind::OP_EQ, bundle::NodeKind::OP_EQ},
+        {NodeKind::OP_NE, bundle::NodeKind::OP_NE},
+        {NodeKind::OP_PLUS, bundle::NodeKind::OP_PLUS},
+        {NodeKind::OP_MINUS, bundle::NodeKind::OP_MINUS},
+        {NodeKind::OP_MULTIPLY, bundle::NodeKind::OP_MULTIPLY},
+        {NodeKind::OP_DIVIDE, bundle::NodeKind::OP_DIVIDE},
+        {NodeKind::OP_MODULUS, bundle::NodeKind::OP_MODULUS},
+        {NodeKind::OP_POWER, bundle::NodeKind::OP_POWER},
+        {NodeKind::FUNCTION, bundle::NodeKind::FUNCTION},
+        {NodeKind::VARIABLE, bundle::NodeKind::VARIABLE},
+        {NodeKind::METHOD, bundle::NodeKind::METHOD},
+        {NodeKind::PROPERTY, bundle::NodeKind::PROPERTY},
+        {NodeKind::PROJECTION, bundle::NodeKind::PROJECTION},
+        {NodeKind::FLAT, bundle::NodeKind::FLAT},
+        {NodeKind::SELECTION, bundle::NodeKind::SELECTION},
+        {NodeKind::INDEXER, bundle::NodeKind::INDEXER},
+        {NodeKind::INLINE_LIST, bundle::NodeKind::INLINE_LIST},
+        {NodeKind::INLINE_MAP, bundle::NodeKind::INLINE_MAP},
+        {NodeKind::COMPOUND_EXPRESSION, bundle::NodeKind::COMPOUND_EXPRESSION},
+        {NodeKind::OP_MATCHES, bundle::NodeKind::OP_MATCHES},
+        {NodeKind::OP_IN, bundle::NodeKind::OP_IN},
+        {NodeKind::SEQUENCE, bundle::NodeKind::SEQUENCE},
+        {NodeKind::PARAMETER, bundle::NodeKind::PARAMETER},
+    };
+    auto it = kinds.find(node->get_kind());
+    if (it == kinds.end()) {
+      CPPEL_THROW(LoadError(std::string("can't serialize node ") + node->get_name()));
+    }
+    return it->second;
+  }
+};
+
+/**
+ * read only view of a bundle, backed by a mmap of the file or by a buffer owned by the caller
+ */
+class Bundle {
+ public:
+  /**
+   * the buffer must stay valid and 8 bytes aligned as long as the bundle is used
+   * @param data
+   * @param size
+   */
+  Bundle(const char *data, const size_t size) : data_(data), size_(size) {
+    validate();
+    build_index();
+  }
+
+  static Bundle open(const std::string &path) {
+    std::shared_ptr<FileMapping> mapping = std::make_shared<FileMapping>(path);
+    Bundle bundle(mapping->data(), mapping->size());
+    bundle.mapping_ = mapping;
+    return bundle;
+  }
+
+  size_t size() const {
+    return header_->expression_count;
+  }
+
+  std::string get_expr_str(const size_t index) const {
+    const bundle::ExpressionRecord &record = expression_record(index);
+    return std::string(string_pool_ + record.str_offset, record.str_length);
+  }
+
+  Expression get(const size_t index) const {
+    const bundle::ExpressionRecord &record = expression_record(index);
+    std::vector<uint32_t> path;
+    return Expression(build_node(record.root, path), get_expr_str(index));
+  }
+
+  /**
+   * find a precompiled expression by its source string
+   * @param expr_str
+   * @param expr
+   * @return
+   */
+  bool find(const std::string &expr_str, std::shared_ptr<Expression> &expr) const {
+    auto it = index_.find(StringRef(expr_str.data(), expr_str.size()));
+    if (it == index_.end()) {
+      return false;
+    }
+    expr = std::make_shared<Expression>(get(it->second));
+    return true;
+  }
+
+  std::vector<Expression> load_all() const {
+    std::vector<Expression> exprs;
+    exprs.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+      exprs.push_back(get(i));
+    }
+    return exprs;
+  }
+
+ private:
+  /**
+   * string in the pool, so that indexing the bundle doesn't copy the sources
+   */
+  struct StringRef {
+    const char *data;
+    size_t size;
+
+    StringRef(const char *data, const size_t size) : data(data), size(size) {}
+
+    bool operator==(const StringRef &other) const {
+      return size == other.size && std::memcmp(data, other.data, size) == 0;
+    }
+  };
+
+  struct StringRefHash {
+    size_t operator()(const StringRef &str) const {
+      uint64_t hash = 14695981039346656037ull;
+      for (size_t i = 0; i < str.size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(str.data[i])) * 1099511628211ull;
+      }
+      return static_cast<size_t>(hash);
+    }
+  };
+
+  const char *data_;
+  size_t size_;
+  std::shared_ptr<FileMapping> mapping_;
+  const bundle::Header *header_ = nullptr;
+  const bundle::ExpressionRecord *expressions_ = nullptr;
+  const bundle::NodeRecord *nodes_ = nullptr;
+  const uint32_t *children_ = nullptr;
+  const char *string_pool_ = nullptr;
+  // expressions by source string, built on load so that a bundle can be shared by threads
+  std::unordered_map<StringRef, size_t, StringRefHash> index_;
+
+  void validate() {
+    if (size_ < sizeof(bundle::Header) || reinterpret_cast<uintptr_t>(data_) % 8 != 0) {
+      CPPEL_THROW(LoadError("invalid bundle"));
+    }
+    header_ = reinterpret_cast<const bundle::Header *>(data_);
+    if (header_->magic != bundle::MAGIC || header_->byte_order != bundle::ENDIAN_MARK) {
+      CPPEL_THROW(LoadError("invalid bundle magic or byte order"));
+    }
+    if (header_->version != bundle::VERSION) {
+      CPPEL_THROW(LoadError("unsupported bundle version " + std::to_string(header_->version)));
+    }
+    size_t offset = sizeof(bundle::Header);
+    expressions_ = reinterpret_cast<const bundle::ExpressionRecord *>(data_ + offset);
+    offset = section_end(offset, header_->expression_count, sizeof(bundle::ExpressionRecord));
+    nodes_ = reinterpret_cast<const bundle::NodeRecord *>(data_ + offset);
+    offset = section_end(offset, header_->node_count, sizeof(bundle::NodeRecord));
+    children_ = reinterpret_cast<const uint32_t *>(data_ + offset);
+    offset = section_end(offset, header_->child_count, sizeof(uint32_t));
+    offset = std::min(bundle::align8(offset), size_);
+    string_pool_ = data_ + offset;
+    if (header_->string_pool_size != size_ - offset) {
+      CPPEL_THROW(LoadError("truncated bundle"));
+    }
+  }
+
+  /**
+   * end of a section of count records starting at offset, which must be in the buffer
+   */
+  size_t section_end(const size_t offset, const uint64_t count, const size_t record_size) const {
+    if (count > (size_ - offset) / record_size) {
+      CPPEL_THROW(LoadError("truncated bundle"));
+    }
+    return offset + static_cast<size_t>(count) * record_size;
+  }
+
+  void build_index() {
+    index_.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+      const bundle::ExpressionRecord &record = expression_record(i);
+      index_.emplace(StringRef(string_pool_ + record.str_offset, record.str_length), i);
+    }
+  }
+
+  const bundle::ExpressionRecord &expression_record(const size_t index) const {
+    if (index >= header_->expression_count) {
+      CPPEL_THROW(LoadError("expression out of index " + std::to_string(index)));
+    }
+    const bundle::ExpressionRecord &record = expressions_[index];
+    check_string(record.str_offset, record.str_length);
+    return record;
+  }
+
+  void check_string(const uint32_t offset, const uint32_t length) const {
+    if (static_cast<uint64_t>(offset) + length > header_->string_pool_size) {
+      CPPEL_THROW(LoadError("string out of bundle"));
+    }
+  }
+
+  /**
+   * @param path nodes being built from the root to the parent of index
+   */
+  std::shared_ptr<AstNode> build_node(const uint32_t index, std::vector<uint32_t> &path) const {
+    using bundle::NodeKind;
+    if (index >= header_->node_count) {
+      CPPEL_THROW(LoadError("node out of index " + std::to_string(index)));
+    }
+    if (path.size() >= bundle::MAX_DEPTH) {
+      CPPEL_THROW(LoadError("nodes nested deeper than " + std::to_string(bundle::MAX_DEPTH)));
+    }
+    if (std::find(path.begin(), path.end(), index) != path.end()) {
+      CPPEL_THROW(LoadError("node " + std::to_string(index) + " is its own ancestor"));
+    }
+    const bundle::NodeRecord &record = nodes_[index];
+    if (static_cast<uint64_t>(record.first_child) + record.child_count > header_->child_count) {
+      CPPEL_THROW(LoadError("children out of bundle"));
+    }
+    check_string(record.str_offset, record.str_length);
+
+    std::vector<std::shared_ptr<AstNode>> children;
+    children.reserve(record.child_count);
+    path.push_back(index);
+    for (uint32_t i = 0; i < record.child_count; ++i) {
+      children.push_back(build_node(children_[record.first_child + i], path));
+    }
+    path.pop_back();
+    size_t start_pos = record.start_pos;
+    size_t end_pos = record.end_pos;
+    bool null_safe = (record.flags & bundle::NULL_SAFE) != 0;
+    std::string str = record.str_length ? std::string(string_pool_ + record.str_offset, record.str_length) : std::string();
+
+    switch (static_cast<NodeKind>(record.kind)) {
+      case NodeKind::LITERAL_NONE:return std::make_shared<LiteralNone>(start_pos, end_pos);
+      case NodeKind::LITERAL_BOOL:return std::make_shared<LiteralBool>(start_pos, end_pos, record.value != 0);
+      case NodeKind::LITERAL_INT:
+        return std::make_shared<LiteralInt>(start_pos, end_pos, static_cast<int>(record.value));
+      case NodeKind::LITERAL_FLOAT: {
+        double value;
+        std::memcpy(&value, &record.value, sizeof(value));
+        return std::make_shared<LiteralFloat>(start_pos, end_pos, static_cast<float>(value));
+      }
+      case NodeKind::LITERAL_STRING:return std::make_shared<LiteralString>(start_pos, end_pos, str);
+      case NodeKind::ASSIGN:
+        if (!dynamic_cast<const VariableNode *>(child(children, 0).get())) {
+          CPPEL_THROW(LoadError("assignee isn't a variable"));
+        }
+        return std::make_shared<Assign>(start_pos, end_pos, child(children, 0), child(children, 1));
+      case NodeKind::ELVIS:return std::make_shared<Elvis>(start_pos, end_pos, child(children, 0), child(children, 1));
+      case NodeKind::TERNARY:
+        return std::make_shared<Ternary>(start_pos, end_pos, child(children, 0), child(children, 1), child(children, 2));
+      case NodeKind::OP_NOT:return std::make_shared<OpNot>(start_pos, end_pos, child(children, 0));
+      case NodeKind::OP_OR:return make_binary<OpOr>(start_pos, end_pos, children);
+      case NodeKind::OP_AND:return make_binary<OpAnd>(start_pos, end_pos, children);
+      case NodeKind::OP_GT:return make_binary<OpGT>(start_pos, end_pos, children);
+      case NodeKind::OP_GE:return make_binary<OpGE>(start_pos, end_pos, children);
+      case NodeKind::OP_LT:return make_binary<OpLT>(start_pos, end_pos, children);
+      case NodeKind::OP_LE:return make_binary<OpLE>(start_pos, end_pos, children);
+      case NodeKind::OP_EQ:return make_binary<OpEQ>(start_pos, end_pos, children);
+      case NodeKind::OP_NE:return make_binary<OpNE>(start_pos, end_pos, children);
+      case NodeKind::OP_PLUS:
+        if (record.flags & bundle::UNARY) {
+          return std::make_shared<OpPlus>(start_pos, end_pos, nullptr, child(children, 0));
+        }
+        return make_binary<OpPlus>(start_pos, end_pos, children);
+      case NodeKind::OP_MINUS:
+        if (record.flags & bundle::UNARY) {
+          return std::make_shared<OpMinus>(start_pos, end_pos, nullptr, child(children, 0));
+        }
+        return make_binary<OpMinus>(start_pos, end_pos, children);
+      case NodeKind::OP_MULTIPLY:return make_binary<OpMultiply>(start_pos, end_pos, children);
+      case NodeKind::OP_DIVIDE:return make_binary<OpDivide>(start_pos, end_pos, children);
+      case NodeKind::OP_MODULUS:return make_binary<OpModulus>(start_pos, end_pos, children);
+      case NodeKind::OP_POWER:return make_binary<OpPower>(start_pos, end_pos, children);
+      case NodeKind::FUNCTION:return std::make_shared<FunctionNode>(start_pos, end_pos, str, children);
+      case NodeKind::VARIABLE:return std::make_shared<VariableNode>(start_pos, end_pos, str);
+      case NodeKind::METHOD:return std::make_shared<MethodNode>(start_pos, end_pos, null_safe, str, children);
+      case NodeKind::PROPERTY:return std::make_shared<PropertyNode>(start_pos, end_pos, null_safe, str);
+      case NodeKind::PROJECTION:return std::make_shared<Projection>(start_pos, end_pos, null_safe, child(children, 0));
+      case NodeKind::FLAT:return std::make_shared<Flat>(start_pos, end_pos, null_safe, child(children, 0));
+      case NodeKind::SELECTION:
+        return std::make_shared<Selection>(start_pos, end_pos, null_safe,
+                                           static_cast<Selection::SelectType>(record.value), child(children, 0));
+      case NodeKind::INDEXER:return std::make_shared<Indexer>(start_pos, end_pos, child(children, 0));
+      case NodeKind::INLINE_LIST:return std::make_shared<InlineList>(start_pos, end_pos, children);
+      case NodeKind::INLINE_MAP:return std::make_shared<InlineMap>(start_pos, end_pos, children);
+      case NodeKind::COMPOUND_EXPRESSION:return std::make_shared<CompoundExpression>(start_pos, end_pos, children);
+      case NodeKind::OP_MATCHES:return make_binary<OpMatches>(start_pos, end_pos, children);
+      case NodeKind::OP_IN:return make_binary<OpIn>(start_pos, end_pos, children);
+      case NodeKind::SEQUENCE:
+        child(children, 0);
+        return std::make_shared<Sequence>(start_pos, end_pos, children);
+      case NodeKind::PARAMETER:return std::make_shared<ParameterNode>(start_pos, end_pos, str);
+    }
+    CPPEL_THROW(LoadError("unknown node kind " + std::to_string(record.kind)));
+  }
+
+  static std::shared_ptr<AstNode> child(const std::vector<std::shared_ptr<AstNode>> &children, const size_t i) {
+    if (i >= children.size()) {
+      CPPEL_THROW(LoadError("missing child of node"));
+    }
+    return children[i];
+  }
+
+  template<typename T>
+  static std::shared_ptr<AstNode> make_binary(const size_t start_pos,
+                                              const size_t end_pos,
+                                              const std::vector<std::shared_ptr<AstNode>> &children) {
+    return std::make_shared<T>(start_pos, end_pos, child(children, 0), child(children, 1));
+  }
+};
+
+} // namespace cppel
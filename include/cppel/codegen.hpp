@@ -0,0 +1,542 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+#include "exception.hpp"
+#include "expression.hpp"
+
+/**
+ * generate c++ source from parsed expressions
+ *
+ * every expression becomes a function where the tree is unrolled: properties are looked up
+ * directly on the active data, literals are hoisted and typed, and selection / projection / flat
+ * are inlined loops. the functions mirror the evaluation of the nodes and are registered
+ * in the NativeRegistry by their expression string when the generated file is linked
+ */
+
+namespace cppel {
+
+struct CodegenError : public CppelError {
+  explicit CodegenError(const std::string &message)
+      : CppelError("codegen_error", message) {}
+};
+
+class CodeGenerator {
+ public:
+  CodeGenerator() {}
+
+  /**
+   * generate the function of an expression
+   * @param expr
+   * @param error unsupported node of the expression when false is returned
+   * @return
+   */
+  bool add(const Expression &expr, std::string &error) {
+    std::string function_name = "cppel_native_" + std::to_string(entries_.size());
+    size_t literal_size = literals_.size();
+    std::stringstream body;
+    try {
+      var_id_ = 0;
+      std::string result = gen(expr.get_root().get(), "context.get_active_data()", body, 1);
+      body << "  return " << result << ";\n";
+    } catch (const CodegenError &e) {
+      literals_.resize(literal_size);
+      error = e.message;
+      return false;
+    }
+    functions_ << "// " << escape_comment(expr.get_expr_str()) << "\n"
+               << "const json *" << function_name << "(cppel::EvaluationContext &context) {\n"
+               << body.str() << "}\n\n";
+    entries_.push_back(std::make_pair(expr.get_expr_str(), function_name));
+    return true;
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  std::string to_source() const {
+    std::stringstream ss;
+    ss << "// generated by cppel_codegen, do not edit\n\n"
+       << "#include <cppel/native.hpp>\n\n"
+       << "namespace {\n\n"
+       << "using json = nlohmann::json;\n\n";
+    for (auto &literal : literals_) {
+      ss << literal << "\n";
+    }
+    ss << "\n" << functions_.str()
+       << "const bool registered = [] {\n"
+       << "  cppel::NativeRegistry &registry = cppel::NativeRegistry::instance();\n";
+    for (auto &entry : entries_) {
+      ss << "  registry.add(" << quote(entry.first) << ", " << entry.second << ");\n";
+    }
+    ss << "  return true;\n"
+       << "}();\n\n"
+       << "}  // namespace\n";
+    return ss.str();
+  }
+
+ private:
+  std::vector<std::string> literals_;
+  std::stringstream functions_;
+  std::vector<std::pair<std::string, std::string>> entries_;
+  int var_id_ = 0;
+
+  std::string next_var(const char *prefix) {
+    return prefix + std::to_string(var_id_++);
+  }
+
+  std::string add_literal(const std::string &type, const std::string &value) {
+    std::string name = "literal_" + std::to_string(literals_.size());
+    literals_.push_back("const " + type + " " + name + " = " + value + ";");
+    return name;
+  }
+
+  static std::string quote(const std::string &str) {
+    std::stringstream ss;
+    ss << '"';
+    for (unsigned char ch : str) {
+      if (ch == '"' || ch == '\\') {
+        ss << '\\' << ch;
+      } else if (ch < 0x20 || ch >= 0x7f) {
+        ss << "\\" << std::oct << std::setw(3) << std::setfill('0') << static_cast<int>(ch) << std::dec;
+      } else {
+        ss << ch;
+      }
+    }
+    ss << '"';
+    return ss.str();
+  }
+
+  static std::string escape_comment(const std::string &str) {
+    std::string escaped;
+    for (char ch : str) {
+      escaped += (ch == '\n' || ch == '\r') ? ' ' : ch;
+    }
+    return escaped;
+  }
+
+  static std::string float_literal(const float value) {
+    std::stringstream ss;
+    ss << std::setprecision(std::numeric_limits<float>::max_digits10) << value;
+    std::string str = ss.str();
+    if (str.find_first_of(".en") == std::string::npos) {
+      str += ".0";
+    }
+    return str + "f";
+  }
+
+  static std::string indent(const int depth) {
+    return std::string(depth * 2, ' ');
+  }
+
+  /**
+   * literal value of the node when it's a typed literal, for the typed helpers
+   * @return type of the literal, empty when it's not a literal
+   */
+  std::string typed_literal(const AstNode *node, std::string &value, std::string &json_value) {
+    switch (node->get_kind()) {
+      case NodeKind::LITERAL_INT: {
+        const json &literal = static_cast<const LiteralInt *>(node)->get_value();
+        value = std::to_string(literal.get<int>());
+        json_value = add_literal("json", "json(" + value + ")");
+        return "int";
+      }
+      case NodeKind::LITERAL_FLOAT: {
+        const json &literal = static_cast<const LiteralFloat *>(node)->get_value();
+        value = float_literal(literal.get<float>());
+        json_value = add_literal("json", "json(" + value + ")");
+        return "float";
+      }
+      case NodeKind::LITERAL_STRING: {
+        const json &literal = static_cast<const LiteralString *>(node)->get_value();
+        value = add_literal("std::string", quote(literal.get<std::string>()));
+        json_value = add_literal("json", "json(" + value + ")");
+        return "string";
+      }
+      default:
+        break;
+    }
+    return "";
+  }
+
+  /**
+   * emit the statements evaluating node into out
+   * @param node
+   * @param active c++ expression of the active data (#this)
+   * @param out
+   * @param depth
+   * @return c++ expression of the result, a const json *
+   */
+  std::string gen(const AstNode *node, const std::string &active, std::stringstream &out, const int depth) {
+    NodeKind kind = node->get_kind();
+    const std::vector<std::shared_ptr<AstNode>> &children = node->get_children();
+    std::string pos = std::to_string(node->get_start_pos());
+    std::string in = indent(depth);
+
+    switch (kind) {
+      case NodeKind::LITERAL_NONE: {
+        return "cppel::native::value_empty()";
+      }
+      case NodeKind::LITERAL_BOOL: {
+        bool value = static_cast<const LiteralBool *>(node)->get_value().get<bool>();
+        return std::string("cppel::native::boolean(") + (value ? "true" : "false") + ")";
+      }
+      case NodeKind::LITERAL_INT:
+      case NodeKind::LITERAL_FLOAT:
+      case NodeKind::LITERAL_STRING: {
+        std::string value, json_value;
+        typed_literal(node, value, json_value);
+        return "&" + json_value;
+      }
+      case NodeKind::PROPERTY: {
+        const PropertyNode *property = static_cast<const PropertyNode *>(node);
+        std::string key = add_literal("std::string", quote(property->get_property_name()));
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = cppel::native::property(context, " << active << ", " << key << ", "
+            << (property->is_null_safe() ? "true" : "false") << ", " << pos << ");\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::VARIABLE: {
+        const std::string &variable_name = static_cast<const VariableNode *>(node)->get_variable_name();
+        if (variable_name == "root") {
+          return "context.get_root_data()";
+        } else if (variable_name == "this") {
+          return active;
+        }
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = context.get_slot("
+            << static_cast<const VariableNode *>(node)->get_slot() << ");\n"
+            << in << "if (!" << var << ") {\n"
+            << in << "  " << var
+            << " = context.fail(cppel::ErrorCode::UNKNOWN_VARIABLE, \"unexpected variable at\", " << pos << ");\n"
+            << in << "}\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::PARAMETER: {
+        const ParameterNode *parameter = static_cast<const ParameterNode *>(node);
+        if (parameter->get_parameter_name()[0] == '$') {
+          // the native function is looked up by the expression string, which has literals instead
+          CPPEL_THROW(CodegenError("literal of a cached plan at " + pos + " is not supported"));
+        }
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = context.get_parameter(" << parameter->get_slot() << ");\n"
+            << in << "if (!" << var << ") {\n"
+            << in << "  " << var
+            << " = context.fail(cppel::ErrorCode::UNKNOWN_VARIABLE, \"unbound parameter at \", " << pos << ");\n"
+            << in << "}\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::ASSIGN: {
+        std::string value = gen(children[1].get(), active, out, depth);
+        out << in << "context.set_slot(" << static_cast<const VariableNode *>(children[0].get())->get_slot() << ", "
+            << value << ");\n";
+        return value;
+      }
+      case NodeKind::SEQUENCE: {
+        std::string value;
+        for (auto &child : children) {
+          value = gen(child.get(), active, out, depth);
+        }
+        return value;
+      }
+      case NodeKind::COMPOUND_EXPRESSION: {
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = " << active << ";\n"
+            << in << "if (" << var << "->is_null()) {\n"
+            << in << "  CPPEL_CHECK(context.fail(cppel::ErrorCode::UNEXPECTED_NULL, \"unexpected null at \", " << pos
+            << "));\n"
+            << in << "}\n";
+        for (auto &child : children) {
+          std::string value = gen(child.get(), var, out, depth);
+          out << in << var << " = " << value << ";\n";
+        }
+        return var;
+      }
+      case NodeKind::ELVIS: {
+        std::string var = next_var("v");
+        std::string first = gen(children[0].get(), active, out, depth);
+        out << in << "const json *" << var << " = " << first << ";\n"
+            << in << "if (" << var << "->is_null()) {\n";
+        std::string second = gen(children[1].get(), active, out, depth + 1);
+        out << in << "  " << var << " = " << second << ";\n"
+            << in << "}\n";
+        return var;
+      }
+      case NodeKind::TERNARY: {
+        std::string var = next_var("v");
+        std::string condition = gen(children[0].get(), active, out, depth);
+        out << in << "const json *" << var << ";\n"
+            << in << "if (cppel::truthy(" << condition << ")) {\n";
+        std::string if_true = gen(children[1].get(), active, out, depth + 1);
+        out << in << "  " << var << " = " << if_true << ";\n"
+            << in << "} else {\n";
+        std::string if_false = gen(children[2].get(), active, out, depth + 1);
+        out << in << "  " << var << " = " << if_false << ";\n"
+            << in << "}\n";
+        return var;
+      }
+      case NodeKind::OP_NOT: {
+        std::string value = gen(children[0].get(), active, out, depth);
+        return "cppel::native::boolean(!cppel::truthy(" + value + "))";
+      }
+      case NodeKind::OP_OR:
+      case NodeKind::OP_AND: {
+        bool is_or = kind == NodeKind::OP_OR;
+        std::string var = next_var("v");
+        std::string lh_value = gen(children[0].get(), active, out, depth);
+        out << in << "const json *" << var << " = cppel::native::boolean(" << (is_or ? "true" : "false") << ");\n"
+            << in << "if (" << (is_or ? "!" : "") << "cppel::truthy(" << lh_value << ")) {\n";
+        std::string rh_value = gen(children[1].get(), active, out, depth + 1);
+        out << in << "  " << var << " = cppel::native::boolean(cppel::truthy(" << rh_value << "));\n"
+            << in << "}\n";
+        return var;
+      }
+      case NodeKind::OP_GT:
+      case NodeKind::OP_GE:
+      case NodeKind::OP_LT:
+      case NodeKind::OP_LE:
+      case NodeKind::OP_EQ:
+      case NodeKind::OP_NE: {
+        static const std::map<NodeKind, std::string> ops = {
+            {NodeKind::OP_GT, "Gt"}, {NodeKind::OP_GE, "Ge"}, {NodeKind::OP_LT, "Lt"},
+            {NodeKind::OP_LE, "Le"}, {NodeKind::OP_EQ, "Eq"}, {NodeKind::OP_NE, "Ne"},
+        };
+        std::string op = "cppel::native::" + ops.at(kind);
+        std::string lh_value = gen(children[0].get(), active, out, depth);
+        std::string literal, json_literal;
+        std::string type = typed_literal(children[1].get(), literal, json_literal);
+        if (type == "int") {
+          return "cppel::native::compare<" + op + ">(" + lh_value + ", static_cast<int64_t>(" + literal + "), "
+              + json_literal + ")";
+        } else if (type == "float") {
+          return "cppel::native::compare<" + op + ">(" + lh_value + ", static_cast<double>(" + literal + "), "
+              + json_literal + ")";
+        } else if (type == "string") {
+          return "cppel::native::compare<" + op + ">(" + lh_value + ", " + literal + ", " + json_literal + ")";
+        }
+        std::string rh_value = gen(children[1].get(), active, out, depth);
+        return "cppel::native::compare<" + op + ">(" + lh_value + ", " + rh_value + ")";
+      }
+      case NodeKind::OP_MATCHES: {
+        const std::shared_ptr<const Pattern> &pattern = static_cast<const OpMatches *>(node)->get_pattern();
+        std::string lh_value = gen(children[0].get(), active, out, depth);
+        if (pattern) {
+          std::string pattern_var =
+              add_literal("cppel::Pattern", "cppel::Pattern(" + quote(pattern->get_pattern()) + ")");
+          return "cppel::native::matches(" + lh_value + ", " + pattern_var + ")";
+        }
+        std::string rh_value = gen(children[1].get(), active, out, depth);
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = cppel::native::matches(context, " << lh_value << ", " << rh_value
+            << ", " << children[1]->get_start_pos() << ");\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::OP_IN: {
+        const std::shared_ptr<const JsonSet> &set = static_cast<const OpIn *>(node)->get_set();
+        std::string lh_value = gen(children[0].get(), active, out, depth);
+        if (set) {
+          std::string set_var = add_literal("cppel::JsonSet",
+                                            "cppel::JsonSet(json::parse(" + quote(set->get_values().dump()) + "))");
+          return "cppel::native::in(" + lh_value + ", " + set_var + ")";
+        }
+        std::string rh_value = gen(children[1].get(), active, out, depth);
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = cppel::native::in(context, " << lh_value << ", " << rh_value
+            << ", " << children[1]->get_start_pos() << ");\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::OP_PLUS:
+      case NodeKind::OP_MINUS:
+      case NodeKind::OP_MULTIPLY:
+      case NodeKind::OP_DIVIDE:
+      case NodeKind::OP_MODULUS:
+      case NodeKind::OP_POWER: {
+        static const std::map<NodeKind, std::string> helpers = {
+            {NodeKind::OP_PLUS, "plus"}, {NodeKind::OP_MINUS, "minus"}, {NodeKind::OP_MULTIPLY, "multiply"},
+            {NodeKind::OP_DIVIDE, "divide"}, {NodeKind::OP_MODULUS, "modulus"}, {NodeKind::OP_POWER, "power"},
+        };
+        std::string helper = "cppel::native::" + helpers.at(kind);
+        std::string lh_value;
+        const AstNode *rh_node = children.back().get();
+        if (children.size() == 1) {
+          lh_value = add_literal("json", "json(0)");
+          lh_value = "&" + lh_value;
+        } else {
+          lh_value = gen(children[0].get(), active, out, depth);
+        }
+        std::string var = next_var("v");
+        std::string literal, json_literal;
+        std::string type = typed_literal(rh_node, literal, json_literal);
+        bool typed = (type == "int" || type == "float") && kind != NodeKind::OP_MODULUS && kind != NodeKind::OP_POWER;
+        std::string rh_value = typed ? literal : gen(rh_node, active, out, depth);
+        if (!typed && !type.empty()) {
+          rh_value = "&" + json_literal;
+        }
+        out << in << "const json *" << var << " = " << helper << "(context, " << lh_value << ", " << rh_value << ");\n";
+        return var;
+      }
+      case NodeKind::FUNCTION: {
+        const FunctionNode *function = static_cast<const FunctionNode *>(node);
+        if (function->is_ordering() || function->is_grouping()) {
+          CPPEL_THROW(CodegenError("#" + function->get_function_name() + " at " + pos + " is not supported"));
+        }
+        std::string key = add_literal("std::pair<std::string, int>",
+                                      "std::make_pair(std::string(" + quote(function->get_function_name()) + "), "
+                                          + std::to_string(children.size()) + ")");
+        std::string function_var = next_var("f");
+        out << in << "const cppel::Function *" << function_var << " = cppel::native::function(context, " << key
+            << ", " << pos << ");\n"
+            << in << "CPPEL_CHECK(" << function_var << ");\n";
+        std::string args = next_var("args");
+        out << in << "std::vector<const json *> " << args << ";\n";
+        for (auto &child : children) {
+          std::string arg = gen(child.get(), active, out, depth);
+          out << in << args << ".push_back(" << arg << ");\n";
+        }
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = context.push_ref((*" << function_var << ")(" << args << "));\n";
+        return var;
+      }
+      case NodeKind::INDEXER: {
+        out << in << "if (" << active << "->is_null()) {\n"
+            << in << "  CPPEL_CHECK(context.fail(cppel::ErrorCode::UNEXPECTED_NULL, \"unexpected null at\", " << pos
+            << "));\n"
+            << in << "}\n";
+        std::string index_value = gen(children[0].get(), active, out, depth);
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = cppel::native::index(context, " << active << ", " << index_value
+            << ", " << pos << ");\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::METHOD: {
+        const MethodNode *method = static_cast<const MethodNode *>(node);
+        std::string method_var = add_literal("cppel::Method *", "cppel::MethodTable::instance().find("
+            + quote(method->get_method_name()) + ", " + std::to_string(children.size()) + ")");
+        std::string var = next_var("v");
+        out << in << "const json *" << var << ";\n"
+            << in << "if (" << active << "->is_null()) {\n";
+        if (method->is_null_safe()) {
+          out << in << "  " << var << " = cppel::native::value_empty();\n";
+        } else {
+          out << in << "  " << var << " = context.fail(cppel::ErrorCode::UNEXPECTED_NULL, \"unexpected null at\", "
+              << pos << ");\n";
+        }
+        out << in << "} else {\n";
+        std::string args = next_var("args");
+        out << in << "  const json *" << args << "[cppel::Method::MAX_ARGS] = {};\n";
+        for (size_t i = 0; i < children.size() && i < Method::MAX_ARGS; ++i) {
+          std::string arg = gen(children[i].get(), active, out, depth + 1);
+          out << in << "  " << args << "[" << i << "] = " << arg << ";\n";
+        }
+        out << in << "  " << var << " = cppel::call_method(context, " << method_var << ", " << active << ", " << args
+            << ", " << pos << ");\n"
+            << in << "}\n"
+            << in << "CPPEL_CHECK(" << var << ");\n";
+        return var;
+      }
+      case NodeKind::INLINE_LIST: {
+        std::string result = next_var("r");
+        out << in << "std::shared_ptr<json> " << result << " = std::make_shared<json>();\n";
+        for (auto &child : children) {
+          std::string item = gen(child.get(), active, out, depth);
+          out << in << result << "->push_back(*" << item << ");\n";
+        }
+        std::string var = next_var("v");
+        out << in << "const json *" << var << " = context.push_ref(" << result << ");\n";
+        return var;
+      }
+      case NodeKind::PROJECTION:
+      case NodeKind::FLAT:
+      case NodeKind::SELECTION: {
+        return gen_loop(node, active, out, depth);
+      }
+      default:
+        break;
+    }
+    CPPEL_THROW(CodegenError(std::string(node->get_name()) + " at " + pos + " is not supported"));
+  }
+
+  std::string gen_loop(const AstNode *node, const std::string &active, std::stringstream &out, const int depth) {
+    NodeKind kind = node->get_kind();
+    std::string pos = std::to_string(node->get_start_pos());
+    std::string in = indent(depth);
+    bool null_safe = false;
+    Selection::SelectType select_type = Selection::SelectType::ALL;
+    if (kind == NodeKind::PROJECTION) {
+      null_safe = static_cast<const Projection *>(node)->is_null_safe();
+    } else if (kind == NodeKind::FLAT) {
+      null_safe = static_cast<const Flat *>(node)->is_null_safe();
+    } else {
+      null_safe = static_cast<const Selection *>(node)->is_null_safe();
+      select_type = static_cast<const Selection *>(node)->get_select_type();
+    }
+
+    std::string var = next_var("v");
+    std::string it = next_var("it");
+    std::string item = next_var("item");
+    out << in << "const json *" << var << " = cppel::native::value_empty();\n"
+        << in << "if (" << active << "->is_null()) {\n";
+    if (!null_safe) {
+      out << in << "  CPPEL_CHECK(context.fail(cppel::ErrorCode::UNEXPECTED_NULL, \"unexpected null at\", " << pos
+          << "));\n";
+    }
+    out << in << "} else {\n";
+    std::string body_in = indent(depth + 2);
+    const AstNode *expr = node->get_children()[0].get();
+    if (kind == NodeKind::SELECTION && select_type != Selection::SelectType::ALL) {
+      bool first = select_type == Selection::SelectType::FIRST;
+      out << in << "  for (auto " << it << " = " << active << "->" << (first ? "begin" : "rbegin") << "(); " << it
+          << " != " << active << "->" << (first ? "end" : "rend") << "(); ++" << it << ") {\n"
+          << body_in << "const json *" << item << " = &(*" << it << ");\n";
+      std::string matched = gen(expr, item, out, depth + 2);
+      out << body_in << "if (cppel::truthy(" << matched << ")) {\n"
+          << body_in << "  " << var << " = " << item << ";\n"
+          << body_in << "  break;\n"
+          << body_in << "}\n"
+          << in << "  }\n";
+    } else {
+      std::string result = next_var("r");
+      out << in << "  std::shared_ptr<json> " << result << " = std::make_shared<json>();\n"
+          << in << "  for (auto " << it << " = " << active << "->begin(); " << it << " != " << active << "->end(); ++"
+          << it << ") {\n"
+          << body_in << "const json *" << item << " = &(*" << it << ");\n";
+      std::string value = gen(expr, item, out, depth + 2);
+      if (kind == NodeKind::PROJECTION) {
+        out << body_in << result << "->push_back(*" << value << ");\n";
+      } else if (kind == NodeKind::FLAT) {
+        out << body_in << "if (!" << value << "->is_array()) {\n"
+            << body_in << "  CPPEL_CHECK(context.fail(cppel::ErrorCode::NOT_ARRAY, \"flat should do with array\", "
+            << pos << "));\n"
+            << body_in << "}\n"
+            << body_in << "for (auto &sub_item : *" << value << ") {\n"
+            << body_in << "  " << result << "->push_back(sub_item);\n"
+            << body_in << "}\n";
+      } else {
+        out << body_in << "if (cppel::truthy(" << value << ")) {\n"
+            << body_in << "  " << result << "->push_back(*" << item << ");\n"
+            << body_in << "}\n";
+      }
+      out << in << "  }\n"
+          << in << "  " << var << " = context.push_ref(" << result << ");\n";
+    }
+    out << in << "}\n";
+    return var;
+  }
+};
+
+} // namespace cppel
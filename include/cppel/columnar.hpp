@@ -0,0 +1,1008 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "ast.hpp"
+#include "context.hpp"
+#include "exception.hpp"
+#include "expression.hpp"
+#include "native.hpp"
+#include "utils.hpp"
+
+/**
+ * vectorized filters over columnar batches
+ *
+ * rows are stored as typed contiguous columns with validity bitmaps, and a predicate made of
+ * properties, literals, comparisons, arithmetic and boolean operators is evaluated a block of
+ * rows per node. the kernels are branch free loops over plain arrays, which the compiler
+ * vectorizes, and boolean values are bitmaps of 64 rows per word
+ */
+
+namespace cppel {
+
+namespace columnar {
+
+// rows evaluated by a visit of a node
+static const size_t BLOCK_ROWS = 1024;
+static const size_t BLOCK_WORDS = BLOCK_ROWS / 64;
+
+} // namespace columnar
+
+class Bitmap {
+ public:
+  Bitmap() {}
+
+  explicit Bitmap(const size_t size, const bool value = false) :
+      size_(size), words_((size + 63) / 64, value ? ~uint64_t(0) : 0) {
+    clear_tail();
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  bool test(const size_t index) const {
+    return (words_[index / 64] >> (index % 64)) & 1;
+  }
+
+  void set(const size_t index, const bool value = true) {
+    uint64_t bit = uint64_t(1) << (index % 64);
+    words_[index / 64] = value ? words_[index / 64] | bit : words_[index / 64] & ~bit;
+  }
+
+  /**
+   * number of the set bits
+   */
+  size_t count() const {
+    size_t count = 0;
+    for (uint64_t word : words_) {
+      count += std::bitset<64>(word).count();
+    }
+    return count;
+  }
+
+  /**
+   * indices of the set bits, in order
+   */
+  std::vector<size_t> indices() const {
+    std::vector<size_t> indices;
+    for (size_t w = 0; w < words_.size(); ++w) {
+      for (uint64_t word = words_[w]; word; word &= word - 1) {
+        indices.push_back(w * 64 + std::bitset<64>((word & (~word + 1)) - 1).count());
+      }
+    }
+    return indices;
+  }
+
+  const uint64_t *data() const {
+    return words_.data();
+  }
+
+  uint64_t *data() {
+    return words_.data();
+  }
+
+  /**
+   * the added bits are unset
+   */
+  void resize(const size_t size) {
+    clear_tail();
+    words_.resize((size + 63) / 64, 0);
+    size_ = size;
+    clear_tail();
+  }
+
+  /**
+   * the bits past size stay unset
+   */
+  void clear_tail() {
+    if (size_ % 64) {
+      words_.back() &= (uint64_t(1) << (size_ % 64)) - 1;
+    }
+  }
+
+ private:
+  size_t size_ = 0;
+  std::vector<uint64_t> words_;
+};
+
+enum class ColumnType {
+  INT,
+  FLOAT,
+  BOOL,
+  STRING
+};
+
+/**
+ * values of a field for every row of a batch, strings are dictionary encoded.
+ * valid has a bit per row, unset for a null, it's empty when no value is null.
+ * the values are padded to whole blocks, so that the kernels never check the end of a batch
+ */
+struct Column {
+  ColumnType type = ColumnType::INT;
+  std::vector<int64_t> ints;
+  std::vector<double> floats;
+  Bitmap bools;
+  std::vector<uint32_t> codes;
+  std::vector<std::string> dictionary;
+  Bitmap valid;
+
+  bool is_valid(const size_t row) const {
+    return valid.empty() || valid.test(row);
+  }
+
+  json value(const size_t row) const {
+    if (!is_valid(row)) {
+      return json();
+    }
+    switch (type) {
+      case ColumnType::INT:
+        return ints[row];
+      case ColumnType::FLOAT:
+        return floats[row];
+      case ColumnType::BOOL:
+        return bools.test(row);
+      default:
+        return dictionary[codes[row]];
+    }
+  }
+};
+
+/**
+ * rows stored by column, a column is read by a property of the same name
+ */
+class ColumnBatch {
+ public:
+  explicit ColumnBatch(const size_t size) : size_(size) {}
+
+  size_t size() const {
+    return size_;
+  }
+
+  void add_int_column(const std::string &name, std::vector<int64_t> values, Bitmap valid = Bitmap()) {
+    Column &column = add_column(name, ColumnType::INT, values.size(), std::move(valid));
+    column.ints = std::move(values);
+    column.ints.resize(padded_size(), 0);
+  }
+
+  void add_float_column(const std::string &name, std::vector<double> values, Bitmap valid = Bitmap()) {
+    Column &column = add_column(name, ColumnType::FLOAT, values.size(), std::move(valid));
+    column.floats = std::move(values);
+    column.floats.resize(padded_size(), 0);
+  }
+
+  void add_bool_column(const std::string &name, const std::vector<bool> &values, Bitmap valid = Bitmap()) {
+    Column &column = add_column(name, ColumnType::BOOL, values.size(), std::move(valid));
+    column.bools = Bitmap(padded_size());
+    for (size_t row = 0; row < values.size(); ++row) {
+      column.bools.set(row, values[row]);
+    }
+  }
+
+  void add_string_column(const std::string &name, const std::vector<std::string> &values, Bitmap valid = Bitmap()) {
+    Column &column = add_column(name, ColumnType::STRING, values.size(), std::move(valid));
+    std::unordered_map<std::string, uint32_t> codes;
+    column.codes.reserve(values.size());
+    for (auto &value : values) {
+      auto it = codes.emplace(value, static_cast<uint32_t>(column.dictionary.size()));
+      if (it.second) {
+        column.dictionary.push_back(value);
+      }
+      column.codes.push_back(it.first->second);
+    }
+    if (column.dictionary.empty()) {
+      column.dictionary.push_back(std::string());
+    }
+    column.codes.resize(padded_size(), 0);
+  }
+
+  const Column *find(const std::string &name) const {
+    auto it = columns_.find(name);
+    return it != columns_.end() ? &it->second : nullptr;
+  }
+
+  /**
+   * the row as a json object, fields of the null values included
+   */
+  json row(const size_t row) const {
+    json object = json::object();
+    for (auto &column : columns_) {
+      object[column.first] = column.second.value(row);
+    }
+    return object;
+  }
+
+  /**
+   * transpose json objects, the type of a column is the one of its first value which isn't null
+   * @throw EvaluateError when a column has values of several types, or values which aren't scalars
+   */
+  static ColumnBatch from_json(const std::vector<json> &rows, const std::vector<std::string> &names) {
+    ColumnBatch batch(rows.size());
+    for (auto &name : names) {
+      json::value_t type = json::value_t::null;
+      Bitmap valid(rows.size(), true);
+      for (size_t row = 0; row < rows.size(); ++row) {
+        auto it = rows[row].find(name);
+        if (it == rows[row].end() || it->is_null()) {
+          valid.set(row, false);
+          continue;
+        }
+        json::value_t value_type = it->is_number_unsigned() ? json::value_t::number_integer : it->type();
+        if (type == json::value_t::null) {
+          type = value_type;
+        } else if (value_type != type) {
+          CPPEL_THROW(EvaluateError("column " + name + " mixes types at row " + std::to_string(row)));
+        }
+      }
+      if (valid.count() == rows.size()) {
+        valid = Bitmap();
+      }
+      switch (type) {
+        case json::value_t::number_float:
+          batch.add_float_column(name, collect<double>(rows, name, 0.0), std::move(valid));
+          break;
+        case json::value_t::boolean:
+          batch.add_bool_column(name, collect<bool>(rows, name, false), std::move(valid));
+          break;
+        case json::value_t::string:
+          batch.add_string_column(name, collect<std::string>(rows, name, std::string()), std::move(valid));
+          break;
+        case json::value_t::number_integer:
+        case json::value_t::null:
+          batch.add_int_column(name, collect<int64_t>(rows, name, 0), std::move(valid));
+          break;
+        default:
+          CPPEL_THROW(EvaluateError("column " + name + " isn't a scalar"));
+      }
+    }
+    return batch;
+  }
+
+ private:
+  size_t size_;
+  std::unordered_map<std::string, Column> columns_;
+
+  Column &add_column(const std::string &name, const ColumnType type, const size_t size, Bitmap valid) {
+    if (size != size_ || !(valid.empty() || valid.size() == size_)) {
+      CPPEL_THROW(EvaluateError("column " + name + " should have " + std::to_string(size_) + " rows"));
+    }
+    Column &column = columns_[name];
+    column = Column();
+    column.type = type;
+    column.valid = std::move(valid);
+    if (!column.valid.empty()) {
+      column.valid.resize(padded_size());
+    }
+    return column;
+  }
+
+  size_t padded_size() const {
+    return (size_ + columnar::BLOCK_ROWS - 1) / columnar::BLOCK_ROWS * columnar::BLOCK_ROWS;
+  }
+
+  template<typename T>
+  static std::vector<T> collect(const std::vector<json> &rows, const std::string &name, const T &null_value) {
+    std::vector<T> values;
+    values.reserve(rows.size());
+    for (auto &row : rows) {
+      auto it = row.find(name);
+      values.push_back(it == row.end() || it->is_null() ? null_value : it->get<T>());
+    }
+    return values;
+  }
+};
+
+namespace columnar {
+
+/**
+ * type of a value, NONE is the null literal or a missing column
+ */
+enum class Type {
+  NONE,
+  BOOL,
+  INT,
+  FLOAT,
+  STRING
+};
+
+enum class Op {
+  GT,
+  GE,
+  LT,
+  LE,
+  EQ,
+  NE,
+  PLUS,
+  MINUS,
+  MULTIPLY,
+  DIVIDE,
+  AND,
+  OR,
+  NOT
+};
+
+/**
+ * values of a block of rows, arrays of BLOCK_ROWS values or bitmaps of BLOCK_WORDS words.
+ * valid and errors are nullptr when every row is valid and none failed
+ */
+struct Vector {
+  Type type = Type::NONE;
+  const int64_t *ints = nullptr;
+  const double *floats = nullptr;
+  const uint64_t *bits = nullptr;
+  const uint32_t *codes = nullptr;
+  const std::vector<std::string> *dictionary = nullptr;
+  const uint64_t *valid = nullptr;
+  const uint64_t *errors = nullptr;
+};
+
+/**
+ * node of a compiled predicate, the buffers of its result are reused by every block
+ */
+struct Node {
+  enum class Kind {
+    COLUMN,
+    LITERAL,
+    OPERATOR
+  };
+
+  Kind kind = Kind::LITERAL;
+  Op op = Op::EQ;
+  std::string name;
+  json literal;
+  std::unique_ptr<Node> lhs;
+  std::unique_ptr<Node> rhs;
+
+  // bound to a batch
+  const Column *column = nullptr;
+  Type type = Type::NONE;
+  std::vector<int64_t> ints;
+  std::vector<double> floats;
+  std::vector<uint64_t> bits;
+  std::vector<uint64_t> errors;
+  // an int operand converted to float, or a bool one to int
+  std::vector<double> lhs_floats;
+  std::vector<double> rhs_floats;
+  std::vector<int64_t> lhs_ints;
+  std::vector<int64_t> rhs_ints;
+  // operands of an arithmetic narrowed to float, like the interpreter does
+  std::vector<float> lhs_singles;
+  std::vector<float> rhs_singles;
+  // comparison of every string of the dictionary of the column operand with the literal one
+  std::vector<uint8_t> table;
+};
+
+/**
+ * order of the types in comparisons, see the comparison of nlohmann::json
+ */
+inline int rank(const Type type) {
+  switch (type) {
+    case Type::NONE:
+      return 0;
+    case Type::BOOL:
+      return 1;
+    case Type::STRING:
+      return 5;
+    default:
+      return 2;
+  }
+}
+
+inline bool compare(const Op op, const int order) {
+  switch (op) {
+    case Op::GT:
+      return order > 0;
+    case Op::GE:
+      return order >= 0;
+    case Op::LT:
+      return order < 0;
+    case Op::LE:
+      return order <= 0;
+    case Op::EQ:
+      return order == 0;
+    default:
+      return order != 0;
+  }
+}
+
+inline uint64_t all(const bool value) {
+  return value ? ~uint64_t(0) : 0;
+}
+
+template<typename T>
+inline int order(const T &lhs, const T &rhs) {
+  return lhs < rhs ? -1 : rhs < lhs ? 1 : 0;
+}
+
+/**
+ * bits of op over two arrays, one word of 64 rows at a time
+ */
+template<typename T, typename Compare>
+inline void compare_block(const T *lhs, const T *rhs, const size_t words, uint64_t *bits, Compare compare) {
+  for (size_t w = 0; w < words; ++w) {
+    const T *l = lhs + w * 64;
+    const T *r = rhs + w * 64;
+    uint64_t word = 0;
+    for (size_t j = 0; j < 64; ++j) {
+      word |= uint64_t(compare(l[j], r[j])) << j;
+    }
+    bits[w] = word;
+  }
+}
+
+template<typename T>
+inline void compare_block(const Op op, const T *lhs, const T *rhs, const size_t words, uint64_t *bits) {
+  switch (op) {
+    case Op::GT:
+      return compare_block(lhs, rhs, words, bits, std::greater<T>());
+    case Op::GE:
+      return compare_block(lhs, rhs, words, bits, std::greater_equal<T>());
+    case Op::LT:
+      return compare_block(lhs, rhs, words, bits, std::less<T>());
+    case Op::LE:
+      return compare_block(lhs, rhs, words, bits, std::less_equal<T>());
+    case Op::EQ:
+      return compare_block(lhs, rhs, words, bits, std::equal_to<T>());
+    default:
+      return compare_block(lhs, rhs, words, bits, std::not_equal_to<T>());
+  }
+}
+
+/**
+ * values of op over two arrays, computed in T and stored in R
+ */
+template<typename T, typename R>
+inline void arithmetic_block(const Op op, const T *lhs, const T *rhs, const size_t rows, R *values) {
+  switch (op) {
+    case Op::PLUS:
+      for (size_t i = 0; i < rows; ++i) values[i] = lhs[i] + rhs[i];
+      break;
+    case Op::MINUS:
+      for (size_t i = 0; i < rows; ++i) values[i] = lhs[i] - rhs[i];
+      break;
+    case Op::MULTIPLY:
+      for (size_t i = 0; i < rows; ++i) values[i] = lhs[i] * rhs[i];
+      break;
+    default:
+      for (size_t i = 0; i < rows; ++i) values[i] = lhs[i] / rhs[i];
+      break;
+  }
+}
+
+/**
+ * compiles a predicate and evaluates it over the blocks of a batch
+ */
+class Evaluator {
+ public:
+  /**
+   * @return compiled tree, nullptr when a node can't be vectorized
+   */
+  static std::unique_ptr<Node> compile(const AstNode *node) {
+    std::unique_ptr<Node> compiled(new Node());
+    if (!node) {
+      // the missing left operand of an unary plus or minus
+      compiled->literal = 0;
+      return compiled;
+    }
+    const std::vector<std::shared_ptr<AstNode>> &children = node->get_children();
+    Op op;
+    switch (node->get_kind()) {
+      case NodeKind::NATIVE:
+        return compile(static_cast<const NativeNode *>(node)->get_interpreted().get());
+      case NodeKind::PROPERTY:
+        compiled->kind = Node::Kind::COLUMN;
+        compiled->name = static_cast<const PropertyNode *>(node)->get_property_name();
+        return compiled;
+      case NodeKind::LITERAL_NONE:
+        return compiled;
+      case NodeKind::LITERAL_BOOL:
+        compiled->literal = static_cast<const LiteralBool *>(node)->get_value();
+        return compiled;
+      case NodeKind::LITERAL_INT:
+        compiled->literal = static_cast<const LiteralInt *>(node)->get_value();
+        return compiled;
+      case NodeKind::LITERAL_FLOAT:
+        compiled->literal = static_cast<const LiteralFloat *>(node)->get_value();
+        return compiled;
+      case NodeKind::LITERAL_STRING:
+        compiled->literal = static_cast<const LiteralString *>(node)->get_value();
+        return compiled;
+      case NodeKind::OP_GT:
+        op = Op::GT;
+        break;
+      case NodeKind::OP_GE:
+        op = Op::GE;
+        break;
+      case NodeKind::OP_LT:
+        op = Op::LT;
+        break;
+      case NodeKind::OP_LE:
+        op = Op::LE;
+        break;
+      case NodeKind::OP_EQ:
+        op = Op::EQ;
+        break;
+      case NodeKind::OP_NE:
+        op = Op::NE;
+        break;
+      case NodeKind::OP_PLUS:
+        op = Op::PLUS;
+        break;
+      case NodeKind::OP_MINUS:
+        op = Op::MINUS;
+        break;
+      case NodeKind::OP_MULTIPLY:
+        op = Op::MULTIPLY;
+        break;
+      case NodeKind::OP_DIVIDE:
+        op = Op::DIVIDE;
+        break;
+      case NodeKind::OP_AND:
+        op = Op::AND;
+        break;
+      case NodeKind::OP_OR:
+        op = Op::OR;
+        break;
+      case NodeKind::OP_NOT:
+        op = Op::NOT;
+        break;
+      default:
+        return nullptr;
+    }
+    compiled->kind = Node::Kind::OPERATOR;
+    compiled->op = op;
+    // the left operand of an unary plus or minus is missing from the children
+    bool unary = compiled->op != Op::NOT && children.size() == 1;
+    compiled->lhs = compile(unary ? nullptr : children[0].get());
+    if (!compiled->lhs) {
+      return nullptr;
+    }
+    if (compiled->op != Op::NOT) {
+      compiled->rhs = compile(children[unary ? 0 : 1].get());
+      if (!compiled->rhs) {
+        return nullptr;
+      }
+    }
+    return compiled;
+  }
+
+  /**
+   * type the tree for the columns of batch and prepare its buffers
+   * @return false when a node can't be vectorized for these columns
+   */
+  static bool bind(Node &node, const ColumnBatch &batch) {
+    node.errors.assign(BLOCK_WORDS, 0);
+    if (node.kind == Node::Kind::COLUMN) {
+      node.column = batch.find(node.name);
+      node.type = !node.column ? Type::NONE : node.column->type == ColumnType::INT ? Type::INT
+          : node.column->type == ColumnType::FLOAT ? Type::FLOAT : node.column->type == ColumnType::BOOL ? Type::BOOL
+          : Type::STRING;
+      return true;
+    } else if (node.kind == Node::Kind::LITERAL) {
+      // literals are repeated once for every row of a block
+      const json &literal = node.literal;
+      if (literal.is_null()) {
+        node.type = Type::NONE;
+      } else if (literal.is_boolean()) {
+        node.type = Type::BOOL;
+        node.bits.assign(BLOCK_WORDS, all(literal.get<bool>()));
+      } else if (literal.is_number_integer()) {
+        node.type = Type::INT;
+        node.ints.assign(BLOCK_ROWS, literal.get<int64_t>());
+      } else if (literal.is_number()) {
+        node.type = Type::FLOAT;
+        node.floats.assign(BLOCK_ROWS, literal.get<double>());
+      } else {
+        node.type = Type::STRING;
+      }
+      return true;
+    }
+    if (!bind(*node.lhs, batch) || (node.rhs && !bind(*node.rhs, batch))) {
+      return false;
+    }
+    Type lhs = node.lhs->type;
+    Type rhs = node.rhs ? node.rhs->type : Type::NONE;
+    node.bits.assign(BLOCK_WORDS, 0);
+    node.lhs_floats.clear();
+    node.rhs_floats.clear();
+    node.lhs_ints.clear();
+    node.rhs_ints.clear();
+    node.lhs_singles.clear();
+    node.rhs_singles.clear();
+    switch (node.op) {
+      case Op::AND:
+      case Op::OR:
+      case Op::NOT:
+        node.type = Type::BOOL;
+        return true;
+      case Op::PLUS:
+      case Op::MINUS:
+      case Op::MULTIPLY:
+      case Op::DIVIDE:
+        // null operands fail the rows, like the interpreter does
+        if (!is_numeric(lhs) || !is_numeric(rhs)) {
+          return false;
+        }
+        node.type = lhs == Type::INT && rhs == Type::INT ? Type::INT
+            : lhs == Type::NONE && rhs == Type::NONE ? Type::INT : Type::FLOAT;
+        if (node.type == Type::INT) {
+          node.ints.assign(BLOCK_ROWS, 0);
+          node.lhs_ints.assign(BLOCK_ROWS, 0);
+          node.rhs_ints.assign(BLOCK_ROWS, 0);
+        } else {
+          node.floats.assign(BLOCK_ROWS, 0);
+          node.lhs_singles.assign(BLOCK_ROWS, 0);
+          node.rhs_singles.assign(BLOCK_ROWS, 0);
+        }
+        return true;
+      default:
+        node.type = Type::BOOL;
+        return bind_compare(node, lhs, rhs);
+    }
+  }
+
+  /**
+   * evaluate the tree on the rows [start, start + BLOCK_ROWS), rows of the block past the batch
+   * have undefined values
+   */
+  static Vector evaluate(Node &node, const size_t start) {
+    Vector vector;
+    vector.type = node.type;
+    if (node.kind == Node::Kind::COLUMN) {
+      const Column *column = node.column;
+      if (column) {
+        vector.ints = column->ints.empty() ? nullptr : column->ints.data() + start;
+        vector.floats = column->floats.empty() ? nullptr : column->floats.data() + start;
+        vector.bits = column->bools.empty() ? nullptr : column->bools.data() + start / 64;
+        vector.codes = column->codes.empty() ? nullptr : column->codes.data() + start;
+        vector.dictionary = &column->dictionary;
+        vector.valid = column->valid.empty() ? nullptr : column->valid.data() + start / 64;
+      }
+      return vector;
+    } else if (node.kind == Node::Kind::LITERAL) {
+      vector.ints = node.ints.empty() ? nullptr : node.ints.data();
+      vector.floats = node.floats.empty() ? nullptr : node.floats.data();
+      vector.bits = node.bits.empty() ? nullptr : node.bits.data();
+      return vector;
+    }
+    Vector lhs = evaluate(*node.lhs, start);
+    Vector rhs = node.rhs ? evaluate(*node.rhs, start) : Vector();
+    uint64_t *bits = node.bits.data();
+    uint64_t *errors = node.errors.data();
+    switch (node.op) {
+      case Op::AND:
+      case Op::OR:
+      case Op::NOT: {
+        uint64_t lhs_bits[BLOCK_WORDS];
+        uint64_t rhs_bits[BLOCK_WORDS];
+        truthy(lhs, lhs_bits);
+        if (node.op == Op::NOT) {
+          for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+            bits[w] = ~lhs_bits[w];
+            errors[w] = word(lhs.errors, w, 0);
+          }
+          break;
+        }
+        truthy(rhs, rhs_bits);
+        // the right operand is only evaluated by the interpreter when the left one doesn't decide
+        bool conjunction = node.op == Op::AND;
+        for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+          uint64_t deciding = conjunction ? lhs_bits[w] : ~lhs_bits[w];
+          bits[w] = conjunction ? lhs_bits[w] & rhs_bits[w] : lhs_bits[w] | rhs_bits[w];
+          errors[w] = word(lhs.errors, w, 0) | (deciding & word(rhs.errors, w, 0));
+        }
+        break;
+      }
+      case Op::PLUS:
+      case Op::MINUS:
+      case Op::MULTIPLY:
+      case Op::DIVIDE:
+        evaluate_arithmetic(node, lhs, rhs);
+        vector.ints = node.type == Type::INT ? node.ints.data() : nullptr;
+        vector.floats = node.type == Type::FLOAT ? node.floats.data() : nullptr;
+        break;
+      default:
+        evaluate_compare(node, lhs, rhs);
+        break;
+    }
+    if (node.type == Type::BOOL) {
+      vector.bits = bits;
+    }
+    vector.errors = errors;
+    return vector;
+  }
+
+ private:
+  static bool is_numeric(const Type type) {
+    return type == Type::INT || type == Type::FLOAT || type == Type::NONE;
+  }
+
+  static uint64_t word(const uint64_t *words, const size_t w, const uint64_t absent) {
+    return words ? words[w] : absent;
+  }
+
+  static void prepare_floats(const Type type, std::vector<double> &floats) {
+    if (type == Type::INT) {
+      floats.assign(BLOCK_ROWS, 0);
+    }
+  }
+
+  static const double *as_floats(const Type type, const Vector &vector, std::vector<double> &floats) {
+    if (type == Type::FLOAT) {
+      return vector.floats;
+    }
+    for (size_t i = 0; i < BLOCK_ROWS; ++i) {
+      floats[i] = static_cast<double>(vector.ints[i]);
+    }
+    return floats.data();
+  }
+
+  static void evaluate_arithmetic(Node &node, const Vector &lhs, const Vector &rhs) {
+    uint64_t *errors = node.errors.data();
+    for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+      uint64_t lhs_valid = lhs.type == Type::NONE ? 0 : word(lhs.valid, w, ~uint64_t(0));
+      uint64_t rhs_valid = rhs.type == Type::NONE ? 0 : word(rhs.valid, w, ~uint64_t(0));
+      errors[w] = word(lhs.errors, w, 0) | word(rhs.errors, w, 0) | ~lhs_valid | ~rhs_valid;
+    }
+    if (lhs.type == Type::NONE || rhs.type == Type::NONE) {
+      return;
+    }
+    if (node.type == Type::INT) {
+      // the operands are narrowed to int like the interpreter does, an overflow wraps around as it does there
+      int64_t *lhs_ints = node.lhs_ints.data();
+      int64_t *rhs_ints = node.rhs_ints.data();
+      for (size_t i = 0; i < BLOCK_ROWS; ++i) {
+        lhs_ints[i] = static_cast<int>(lhs.ints[i]);
+        rhs_ints[i] = static_cast<int>(rhs.ints[i]);
+      }
+      if (node.op == Op::DIVIDE) {
+        // a division by zero, or of the lowest int by -1, fails the row instead of the process
+        for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+          uint64_t failed = 0;
+          for (size_t j = 0; j < 64; ++j) {
+            size_t i = w * 64 + j;
+            bool failing = rhs_ints[i] == 0 || (rhs_ints[i] == -1 && lhs_ints[i] == std::numeric_limits<int>::min());
+            failed |= uint64_t(failing) << j;
+            rhs_ints[i] = failing ? 1 : rhs_ints[i];
+          }
+          errors[w] |= failed;
+        }
+      }
+      int64_t *values = node.ints.data();
+      arithmetic_block(node.op, static_cast<const int64_t *>(lhs_ints), static_cast<const int64_t *>(rhs_ints),
+                       BLOCK_ROWS, values);
+      for (size_t i = 0; i < BLOCK_ROWS; ++i) {
+        values[i] = static_cast<int>(values[i]);
+      }
+    } else {
+      const float *lhs_singles = as_singles(lhs, node.lhs_singles);
+      const float *rhs_singles = as_singles(rhs, node.rhs_singles);
+      arithmetic_block(node.op, lhs_singles, rhs_singles, BLOCK_ROWS, node.floats.data());
+    }
+  }
+
+  static const float *as_singles(const Vector &vector, std::vector<float> &singles) {
+    if (vector.type == Type::INT) {
+      std::copy(vector.ints, vector.ints + BLOCK_ROWS, singles.begin());
+    } else {
+      std::copy(vector.floats, vector.floats + BLOCK_ROWS, singles.begin());
+    }
+    return singles.data();
+  }
+
+  static bool bind_compare(Node &node, const Type lhs, const Type rhs) {
+    if (lhs == Type::STRING && rhs == Type::STRING) {
+      // a column against a literal, through the dictionary of the column
+      Node *column = node.lhs->kind == Node::Kind::LITERAL ? node.rhs.get() : node.lhs.get();
+      Node *literal = column == node.lhs.get() ? node.rhs.get() : node.lhs.get();
+      if (column->kind != Node::Kind::COLUMN || literal->kind != Node::Kind::LITERAL) {
+        return false;
+      }
+      const std::string &value = literal->literal.get_ref<const std::string &>();
+      const std::vector<std::string> &dictionary = column->column->dictionary;
+      node.table.resize(dictionary.size());
+      for (size_t code = 0; code < dictionary.size(); ++code) {
+        int result = order(dictionary[code], value);
+        node.table[code] = compare(node.op, column == node.lhs.get() ? result : -result);
+      }
+    } else if (lhs != Type::NONE && rhs != Type::NONE && rank(lhs) == rank(rhs)) {
+      if (lhs == Type::BOOL || rhs == Type::BOOL) {
+        node.lhs_ints.assign(BLOCK_ROWS, 0);
+        node.rhs_ints.assign(BLOCK_ROWS, 0);
+      } else if (lhs != rhs) {
+        prepare_floats(lhs, node.lhs_floats);
+        prepare_floats(rhs, node.rhs_floats);
+      }
+    }
+    return true;
+  }
+
+  static void evaluate_compare(Node &node, const Vector &lhs, const Vector &rhs) {
+    uint64_t *bits = node.bits.data();
+    uint64_t *errors = node.errors.data();
+    Op op = node.op;
+    if (lhs.type == Type::NONE || rhs.type == Type::NONE || rank(lhs.type) != rank(rhs.type)) {
+      std::fill(bits, bits + BLOCK_WORDS, all(compare(op, order(rank(lhs.type), rank(rhs.type)))));
+    } else if (lhs.type == Type::STRING) {
+      const uint32_t *codes = lhs.codes ? lhs.codes : rhs.codes;
+      const uint8_t *table = node.table.data();
+      for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+        uint64_t result = 0;
+        for (size_t j = 0; j < 64; ++j) {
+          result |= uint64_t(table[codes[w * 64 + j]]) << j;
+        }
+        bits[w] = result;
+      }
+    } else if (lhs.type == Type::BOOL) {
+      compare_block(op, as_ints(lhs, node.lhs_ints), as_ints(rhs, node.rhs_ints), BLOCK_WORDS, bits);
+    } else if (lhs.type == Type::INT && rhs.type == Type::INT) {
+      compare_block(op, lhs.ints, rhs.ints, BLOCK_WORDS, bits);
+    } else {
+      compare_block(op, as_floats(lhs.type, lhs, node.lhs_floats), as_floats(rhs.type, rhs, node.rhs_floats),
+                    BLOCK_WORDS, bits);
+    }
+    // null is lower than any other value and equal to null
+    uint64_t null_value = all(compare(op, -1));
+    uint64_t value_null = all(compare(op, 1));
+    uint64_t null_null = all(compare(op, 0));
+    for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+      uint64_t lhs_valid = lhs.type == Type::NONE ? 0 : word(lhs.valid, w, ~uint64_t(0));
+      uint64_t rhs_valid = rhs.type == Type::NONE ? 0 : word(rhs.valid, w, ~uint64_t(0));
+      bits[w] = (lhs_valid & rhs_valid & bits[w]) | (~lhs_valid & rhs_valid & null_value)
+          | (lhs_valid & ~rhs_valid & value_null) | (~lhs_valid & ~rhs_valid & null_null);
+      errors[w] = word(lhs.errors, w, 0) | word(rhs.errors, w, 0);
+    }
+  }
+
+  static const int64_t *as_ints(const Vector &vector, std::vector<int64_t> &ints) {
+    for (size_t i = 0; i < BLOCK_ROWS; ++i) {
+      ints[i] = (vector.bits[i / 64] >> (i % 64)) & 1;
+    }
+    return ints.data();
+  }
+
+  /**
+   * like cppel::truthy, where every string is truthy even the empty one
+   */
+  static void truthy(const Vector &vector, uint64_t *bits) {
+    switch (vector.type) {
+      case Type::NONE:
+        std::fill(bits, bits + BLOCK_WORDS, 0);
+        return;
+      case Type::BOOL:
+        std::copy(vector.bits, vector.bits + BLOCK_WORDS, bits);
+        break;
+      case Type::INT: {
+        int64_t zero[64] = {};
+        for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+          compare_block(vector.ints + w * 64, zero, 1, bits + w, std::not_equal_to<int64_t>());
+        }
+        break;
+      }
+      case Type::FLOAT: {
+        double zero[64] = {};
+        for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+          compare_block(vector.floats + w * 64, zero, 1, bits + w, std::not_equal_to<double>());
+        }
+        break;
+      }
+      case Type::STRING:
+        std::fill(bits, bits + BLOCK_WORDS, ~uint64_t(0));
+        break;
+    }
+    for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+      bits[w] &= word(vector.valid, w, ~uint64_t(0));
+    }
+  }
+};
+
+} // namespace columnar
+
+/**
+ * rows of a columnar batch selected by a predicate
+ *
+ * properties read the columns of the same name, comparisons follow the order of json values where
+ * null is lower than anything, and a row whose arithmetic reads a null or divides an int by zero
+ * isn't selected, where the interpreter would fail. like the interpreter, int arithmetic narrows its
+ * operands to int and float arithmetic narrows them to float. other expressions, and comparisons
+ * between two string columns, are evaluated a row at a time by the interpreter
+ */
+class ColumnarFilter {
+ public:
+  explicit ColumnarFilter(const Expression &expr) :
+      expr_(expr), root_(columnar::Evaluator::compile(expr.get_root().get())) {}
+
+  /**
+   * whether the expression is compiled to vector kernels, some columns may still need the fallback
+   */
+  bool is_vectorized() const {
+    return root_ != nullptr;
+  }
+
+  /**
+   * not thread safe, the compiled tree keeps the buffers of the last batch
+   * @return bit per row, set for the rows on which the expression is truthy
+   */
+  Bitmap filter(const ColumnBatch &batch) {
+    Bitmap selection(batch.size());
+    if (!root_ || root_->kind == columnar::Node::Kind::LITERAL || !columnar::Evaluator::bind(*root_, batch)) {
+      filter_rows(batch, selection);
+      return selection;
+    }
+    uint64_t *selected = selection.data();
+    size_t words = (batch.size() + 63) / 64;
+    for (size_t start = 0; start < batch.size(); start += columnar::BLOCK_ROWS) {
+      uint64_t bits[columnar::BLOCK_WORDS];
+      columnar::Vector result = columnar::Evaluator::evaluate(*root_, start);
+      truthy_bits(result, bits);
+      for (size_t w = 0; w < columnar::BLOCK_WORDS && start / 64 + w < words; ++w) {
+        selected[start / 64 + w] = bits[w] & ~(result.errors ? result.errors[w] : 0);
+      }
+    }
+    selection.clear_tail();
+    return selection;
+  }
+
+ private:
+  Expression expr_;
+  std::unique_ptr<columnar::Node> root_;
+
+  void truthy_bits(const columnar::Vector &result, uint64_t *bits) {
+    if (result.type == columnar::Type::BOOL) {
+      std::copy(result.bits, result.bits + columnar::BLOCK_WORDS, bits);
+      if (result.valid) {
+        for (size_t w = 0; w < columnar::BLOCK_WORDS; ++w) {
+          bits[w] &= result.valid[w];
+        }
+      }
+      return;
+    }
+    // a predicate which isn't boolean, like a single numeric column
+    std::fill(bits, bits + columnar::BLOCK_WORDS, 0);
+    for (size_t i = 0; i < columnar::BLOCK_ROWS; ++i) {
+      bool valid = !result.valid || ((result.valid[i / 64] >> (i % 64)) & 1);
+      bool value = false;
+      switch (result.type) {
+        case columnar::Type::INT:
+          value = result.ints[i] != 0;
+          break;
+        case columnar::Type::FLOAT:
+          value = result.floats[i] != 0;
+          break;
+        case columnar::Type::STRING:
+          value = true;
+          break;
+        default:
+          break;
+      }
+      bits[i / 64] |= uint64_t(valid && value) << (i % 64);
+    }
+  }
+
+  void filter_rows(const ColumnBatch &batch, Bitmap &selection) {
+    for (size_t row = 0; row < batch.size(); ++row) {
+      json data = batch.row(row);
+      EvaluationContext context(data);
+      EvaluateResult result = expr_.try_evaluate(context);
+      selection.set(row, result.ok() && truthy(&result.value));
+    }
+  }
+};
+
+} // namespace cppel
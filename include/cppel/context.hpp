@@ -7,20 +7,39 @@
 #include <string>
 #include <deque>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "nlohmann/json.hpp"
+#include "budget.hpp"
+#include "document.hpp"
 #include "function.hpp"
+#include "loader.hpp"
 #include "exception.hpp"
+#include "profiler.hpp"
 
 namespace cppel {
 using json = nlohmann::json;
 
 using Arguments = std::vector<const json *>;
+using Variables = std::vector<std::string>;
+using Parameters = std::vector<std::string>;
 using Function = std::function<std::shared_ptr<json>(Arguments &args)>;
 
 class EvaluationContext {
  public:
   EvaluationContext(const json &root_data) : root_data_(&root_data) {}
 
+  /**
+   * evaluate on a native object, see adapter.hpp
+   * @param adapter
+   * @param object
+   */
+  EvaluationContext(const DocumentAdapter &adapter, const void *object) {
+    root_data_ = push_document(&adapter, object);
+    root_documents_ = documents_->size();
+  }
+
   const json *get_root_data() {
     return root_data_;
   }
@@ -43,36 +62,514 @@ class EvaluationContext {
   }
 
   const json *push_ref(std::shared_ptr<const json> data) {
+    if (profiler_) {
+      profiler_->on_push_ref();
+    }
+    if (budgeted_) {
+      budget_.on_temporary(*data);
+    }
     ref_queue_.push_back(data);
     return data.get();
   }
 
+  /**
+   * report an evaluation error, throws EvaluateError unless the context is non-throwing,
+   * in which case the error is kept in the status and nullptr is returned to be propagated
+   * @param code
+   * @param message
+   * @param pos
+   * @return
+   */
+  const json *fail(const ErrorCode code, const char *message, const size_t pos) {
+    if (throw_error_) {
+      CPPEL_THROW(EvaluateError(message + std::to_string(pos)));
+    }
+    status_.code = code;
+    status_.message = message;
+    status_.pos = pos;
+    return nullptr;
+  }
+
+  bool is_throw_error() const {
+    return throw_error_;
+  }
+
+  void set_throw_error(const bool throw_error) {
+    throw_error_ = throw_error;
+  }
+
+  EvaluateStatus &get_status() {
+    return status_;
+  }
+
+  /**
+   * whether the evaluation failed on a call of a batch function which isn't loaded yet
+   */
+  bool is_pending() const {
+    return status_.code == ErrorCode::PENDING;
+  }
+
+  /**
+   * forget the state of an interrupted evaluation
+   */
+  void reset() {
+    status_ = EvaluateStatus();
+    data_deque_.clear();
+    ref_queue_.clear();
+    if (values_) {
+      values_->clear();
+    }
+    clear_documents();
+    budget_.release();
+  }
+
+  void on_iterate(const uint64_t count) {
+    if (profiler_) {
+      profiler_->on_iterate(count);
+    }
+    if (budgeted_) {
+      budget_.on_iterate(count);
+    }
+  }
+
+  /**
+   * limit every evaluation on the context, an evaluation exceeding a limit fails with
+   * STEP_LIMIT, ITERATION_LIMIT, MEMORY_LIMIT or DEADLINE
+   * @param limits
+   */
+  void set_limits(const EvaluationLimits &limits) {
+    budget_ = Budget(limits);
+    budgeted_ = true;
+  }
+
+  void clear_limits() {
+    budget_ = Budget();
+    budgeted_ = false;
+  }
+
+  bool has_budget() const {
+    return budgeted_;
+  }
+
+  /**
+   * usage of the last evaluation, see set_limits
+   */
+  const Budget &get_budget() const {
+    return budget_;
+  }
+
+  void start_budget() {
+    if (budgeted_) {
+      budget_.start();
+    }
+  }
+
+  /**
+   * count a visited node, nodes call it only when has_budget()
+   * @return false when a limit is exceeded
+   */
+  bool on_step() {
+    return budget_.on_step();
+  }
+
+  /**
+   * check the limits before an element of a loop, nodes call it only when has_budget()
+   * @param iterating elements iterated by the loop so far
+   * @param building approximate bytes of the array built by the loop
+   * @return false when a limit is exceeded
+   */
+  bool within_budget(const uint64_t iterating, const uint64_t building) {
+    return budget_.check(iterating, building);
+  }
+
+  /**
+   * report the exceeded limit of the budget
+   */
+  const json *fail_budget(const size_t pos) {
+    switch (budget_.get_exceeded()) {
+      case Budget::Limit::STEPS:
+        return fail(ErrorCode::STEP_LIMIT, "step limit exceeded at ", pos);
+      case Budget::Limit::ITERATIONS:
+        return fail(ErrorCode::ITERATION_LIMIT, "iteration limit exceeded at ", pos);
+      case Budget::Limit::BYTES:
+        return fail(ErrorCode::MEMORY_LIMIT, "memory limit exceeded at ", pos);
+      default:
+        return fail(ErrorCode::DEADLINE, "deadline exceeded at ", pos);
+    }
+  }
+
+  Profiler *get_profiler() {
+    return profiler_;
+  }
+
+  void set_profiler(Profiler *profiler) {
+    profiler_ = profiler;
+  }
+
+  /**
+   * loader of the batch functions, nullptr when there is none
+   */
+  BatchLoader *get_loader() {
+    return loader_;
+  }
+
+  void set_loader(BatchLoader *loader) {
+    loader_ = loader;
+  }
+
   void clear_ref() {
     ref_queue_.clear();
+    if (values_) {
+      values_->clear();
+    }
+    clear_documents();
+    budget_.release();
+  }
+
+  /**
+   * temporary plain value, like a field of a native object, stored without a heap allocation of its own
+   * @param value
+   * @return
+   */
+  const json *push_value(json &&value) {
+    if (profiler_) {
+      profiler_->on_push_ref();
+    }
+    if (budgeted_) {
+      budget_.on_temporary(value);
+    }
+    if (!values_) {
+      values_.reset(new std::deque<json>());
+    }
+    values_->push_back(std::move(value));
+    return &values_->back();
+  }
+
+  /**
+   * placeholder of a native object, valid until clear_ref(). placeholders are discarded values,
+   * which never come from parsed data, the placeholder of an array is a json array whose
+   * elements are the placeholders of the elements
+   * @param adapter
+   * @param object
+   * @return
+   */
+  const json *push_document(const DocumentAdapter *adapter, const void *object) {
+    if (!documents_) {
+      documents_.reset(new std::deque<DocumentEntry>());
+    }
+    documents_->emplace_back();
+    DocumentEntry &entry = documents_->back();
+    entry.document.adapter = adapter;
+    entry.document.object = object;
+    if (adapter->is_array(object)) {
+      entry.value = json::array();
+      entry.value.get_ref<json::array_t &>().resize(adapter->size(object), json(json::value_t::discarded));
+      entry.size = entry.value.size();
+      if (entry.size > 0) {
+        entry.elements = &entry.value[0];
+        arrays_.emplace(entry.elements, documents_->size() - 1);
+      }
+    } else {
+      entry.value = json(json::value_t::discarded);
+    }
+    document_index_[&entry.value] = documents_->size() - 1;
+    return &entry.value;
+  }
+
+  bool has_documents() const {
+    return documents_ && !documents_->empty();
+  }
+
+  /**
+   * native object behind data
+   * @param data
+   * @param document
+   * @return false when data is plain json
+   */
+  bool find_document(const json *data, Document &document) const {
+    if (!has_documents() || !(data->is_discarded() || data->is_array())) {
+      return false;
+    }
+    if (data->is_discarded()) {
+      // elements of arrays are the most frequent ones, they are found in the array starting before them
+      auto array = arrays_.upper_bound(data);
+      if (array != arrays_.begin()) {
+        const DocumentEntry &entry = (*documents_)[(--array)->second];
+        if (data < entry.elements + entry.size) {
+          size_t index = data - entry.elements;
+          const DocumentAdapter *element_adapter = entry.document.adapter->get_element_adapter();
+          if (element_adapter && !entry.document.adapter->is_element_value(entry.document.object, index)) {
+            document.adapter = element_adapter;
+            document.object = entry.document.adapter->get_element_object(entry.document.object, index);
+          } else {
+            document = entry.document;
+            document.is_value = true;
+            document.index = index;
+          }
+          return true;
+        }
+      }
+    }
+    auto it = document_index_.find(data);
+    if (it != document_index_.end()) {
+      document = (*documents_)[it->second].document;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * data converted to json when it's a document, nodes call it on the values they return
+   * @param data
+   * @return
+   */
+  const json *resolve(const json *data) {
+    Document document;
+    if (!data || !find_document(data, document)) {
+      return data;
+    }
+    if (document.is_value) {
+      return document.adapter->get_element(*this, document.object, document.index);
+    }
+    return push_ref(std::make_shared<json>(document.adapter->to_json(document.object)));
+  }
+
+  /**
+   * data to iterate or index, arrays of documents are their placeholders and other documents are converted
+   * @param data
+   * @return
+   */
+  const json *resolve_iterable(const json *data) {
+    Document document;
+    if (data->is_array() || !find_document(data, document)) {
+      return data;
+    }
+    if (document.is_array()) {
+      return push_document(document.adapter, document.object);
+    }
+    return resolve(data);
+  }
+
+  /**
+   * whether data is a temporary owned by the context, rather than a part of the input or a literal
+   * @param data
+   * @return
+   */
+  bool is_ref(const json *data) const {
+    for (auto it = ref_queue_.rbegin(); it != ref_queue_.rend(); ++it) {
+      if (it->get() == data) {
+        return true;
+      }
+    }
+    if (values_) {
+      for (auto &value : *values_) {
+        if (&value == data) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * move data out of the context when it's a temporary nobody else shares, copy it otherwise
+   * @param data
+   * @return
+   */
+  json take_ref(const json *data) {
+    for (auto it = ref_queue_.rbegin(); it != ref_queue_.rend(); ++it) {
+      if (it->get() == data) {
+        if (it->use_count() == 1) {
+          return std::move(*const_cast<json *>(data));
+        }
+        break;
+      }
+    }
+    return *data;
+  }
+
+  /**
+   * copy of an item of a collection, a document is converted and the conversion is moved out
+   * @param data
+   * @return
+   */
+  json take_value(const json *data) {
+    const json *value = resolve(data);
+    if (value == data) {
+      return *data;
+    }
+    if (values_ && !values_->empty() && value == &values_->back()) {
+      return std::move(values_->back());
+    }
+    return take_ref(value);
+  }
+
+  /**
+   * named parameter of the evaluated expressions, read by #name
+   * @param name
+   * @param value
+   */
+  void set_variable(const std::string &name, json value) {
+    variables_[name] = std::move(value);
+    ++variables_version_;
+  }
+
+  bool has_variables() const {
+    return !variables_.empty();
+  }
+
+  /**
+   * variable given by set_variable, nullptr when there is none
+   */
+  const json *get_variable(const std::string &name) const {
+    auto it = variables_.find(name);
+    return it != variables_.end() ? &it->second : nullptr;
+  }
+
+  /**
+   * prepare the frame of an expression, whose variables are indexed by the slots resolved when it
+   * was parsed. parameters are bound to the slots again only when they or the expression change
+   * @param variables names of the slots, nullptr when the expression has no variable
+   * @param parameters values bound to the parameters of the expression, by slot
+   */
+  void enter_frame(const std::shared_ptr<const Variables> &variables, const std::vector<json> *parameters = nullptr) {
+    parameters_ = parameters;
+    if (!variables) {
+      frame_.clear();
+      return;
+    }
+    if (variables != frame_variables_ || frame_version_ != variables_version_) {
+      bound_.assign(variables->size(), nullptr);
+      for (size_t slot = 0; slot < variables->size() && !variables_.empty(); ++slot) {
+        auto it = variables_.find((*variables)[slot]);
+        if (it != variables_.end()) {
+          bound_[slot] = &it->second;
+        }
+      }
+      frame_variables_ = variables;
+      frame_version_ = variables_version_;
+    }
+    frame_.assign(bound_.begin(), bound_.end());
+  }
+
+  /**
+   * value of a variable, nullptr when it's neither assigned nor given
+   */
+  const json *get_slot(const size_t slot) const {
+    return slot < frame_.size() ? frame_[slot] : nullptr;
+  }
+
+  void set_slot(const size_t slot, const json *value) {
+    if (slot < frame_.size()) {
+      frame_[slot] = value;
+    }
+  }
+
+  /**
+   * value bound to a parameter like ?1 or :name, nullptr when it isn't bound
+   */
+  const json *get_parameter(const size_t slot) const {
+    if (!parameters_ || slot >= parameters_->size() || (*parameters_)[slot].is_discarded()) {
+      return nullptr;
+    }
+    return &(*parameters_)[slot];
   }
 
   void add_function(const std::pair<std::string, int> &name_args_count, const Function function) {
     functions_[name_args_count] = function;
   }
 
+  /**
+   * function added to the context, or else a preset one
+   */
+  const Function *find_function(const std::pair<std::string, int> &name_args_count) const {
+    if (!functions_.empty()) {
+      auto it = functions_.find(name_args_count);
+      if (it != functions_.end()) {
+        return &it->second;
+      }
+    }
+    auto preset = presets().find(name_args_count);
+    return preset != presets().end() ? &preset->second : nullptr;
+  }
+
   Function &get_function(const std::pair<std::string, int> &name_args_count) {
     if (functions_.find(name_args_count) != functions_.end()) {
       return functions_[name_args_count];
     }
+    auto preset = presets().find(name_args_count);
+    if (preset != presets().end()) {
+      // copied so that changing the returned function doesn't change the other contexts
+      return functions_[name_args_count] = preset->second;
+    }
     CPPEL_THROW(EvaluateError(
                     "function [" + name_args_count.first + "] with args_count " + std::to_string(name_args_count.second)
                         + " not exits"));
   }
 
  private:
+  struct DocumentEntry {
+    json value;
+    Document document;
+    const json *elements = nullptr;
+    size_t size = 0;
+  };
+
   const json *root_data_;
   std::deque<std::shared_ptr<const json>> ref_queue_;
+  // created on first use, most evaluations push neither values nor documents
+  std::unique_ptr<std::deque<json>> values_;
+  std::unique_ptr<std::deque<DocumentEntry>> documents_;
+  std::unordered_map<const json *, size_t> document_index_;
+  // documents of the non empty arrays by the address of their first element placeholder
+  std::map<const json *, size_t> arrays_;
+  size_t root_documents_ = 0;
   std::deque<const json *> data_deque_;
+  std::unordered_map<std::string, json> variables_;
+  uint64_t variables_version_ = 0;
+  std::shared_ptr<const Variables> frame_variables_;
+  uint64_t frame_version_ = 0;
+  std::vector<const json *> bound_;
+  std::vector<const json *> frame_;
+  const std::vector<json> *parameters_ = nullptr;
+  Profiler *profiler_ = nullptr;
+  BatchLoader *loader_ = nullptr;
+  Budget budget_;
+  bool budgeted_ = false;
+  bool throw_error_ = true;
+  EvaluateStatus status_;
 
-  std::map<std::pair<std::string, int>, Function> functions_ = {
-      {std::make_pair("join", 2), PresetFunction::join},
-      {std::make_pair("split", 2), PresetFunction::split}
-  };
+  // functions added to the context, the preset ones are shared by every context
+  std::map<std::pair<std::string, int>, Function> functions_;
+
+  static const std::map<std::pair<std::string, int>, Function> &presets() {
+    static const std::map<std::pair<std::string, int>, Function> presets = {
+        {std::make_pair("join", 2), PresetFunction::join},
+        {std::make_pair("split", 2), PresetFunction::split},
+        {std::make_pair("sum", 1), PresetFunction::sum},
+        {std::make_pair("avg", 1), PresetFunction::avg},
+        {std::make_pair("min", 1), PresetFunction::min},
+        {std::make_pair("max", 1), PresetFunction::max},
+        {std::make_pair("count", 1), PresetFunction::count}
+    };
+    return presets;
+  }
+
+  /**
+   * drop the documents pushed during the evaluation, the root one is kept
+   */
+  void clear_documents() {
+    if (!documents_) {
+      return;
+    }
+    while (documents_->size() > root_documents_) {
+      document_index_.erase(&documents_->back().value);
+      if (documents_->back().size > 0) {
+        arrays_.erase(documents_->back().elements);
+      }
+      documents_->pop_back();
+    }
+  }
 };
 
 } // namespace cppel
\ No newline at end of file
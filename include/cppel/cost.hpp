@@ -0,0 +1,390 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hpp"
+#include "expression.hpp"
+#include "native.hpp"
+
+/**
+ * static cost estimation
+ *
+ * the worst case cost of an expression is a polynomial of n, the size of the arrays and strings
+ * of the input. every loop over a value of size n multiplies the cost of its body by n, so the
+ * degree of the cost is the depth of the nested projections, selections, flats and orderings
+ */
+
+namespace cppel {
+
+/**
+ * polynomial of n, the size of the arrays and strings of the input
+ */
+class Cost {
+ public:
+  Cost() {}
+
+  explicit Cost(const double constant) : terms_(1, constant) {}
+
+  /**
+   * highest power of n
+   */
+  size_t degree() const {
+    return terms_.empty() ? 0 : terms_.size() - 1;
+  }
+
+  double coefficient(const size_t power) const {
+    return power < terms_.size() ? terms_[power] : 0;
+  }
+
+  /**
+   * numeric cost for arrays of n elements
+   */
+  double at(const double n) const {
+    double value = 0;
+    for (size_t power = terms_.size(); power > 0; --power) {
+      value = value * n + terms_[power - 1];
+    }
+    return value;
+  }
+
+  /**
+   * cost of a loop running the body n^power times
+   */
+  Cost times_n(const size_t power) const {
+    Cost cost;
+    if (!terms_.empty()) {
+      cost.terms_.assign(power, 0);
+      cost.terms_.insert(cost.terms_.end(), terms_.begin(), terms_.end());
+    }
+    return cost;
+  }
+
+  /**
+   * add coefficient * n^power
+   */
+  Cost &add(const size_t power, const double coefficient) {
+    if (terms_.size() <= power) {
+      terms_.resize(power + 1, 0);
+    }
+    terms_[power] += coefficient;
+    return *this;
+  }
+
+  Cost &operator+=(const Cost &other) {
+    if (terms_.size() < other.terms_.size()) {
+      terms_.resize(other.terms_.size(), 0);
+    }
+    for (size_t power = 0; power < other.terms_.size(); ++power) {
+      terms_[power] += other.terms_[power];
+    }
+    return *this;
+  }
+
+  Cost operator+(const Cost &other) const {
+    Cost cost = *this;
+    cost += other;
+    return cost;
+  }
+
+  /**
+   * like 3 + 2n + n^2
+   */
+  std::string to_string() const {
+    std::string str;
+    for (size_t power = 0; power < terms_.size(); ++power) {
+      if (terms_[power] == 0) {
+        continue;
+      }
+      if (!str.empty()) {
+        str += " + ";
+      }
+      char coefficient[32];
+      std::snprintf(coefficient, sizeof(coefficient), "%g", terms_[power]);
+      if (power == 0 || terms_[power] != 1) {
+        str += coefficient;
+      }
+      if (power > 0) {
+        str += power == 1 ? "n" : "n^" + std::to_string(power);
+      }
+    }
+    return str.empty() ? "0" : str;
+  }
+
+ private:
+  // coefficients by power of n
+  std::vector<double> terms_;
+};
+
+/**
+ * weights of the operations counted by the estimation
+ */
+struct CostModel {
+  // evaluation of any node
+  double node = 1;
+  // element copied into an array built by a projection, a selection or a flat
+  double element = 1;
+  // call of a function of the context, whose cost isn't known, or a string function like #split, per character
+  double function = 10;
+  // builtin method, like a string operation, per character of its receiver
+  double method = 2;
+  // matches, per character
+  double pattern = 5;
+  // per element of #sort, #top, #distinct and #groupBy, for the comparisons and hashing
+  double ordering = 8;
+};
+
+namespace cost {
+
+/**
+ * walks the tree like ReadPathCollector, threading the shape of the active data
+ */
+class CostEstimator {
+ public:
+  explicit CostEstimator(const CostModel &model) : model_(model) {}
+
+  Cost estimate(const AstNode *root) {
+    slots_.clear();
+    Cost cost;
+    estimate(root, input(), cost);
+    return cost;
+  }
+
+ private:
+  /**
+   * powers of n of the size of a value and of the size of its elements,
+   * the elements of the elements are assumed to be as large as the elements
+   */
+  struct Shape {
+    size_t size;
+    size_t element;
+  };
+
+  static Shape input() {
+    return Shape{1, 1};
+  }
+
+  static Shape constant() {
+    return Shape{0, 0};
+  }
+
+  const CostModel &model_;
+  // shape of the values assigned to the variables, by slot
+  std::unordered_map<size_t, Shape> slots_;
+
+  static Shape widest(const Shape &a, const Shape &b) {
+    return Shape{std::max(a.size, b.size), std::max(a.element, b.element)};
+  }
+
+  static bool is_number(const AstNode *node) {
+    return node->get_kind() == NodeKind::LITERAL_INT || node->get_kind() == NodeKind::LITERAL_FLOAT;
+  }
+
+  /**
+   * add the cost of node evaluated on active to cost
+   * @return shape of the value of node
+   */
+  Shape estimate(const AstNode *node, const Shape &active, Cost &cost) {
+    const std::vector<std::shared_ptr<AstNode>> &children = node->get_children();
+    const NativeNode *native = dynamic_cast<const NativeNode *>(node);
+    if (native) {
+      return estimate(native->get_interpreted().get(), active, cost);
+    }
+    cost.add(0, model_.node);
+    switch (node->get_kind()) {
+      case NodeKind::LITERAL_NONE:
+      case NodeKind::LITERAL_BOOL:
+      case NodeKind::LITERAL_INT:
+      case NodeKind::LITERAL_FLOAT:
+      case NodeKind::LITERAL_STRING: {
+        return constant();
+      }
+      case NodeKind::PROPERTY:
+      case NodeKind::INDEXER: {
+        if (!children.empty()) {
+          estimate(children[0].get(), active, cost);
+        }
+        return Shape{active.element, active.element};
+      }
+      case NodeKind::VARIABLE: {
+        const VariableNode *variable = static_cast<const VariableNode *>(node);
+        if (variable->get_variable_name() == "this") {
+          return active;
+        }
+        auto it = variable->is_slot() ? slots_.find(variable->get_slot()) : slots_.end();
+        return it != slots_.end() ? it->second : input();
+      }
+      case NodeKind::PARAMETER: {
+        // literals parameterized by the plan cache stay constants
+        return static_cast<const ParameterNode *>(node)->get_parameter_name()[0] == '$' ? constant() : input();
+      }
+      case NodeKind::ASSIGN: {
+        Shape shape = estimate(children[1].get(), active, cost);
+        const VariableNode *variable = dynamic_cast<const VariableNode *>(children[0].get());
+        if (variable && variable->is_slot()) {
+          slots_[variable->get_slot()] = shape;
+        }
+        return shape;
+      }
+      case NodeKind::SEQUENCE: {
+        Shape shape = constant();
+        for (auto &child : children) {
+          shape = estimate(child.get(), active, cost);
+        }
+        return shape;
+      }
+      case NodeKind::COMPOUND_EXPRESSION: {
+        Shape shape = active;
+        for (auto &child : children) {
+          shape = estimate(child.get(), shape, cost);
+        }
+        return shape;
+      }
+      case NodeKind::PROJECTION:
+      case NodeKind::SELECTION:
+      case NodeKind::FLAT: {
+        Cost body;
+        Shape element{active.element, active.element};
+        Shape item = estimate(children[0].get(), element, body);
+        if (node->get_kind() == NodeKind::SELECTION) {
+          bool all = static_cast<const Selection *>(node)->get_select_type() == Selection::SelectType::ALL;
+          body.add(0, all ? model_.element : 0);
+          cost += body.times_n(active.size);
+          return all ? active : element;
+        }
+        if (node->get_kind() == NodeKind::FLAT) {
+          // the items of every element are copied
+          body.add(item.size, model_.element);
+          cost += body.times_n(active.size);
+          return Shape{active.size + item.size, item.element};
+        }
+        body.add(0, model_.element);
+        cost += body.times_n(active.size);
+        return Shape{active.size, item.size};
+      }
+      case NodeKind::METHOD: {
+        for (auto &child : children) {
+          estimate(child.get(), active, cost);
+        }
+        cost.add(active.size, model_.method);
+        return active;
+      }
+      case NodeKind::OP_MATCHES: {
+        Shape shape = estimate(children[0].get(), active, cost);
+        estimate(children[1].get(), active, cost);
+        cost.add(shape.size, model_.pattern);
+        return constant();
+      }
+      case NodeKind::OP_IN: {
+        estimate(children[0].get(), active, cost);
+        Shape list = estimate(children[1].get(), active, cost);
+        // without the set compiled from a list of literals, every element of the list is compared
+        if (!static_cast<const OpIn *>(node)->get_set()) {
+          cost.add(list.size, model_.node);
+        }
+        return constant();
+      }
+      case NodeKind::OP_PLUS: {
+        Shape shape = constant();
+        for (auto &child : children) {
+          shape = widest(shape, estimate(child.get(), active, cost));
+        }
+        // the worst case concatenates strings, unless the operator is unary or a number is added
+        if (children.size() == 2 && !is_number(children[0].get()) && !is_number(children[1].get())) {
+          cost.add(shape.size, model_.element);
+        }
+        return shape;
+      }
+      case NodeKind::FUNCTION: {
+        return estimate_function(static_cast<const FunctionNode *>(node), active, cost);
+      }
+      case NodeKind::INLINE_LIST:
+      case NodeKind::INLINE_MAP: {
+        Shape shape = constant();
+        for (auto &child : children) {
+          Shape item = estimate(child.get(), active, cost);
+          shape.element = std::max(shape.element, item.size);
+        }
+        return shape;
+      }
+      default:
+        break;
+    }
+    // operators, the worst case of a condition evaluates every branch
+    Shape shape = constant();
+    for (auto &child : children) {
+      shape = widest(shape, estimate(child.get(), active, cost));
+    }
+    return shape;
+  }
+
+  Shape estimate_function(const FunctionNode *node, const Shape &active, Cost &cost) {
+    const std::vector<std::shared_ptr<AstNode>> &children = node->get_children();
+    const std::string &name = node->get_function_name();
+    if (node->is_ordering() || node->is_grouping()) {
+      Shape collection = estimate(children[0].get(), active, cost);
+      Shape element{collection.element, collection.element};
+      // the key of #sort and #groupBy is the second argument, #top has the count before it
+      size_t key = name == "top" ? 2 : 1;
+      Cost body(model_.ordering);
+      for (size_t i = 1; i < children.size(); ++i) {
+        if (i == key) {
+          estimate(children[i].get(), element, body);
+        } else {
+          estimate(children[i].get(), active, cost);
+        }
+      }
+      cost += body.times_n(collection.size);
+      return collection;
+    }
+    Shape shape = constant();
+    for (auto &child : children) {
+      shape = widest(shape, estimate(child.get(), active, cost));
+    }
+    aggregate::Kind kind;
+    if (PresetFunction::find_aggregate(name, kind)) {
+      cost.add(shape.size, model_.node);
+      return constant();
+    }
+    cost.add(shape.size, model_.function);
+    return shape;
+  }
+};
+
+} // namespace cost
+
+/**
+ * worst case cost of an expression
+ */
+inline Cost estimate_cost(const AstNode &root, const CostModel &model = CostModel()) {
+  return cost::CostEstimator(model).estimate(&root);
+}
+
+inline Cost estimate_cost(const Expression &expr, const CostModel &model = CostModel()) {
+  return estimate_cost(*expr.get_root(), model);
+}
+
+using AdmissionHandler = std::function<void(const std::string &expr_str, const Cost &cost)>;
+
+/**
+ * budget of the expressions accepted by a Parser, see Parser::set_admission
+ */
+struct AdmissionPolicy {
+  // highest accepted cost at array_size, 0 accepts everything
+  double max_cost = 0;
+  // n at which the cost is compared to max_cost
+  double array_size = 1000;
+  CostModel model;
+  // when set, the expressions above the budget are flagged to it and accepted instead of rejected
+  AdmissionHandler on_exceeded;
+};
+
+} // namespace cppel
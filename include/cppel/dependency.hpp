@@ -0,0 +1,575 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "ast.hpp"
+#include "context.hpp"
+#include "exception.hpp"
+#include "expression.hpp"
+#include "native.hpp"
+
+/**
+ * dependency tracking
+ *
+ * the paths of the input an expression reads are found by walking its tree once, an ExpressionSet
+ * indexes them so that a change of the input only re-evaluates the expressions reading it.
+ * paths are json pointers like /user/age, the segment * stands for any element of an array
+ */
+
+namespace cppel {
+
+using Path = std::vector<std::string>;
+
+namespace dependency {
+
+/**
+ * @throw EvaluateError when pointer isn't a json pointer
+ */
+inline Path parse_pointer(const std::string &pointer) {
+  Path path;
+  if (pointer.empty()) {
+    return path;
+  }
+  if (pointer[0] != '/') {
+    CPPEL_THROW(EvaluateError("invalid json pointer " + pointer));
+  }
+  std::string segment;
+  for (size_t i = 1; i <= pointer.size(); ++i) {
+    if (i == pointer.size() || pointer[i] == '/') {
+      path.push_back(segment);
+      segment.clear();
+    } else if (pointer[i] == '~' && i + 1 < pointer.size() && (pointer[i + 1] == '0' || pointer[i + 1] == '1')) {
+      segment += pointer[++i] == '0' ? '~' : '/';
+    } else {
+      segment += pointer[i];
+    }
+  }
+  return path;
+}
+
+inline std::string to_pointer(const Path &path) {
+  std::string pointer;
+  for (auto &segment : path) {
+    pointer += '/';
+    for (char ch : segment) {
+      if (ch == '~') {
+        pointer += "~0";
+      } else if (ch == '/') {
+        pointer += "~1";
+      } else {
+        pointer += ch;
+      }
+    }
+  }
+  return pointer;
+}
+
+/**
+ * a change at changed affects a read of read when one is a prefix of the other
+ */
+inline bool overlaps(const Path &read, const Path &changed) {
+  size_t size = std::min(read.size(), changed.size());
+  for (size_t i = 0; i < size; ++i) {
+    if (read[i] != changed[i] && read[i] != "*") {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * path changed by inserting or erasing at pointer. an index or - is taken for an element of an array,
+ * whose following elements shift, so the whole array changes
+ */
+inline std::string shifted_path(const std::string &pointer) {
+  size_t slash = pointer.rfind('/');
+  if (slash == std::string::npos || slash + 1 == pointer.size()) {
+    return pointer;
+  }
+  std::string segment = pointer.substr(slash + 1);
+  if (segment == "-" || segment.find_first_not_of("0123456789") == std::string::npos) {
+    return pointer.substr(0, slash);
+  }
+  return pointer;
+}
+
+/**
+ * paths changed by the operations of a json patch, a move changes both its source and its target.
+ * adding, removing or moving an element of an array changes the array
+ */
+inline std::vector<std::string> patched_paths(const json &patch) {
+  std::vector<std::string> paths;
+  for (auto &operation : patch) {
+    auto op = operation.find("op");
+    if (op == operation.end() || *op == "test") {
+      continue;
+    }
+    const std::string &path = operation.at("path").get_ref<const std::string &>();
+    if (*op == "replace") {
+      paths.push_back(path);
+      continue;
+    }
+    if (*op == "move") {
+      paths.push_back(shifted_path(operation.at("from").get<std::string>()));
+    }
+    paths.push_back(shifted_path(path));
+  }
+  return paths;
+}
+
+inline const json &patch_member(const json &operation, const char *name) {
+  auto it = operation.find(name);
+  if (it == operation.end()) {
+    CPPEL_THROW(EvaluateError(std::string("json patch operation without ") + name));
+  }
+  return *it;
+}
+
+inline size_t patch_index(const std::string &segment, const size_t size) {
+  if (segment.empty() || segment.size() > 18 || (segment.size() > 1 && segment[0] == '0')
+      || segment.find_first_not_of("0123456789") != std::string::npos || std::stoull(segment) > size) {
+    CPPEL_THROW(EvaluateError("invalid json patch index " + segment));
+  }
+  return static_cast<size_t>(std::stoull(segment));
+}
+
+inline void patch_add(json &data, const std::string &pointer, json value) {
+  const json::json_pointer ptr(pointer);
+  if (ptr.empty()) {
+    data = std::move(value);
+    return;
+  }
+  const json::json_pointer parent_ptr = ptr.parent_pointer();
+  json &parent = data.at(parent_ptr);
+  const std::string &key = ptr.back();
+  if (parent.is_object()) {
+    parent[key] = std::move(value);
+  } else if (parent.is_array() && key == "-") {
+    parent.push_back(std::move(value));
+  } else if (parent.is_array()) {
+    parent.insert(parent.begin() + patch_index(key, parent.size()), std::move(value));
+  } else {
+    CPPEL_THROW(EvaluateError("json patch can't add to a value at " + pointer));
+  }
+}
+
+inline json patch_remove(json &data, const std::string &pointer) {
+  const json::json_pointer ptr(pointer);
+  json removed = std::move(data.at(ptr));
+  if (ptr.empty()) {
+    data = nullptr;
+    return removed;
+  }
+  const json::json_pointer parent_ptr = ptr.parent_pointer();
+  json &parent = data.at(parent_ptr);
+  if (parent.is_object()) {
+    parent.erase(ptr.back());
+  } else {
+    parent.erase(patch_index(ptr.back(), parent.size() - 1));
+  }
+  return removed;
+}
+
+/**
+ * apply a json patch (rfc 6902) to data, like json::patch_inplace but without its deprecation warnings.
+ * the operations are applied in order, the ones before a failing operation stay applied
+ * @return paths changed by the patch
+ * @throw EvaluateError when an operation is invalid or a test fails
+ */
+inline std::vector<std::string> apply_patch(json &data, const json &patch) {
+  if (!patch.is_array()) {
+    CPPEL_THROW(EvaluateError("json patch should be an array"));
+  }
+  try {
+    for (auto &operation : patch) {
+      const std::string &op = patch_member(operation, "op").get_ref<const std::string &>();
+      const std::string &path = patch_member(operation, "path").get_ref<const std::string &>();
+      if (op == "add") {
+        patch_add(data, path, patch_member(operation, "value"));
+      } else if (op == "remove") {
+        patch_remove(data, path);
+      } else if (op == "replace") {
+        const json::json_pointer ptr(path);
+        data.at(ptr) = patch_member(operation, "value");
+      } else if (op == "move") {
+        const std::string &from = patch_member(operation, "from").get_ref<const std::string &>();
+        if (path.compare(0, from.size(), from) == 0 && (path.size() == from.size() || path[from.size()] == '/')) {
+          if (path.size() != from.size()) {
+            CPPEL_THROW(EvaluateError("json patch can't move " + from + " into itself"));
+          }
+          continue;
+        }
+        patch_add(data, path, patch_remove(data, from));
+      } else if (op == "copy") {
+        const std::string &from = patch_member(operation, "from").get_ref<const std::string &>();
+        const json::json_pointer from_ptr(from);
+        patch_add(data, path, data.at(from_ptr));
+      } else if (op == "test") {
+        const json::json_pointer ptr(path);
+        if (data.at(ptr) != patch_member(operation, "value")) {
+          CPPEL_THROW(EvaluateError("json patch test failed at " + path));
+        }
+      } else {
+        CPPEL_THROW(EvaluateError("unknown json patch operation " + op));
+      }
+    }
+  } catch (const json::exception &e) {
+    CPPEL_THROW(EvaluateError(std::string("invalid json patch: ") + e.what()));
+  }
+  return patched_paths(patch);
+}
+
+/**
+ * walk a tree with the path of the active data, which is unknown for a computed value like the
+ * result of a function. a value of the input used by an operator, a function or as the result is
+ * read whole, a navigation only reads what it reaches
+ */
+class ReadPathCollector {
+ public:
+  std::vector<Path> collect(const AstNode *root) {
+    paths_.clear();
+    Path root_path;
+    use(root, &root_path);
+    return normalize(std::move(paths_));
+  }
+
+ private:
+  std::vector<Path> paths_;
+
+  void use(const AstNode *node, const Path *active) {
+    Path value;
+    if (navigate(node, active, value)) {
+      paths_.push_back(std::move(value));
+    }
+  }
+
+  /**
+   * record the paths read by node evaluated on active
+   * @param active nullptr when the active data isn't a value of the input
+   * @param value path of the value of node
+   * @return false when the value of node isn't a value of the input
+   */
+  bool navigate(const AstNode *node, const Path *active, Path &value) {
+    const std::vector<std::shared_ptr<AstNode>> &children = node->get_children();
+    switch (node->get_kind()) {
+      case NodeKind::NATIVE: {
+        return navigate(static_cast<const NativeNode *>(node)->get_interpreted().get(), active, value);
+      }
+      case NodeKind::PROPERTY: {
+        if (!active) {
+          return false;
+        }
+        value = *active;
+        value.push_back(static_cast<const PropertyNode *>(node)->get_property_name());
+        return true;
+      }
+      case NodeKind::VARIABLE: {
+        const VariableNode *variable = static_cast<const VariableNode *>(node);
+        if (variable->get_variable_name() == "root") {
+          value.clear();
+          return true;
+        } else if (!variable->is_slot() && active) {
+          value = *active;
+          return true;
+        }
+        // the value assigned to a variable is read whole by the assignment
+        return false;
+      }
+      case NodeKind::COMPOUND_EXPRESSION: {
+        bool known = active != nullptr;
+        Path current = known ? *active : Path();
+        for (auto &child : children) {
+          Path next;
+          known = navigate(child.get(), known ? &current : nullptr, next);
+          current.swap(next);
+        }
+        value.swap(current);
+        return known;
+      }
+      case NodeKind::INDEXER: {
+        std::string key = "*";
+        const AstNode *index = children[0].get();
+        if (const LiteralInt *literal = dynamic_cast<const LiteralInt *>(index)) {
+          key = std::to_string(literal->get_value().get<int>());
+        } else if (const LiteralString *literal = dynamic_cast<const LiteralString *>(index)) {
+          key = literal->get_value().get<std::string>();
+        } else {
+          use(index, active);
+        }
+        if (!active) {
+          return false;
+        }
+        value = *active;
+        value.push_back(key);
+        return true;
+      }
+      case NodeKind::METHOD: {
+        if (active) {
+          paths_.push_back(*active);
+        }
+        for (auto &child : children) {
+          use(child.get(), active);
+        }
+        return false;
+      }
+      case NodeKind::SELECTION:
+      case NodeKind::PROJECTION:
+      case NodeKind::FLAT: {
+        Path element;
+        if (active) {
+          element = *active;
+          element.push_back("*");
+        }
+        const Path *element_ptr = active ? &element : nullptr;
+        if (node->get_kind() == NodeKind::SELECTION) {
+          use(children[0].get(), element_ptr);
+          if (!active) {
+            return false;
+          }
+          // the elements kept by the selection are read whole
+          bool all = static_cast<const Selection *>(node)->get_select_type() == Selection::SelectType::ALL;
+          value = all ? *active : element;
+          return true;
+        }
+        size_t size = paths_.size();
+        bool known = navigate(children[0].get(), element_ptr, value);
+        if (!known && element_ptr && !reads_under(element, size)) {
+          // a constant projection still depends on the number of elements
+          paths_.push_back(element);
+        }
+        return known;
+      }
+      default:
+        break;
+    }
+    for (auto &child : children) {
+      use(child.get(), active);
+    }
+    return false;
+  }
+
+  bool reads_under(const Path &path, const size_t from) const {
+    for (size_t i = from; i < paths_.size(); ++i) {
+      if (paths_[i].size() >= path.size() && std::equal(path.begin(), path.end(), paths_[i].begin())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * sorted and without the paths under another one
+   */
+  static std::vector<Path> normalize(std::vector<Path> paths) {
+    std::sort(paths.begin(), paths.end());
+    std::vector<Path> normalized;
+    for (auto &path : paths) {
+      if (normalized.empty() || path.size() < normalized.back().size()
+          || !std::equal(normalized.back().begin(), normalized.back().end(), path.begin())) {
+        normalized.push_back(std::move(path));
+      }
+    }
+    return normalized;
+  }
+};
+
+} // namespace dependency
+
+/**
+ * paths of the input read by an expression, a change of the input which doesn't overlap
+ * any of them leaves the result unchanged
+ */
+inline std::vector<Path> read_paths(const Expression &expr) {
+  return dependency::ReadPathCollector().collect(expr.get_root().get());
+}
+
+/**
+ * trie of the read paths of many expressions
+ */
+class PathIndex {
+ public:
+  PathIndex() : root_(new TrieNode()) {}
+
+  void add(const Path &path, const size_t id) {
+    TrieNode *node = root_.get();
+    for (auto &segment : path) {
+      std::unique_ptr<TrieNode> &child = node->children[segment];
+      if (!child) {
+        child.reset(new TrieNode());
+      }
+      node = child.get();
+    }
+    node->ids.push_back(id);
+  }
+
+  /**
+   * append the ids of the paths overlapping changed, an id may be appended several times
+   */
+  void find(const Path &changed, std::vector<size_t> &ids) const {
+    find(root_.get(), changed, 0, ids);
+  }
+
+ private:
+  struct TrieNode {
+    std::vector<size_t> ids;
+    std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
+  };
+
+  std::unique_ptr<TrieNode> root_;
+
+  static void find(const TrieNode *node, const Path &changed, const size_t depth, std::vector<size_t> &ids) {
+    ids.insert(ids.end(), node->ids.begin(), node->ids.end());
+    if (depth == changed.size()) {
+      for (auto &child : node->children) {
+        find(child.second.get(), changed, depth, ids);
+      }
+      return;
+    }
+    auto it = node->children.find(changed[depth]);
+    if (it != node->children.end()) {
+      find(it->second.get(), changed, depth + 1, ids);
+    }
+    it = node->children.find("*");
+    if (it != node->children.end() && changed[depth] != "*") {
+      find(it->second.get(), changed, depth + 1, ids);
+    }
+  }
+};
+
+/**
+ * result of an expression which changed, previous is null for the first evaluation
+ */
+struct ResultChange {
+  size_t index;
+  EvaluateResult previous;
+  EvaluateResult current;
+};
+
+/**
+ * expressions attached to a long lived document, after a change of the document only the
+ * expressions reading a changed path are evaluated again
+ */
+class ExpressionSet {
+ public:
+  /**
+   * @return index of the expression in the set
+   */
+  size_t add(const Expression &expr) {
+    size_t index = exprs_.size();
+    exprs_.push_back(expr);
+    results_.emplace_back();
+    evaluated_.push_back(false);
+    marks_.push_back(0);
+    for (auto &path : read_paths(expr)) {
+      index_.add(path, index);
+    }
+    pending_.push_back(index);
+    return index;
+  }
+
+  size_t size() const {
+    return exprs_.size();
+  }
+
+  const Expression &get(const size_t index) const {
+    return exprs_[index];
+  }
+
+  const EvaluateResult &get_result(const size_t index) const {
+    return results_[index];
+  }
+
+  /**
+   * evaluate every expression
+   * @return the results which changed
+   */
+  std::vector<ResultChange> evaluate(EvaluationContext &context) {
+    std::vector<size_t> indexes(exprs_.size());
+    for (size_t i = 0; i < indexes.size(); ++i) {
+      indexes[i] = i;
+    }
+    pending_.clear();
+    return evaluate(context, indexes);
+  }
+
+  std::vector<ResultChange> evaluate(const json &data) {
+    EvaluationContext context(data);
+    return evaluate(context);
+  }
+
+  /**
+   * evaluate the expressions reading a changed path and the ones added since the last evaluation
+   * @param context context of the changed document
+   * @param changed_paths json pointers of the changed values
+   * @return the results which changed
+   */
+  std::vector<ResultChange> update(EvaluationContext &context, const std::vector<std::string> &changed_paths) {
+    std::vector<size_t> found;
+    found.swap(pending_);
+    for (auto &pointer : changed_paths) {
+      index_.find(dependency::parse_pointer(pointer), found);
+    }
+    ++mark_;
+    std::vector<size_t> indexes;
+    for (size_t index : found) {
+      if (marks_[index] != mark_) {
+        marks_[index] = mark_;
+        indexes.push_back(index);
+      }
+    }
+    std::sort(indexes.begin(), indexes.end());
+    return evaluate(context, indexes);
+  }
+
+  std::vector<ResultChange> update(const json &data, const std::vector<std::string> &changed_paths) {
+    EvaluationContext context(data);
+    return update(context, changed_paths);
+  }
+
+  /**
+   * apply a json patch to data, then update the results
+   * @throw EvaluateError when the patch can't be applied
+   */
+  std::vector<ResultChange> patch(json &data, const json &patch) {
+    return update(data, dependency::apply_patch(data, patch));
+  }
+
+ private:
+  std::vector<Expression> exprs_;
+  std::vector<EvaluateResult> results_;
+  std::vector<bool> evaluated_;
+  std::vector<size_t> pending_;
+  PathIndex index_;
+  // indexes found by an update are deduplicated by marking them with the number of the update
+  std::vector<uint64_t> marks_;
+  uint64_t mark_ = 0;
+
+  std::vector<ResultChange> evaluate(EvaluationContext &context, const std::vector<size_t> &indexes) {
+    std::vector<ResultChange> changes;
+    for (size_t index : indexes) {
+      EvaluateResult result = exprs_[index].try_evaluate(context);
+      EvaluateResult &previous = results_[index];
+      if (!evaluated_[index] || result.status.code != previous.status.code || result.value != previous.value) {
+        ResultChange change;
+        change.index = index;
+        change.previous = std::move(previous);
+        change.current = result;
+        changes.push_back(std::move(change));
+      }
+      previous = std::move(result);
+      evaluated_[index] = true;
+    }
+    return changes;
+  }
+};
+
+} // namespace cppel
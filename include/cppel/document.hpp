@@ -0,0 +1,90 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <string>
+#include "nlohmann/json.hpp"
+
+namespace cppel {
+
+using json = nlohmann::json;
+
+class EvaluationContext;
+
+/**
+ * access to native objects, so that expressions are evaluated without converting them to json.
+ * see adapter.hpp to register the fields of structs
+ *
+ * objects enter the evaluation as placeholders owned by the context (EvaluationContext::push_document),
+ * property, indexer, selection, projection and flat navigate them through the adapter,
+ * they are converted to json only when they are the value of a node, like the result or an operand
+ */
+class DocumentAdapter {
+ public:
+  virtual ~DocumentAdapter() {}
+
+  /**
+   * property of object, nested objects are returned as documents
+   * @return nullptr when object has no such property
+   */
+  virtual const json *get_property(EvaluationContext & /*context*/,
+                                   const void * /*object*/,
+                                   const std::string & /*name*/) const {
+    return nullptr;
+  }
+
+  virtual bool is_array(const void * /*object*/) const {
+    return false;
+  }
+
+  virtual size_t size(const void * /*object*/) const {
+    return 0;
+  }
+
+  /**
+   * adapter of the elements of an array, nullptr when they are plain values
+   */
+  virtual const DocumentAdapter *get_element_adapter() const {
+    return nullptr;
+  }
+
+  virtual const void *get_element_object(const void * /*object*/, const size_t /*index*/) const {
+    return nullptr;
+  }
+
+  /**
+   * whether an element of an array with an element adapter is a plain value nevertheless
+   */
+  virtual bool is_element_value(const void * /*object*/, const size_t /*index*/) const {
+    return false;
+  }
+
+  /**
+   * plain value of an element of an array
+   */
+  virtual const json *get_element(EvaluationContext & /*context*/,
+                                  const void * /*object*/,
+                                  const size_t /*index*/) const {
+    return nullptr;
+  }
+
+  virtual json to_json(const void *object) const = 0;
+};
+
+/**
+ * a native object in the evaluation, or a plain value of an adapted array when is_value is set
+ */
+struct Document {
+  const DocumentAdapter *adapter = nullptr;
+  const void *object = nullptr;
+  bool is_value = false;
+  size_t index = 0;
+
+  bool is_array() const {
+    return !is_value && adapter->is_array(object);
+  }
+};
+
+} // namespace cppel
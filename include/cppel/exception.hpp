@@ -34,6 +34,56 @@ struct EvaluateError : public CppelError {
       : CppelError("evaluate_error", message) {}
 };
 
+struct LoadError : public CppelError {
+  explicit LoadError(const std::string &message)
+      : CppelError("load_error", message) {}
+};
+
+enum class ErrorCode {
+  NONE,
+  UNEXPECTED_NULL,
+  OUT_OF_RANGE,
+  MISSING_KEY,
+  NOT_INDEXABLE,
+  NOT_ARRAY,
+  UNKNOWN_VARIABLE,
+  UNKNOWN_FUNCTION,
+  INVALID_PATTERN,
+  INVALID_ARGUMENT,
+  UNKNOWN_METHOD,
+  PENDING,
+  STEP_LIMIT,
+  ITERATION_LIMIT,
+  MEMORY_LIMIT,
+  DEADLINE,
+  EXCEPTION,
+};
+
+/**
+ * failure of a non-throwing evaluation, message is a static string so that
+ * reporting an error doesn't allocate
+ */
+struct EvaluateStatus {
+  ErrorCode code = ErrorCode::NONE;
+  const char *message = "";
+  size_t pos = 0;
+  std::string detail;
+
+  bool ok() const {
+    return code == ErrorCode::NONE;
+  }
+
+  std::string to_string() const {
+    if (ok()) {
+      return "ok";
+    }
+    if (code == ErrorCode::EXCEPTION) {
+      return detail;
+    }
+    return std::string(message) + std::to_string(pos);
+  }
+};
+
 #define CPPEL_THROW(exception) throw exception
 
 }  // namespace cppel
\ No newline at end of file
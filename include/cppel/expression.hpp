@@ -4,34 +4,364 @@
 
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <sstream>
+#include <iomanip>
+#include <utility>
+#include <vector>
 #include "nlohmann/json.hpp"
 #include "ast.hpp"
 #include "context.hpp"
+#include "profiler.hpp"
 
 namespace cppel {
 
 using json = nlohmann::json;
 
+struct EvaluateResult {
+  json value;
+  EvaluateStatus status;
+
+  bool ok() const {
+    return status.ok();
+  }
+};
+
+/**
+ * start and end positions of the tokens of an expression
+ */
+using TokenSpans = std::vector<std::pair<size_t, size_t>>;
+
+/**
+ * maps the positions of a plan shared by expressions with the same tokens, parsed from one of them,
+ * to the positions of another one whose literals or spaces have other widths
+ */
+class PositionMap {
+ public:
+  PositionMap(const std::shared_ptr<const TokenSpans> &from, TokenSpans to) : from_(from), to_(std::move(to)) {}
+
+  /**
+   * @param pos start position of a node of the plan
+   */
+  size_t map_start(const size_t pos) const {
+    auto it = std::upper_bound(from_->begin(), from_->end(), pos,
+                               [](const size_t lh, const std::pair<size_t, size_t> &rh) { return lh < rh.first; });
+    if (it == from_->begin()) {
+      return pos;
+    }
+    size_t index = it - from_->begin() - 1;
+    const std::pair<size_t, size_t> &from = (*from_)[index];
+    const std::pair<size_t, size_t> &to = to_[index];
+    if (pos < from.second) {
+      return std::min(to.first + (pos - from.first), to.second);
+    }
+    size_t mapped = to.second + (pos - from.second);
+    return index + 1 < to_.size() ? std::min(mapped, to_[index + 1].first) : mapped;
+  }
+
+  /**
+   * @param pos end position of a node of the plan
+   */
+  size_t map_end(const size_t pos) const {
+    auto it = std::lower_bound(from_->begin(), from_->end(), pos,
+                               [](const std::pair<size_t, size_t> &lh, const size_t rh) { return lh.second < rh; });
+    if (it == from_->end()) {
+      return from_->empty() ? pos : to_.back().second + (pos - from_->back().second);
+    }
+    size_t index = it - from_->begin();
+    const std::pair<size_t, size_t> &from = (*from_)[index];
+    const std::pair<size_t, size_t> &to = to_[index];
+    if (pos > from.first) {
+      return to.second - std::min(from.second - pos, to.second - to.first);
+    }
+    size_t gap = std::min(from.first - pos, to.first);
+    return index > 0 ? std::max(to.first - gap, to_[index - 1].second) : to.first - gap;
+  }
+
+ private:
+  std::shared_ptr<const TokenSpans> from_;
+  TokenSpans to_;
+};
+
 class Expression {
  public:
-  Expression(const std::shared_ptr<AstNode> root) : root_(root) {}
+  Expression(const std::shared_ptr<AstNode> root)
+      : root_(root), variables_(bind_variables(root)), parameters_(bind_parameters(root)) {
+    unbind();
+  }
+
+  Expression(const std::shared_ptr<AstNode> root, const std::string &expr_str)
+      : root_(root), expr_str_(expr_str), variables_(bind_variables(root)), parameters_(bind_parameters(root)) {
+    unbind();
+  }
+
+  /**
+   * @param variables slots already bound by bind_variables, root may wrap the bound tree
+   * @param parameters slots already bound by bind_parameters
+   * @param values values of the parameters by slot, empty when none is bound yet
+   * @param positions positions of the nodes of root in expr_str, nullptr when they're the positions of the nodes
+   */
+  Expression(const std::shared_ptr<AstNode> root,
+             const std::string &expr_str,
+             const std::shared_ptr<const Variables> &variables,
+             const std::shared_ptr<const Parameters> &parameters = nullptr,
+             std::vector<json> values = std::vector<json>(),
+             const std::shared_ptr<const PositionMap> &positions = nullptr)
+      : root_(root), expr_str_(expr_str), variables_(variables), parameters_(parameters), positions_(positions) {
+    if (values.empty()) {
+      unbind();
+    } else {
+      values_ = std::make_shared<std::vector<json>>(std::move(values));
+    }
+  }
+
+  /**
+   * bind the value of the positional parameter ?position, copies of the expression keep their values
+   * @throw EvaluateError when the expression has no such parameter
+   */
+  Expression &bind(const size_t position, json value) {
+    return bind_slot(find_parameter("?" + std::to_string(position)), std::move(value));
+  }
+
+  /**
+   * bind the value of the named parameter :name
+   * @throw EvaluateError when the expression has no such parameter
+   */
+  Expression &bind(const std::string &name, json value) {
+    return bind_slot(find_parameter(":" + name), std::move(value));
+  }
 
   json evaluate(const json &data) {
     EvaluationContext context = EvaluationContext(data);
-    json rlt = *root_->evaluate(context);
-    context.clear_ref();
-    return rlt;
+    return evaluate(context);
   }
 
+  /**
+   * temporaries like the result of a projection are moved out of the context instead of copied
+   * @param context
+   * @return
+   */
   json evaluate(EvaluationContext &context) {
-    json rlt = *root_->evaluate(context);
+    context.enter_frame(variables_, values_.get());
+    context.start_budget();
+    json rlt = context.take_ref(checked(evaluate_root(context), context));
     context.clear_ref();
     return rlt;
   }
 
+  /**
+   * evaluate without copying the result, the returned reference points either into the input data,
+   * into the expression literals or to a temporary of the context (see EvaluationContext::is_ref),
+   * it's valid until the next evaluation on the context or context.clear_ref()
+   * @param context
+   * @return
+   */
+  const json &evaluate_ref(EvaluationContext &context) {
+    context.clear_ref();
+    context.enter_frame(variables_, values_.get());
+    context.start_budget();
+    return *checked(evaluate_root(context), context);
+  }
+
+  /**
+   * evaluate without throwing, errors like null navigation or index out of range are
+   * reported through the status with the position of the failing node
+   * @param context
+   * @return
+   */
+  EvaluateResult try_evaluate(EvaluationContext &context) {
+    EvaluateResult result;
+    bool throw_error = context.is_throw_error();
+    context.set_throw_error(false);
+    context.get_status() = EvaluateStatus();
+    try {
+      context.enter_frame(variables_, values_.get());
+      context.start_budget();
+      const json *rlt = root_->evaluate(context);
+      if (rlt) {
+        result.value = context.take_ref(rlt);
+      } else {
+        result.status = context.get_status();
+        result.status.pos = position_of(result.status.pos);
+      }
+    } catch (const std::exception &e) {
+      // raised by json conversions or user functions, not by the evaluator itself
+      result.status.code = ErrorCode::EXCEPTION;
+      result.status.detail = e.what();
+    }
+    context.set_throw_error(throw_error);
+    context.reset();
+    return result;
+  }
+
+  EvaluateResult try_evaluate(const json &data) {
+    EvaluationContext context = EvaluationContext(data);
+    return try_evaluate(context);
+  }
+
+  /**
+   * evaluate with every node instrumented, stats are accumulated into profiler
+   * @param context
+   * @param profiler
+   * @return
+   */
+  json profile(EvaluationContext &context, Profiler &profiler) {
+    Profiler *previous = context.get_profiler();
+    context.set_profiler(&profiler);
+    try {
+      AllocationScope allocation_scope;
+      json rlt = evaluate(context);
+      profiler.on_evaluation(allocation_scope.get());
+      context.set_profiler(previous);
+      return rlt;
+    } catch (...) {
+      context.set_profiler(previous);
+      context.clear_ref();
+      throw;
+    }
+  }
+
+  /**
+   * annotated tree of the expression, like:
+   *    OpGT [2, 3) '>' calls=1 time=0.001ms refs=0 iterated=0 allocs=0 bytes=0
+   *      PropertyNode [0, 1) 'a' calls=1 time=0.000ms refs=0 iterated=0 allocs=0 bytes=0
+   * @param profiler
+   * @return
+   */
+  std::string explain(const Profiler &profiler) const {
+    std::stringstream ss;
+    explain_node(ss, root_.get(), profiler, 0);
+    return ss.str();
+  }
+
+  const std::shared_ptr<AstNode> &get_root() const {
+    return root_;
+  }
+
+  const std::string &get_expr_str() const {
+    return expr_str_;
+  }
+
+  /**
+   * names of the variables by slot, nullptr when the expression has none
+   */
+  const std::shared_ptr<const Variables> &get_variables() const {
+    return variables_;
+  }
+
+  /**
+   * names of the parameters by slot like ?1 or :name, nullptr when the expression has none
+   */
+  const std::shared_ptr<const Parameters> &get_parameters() const {
+    return parameters_;
+  }
+
+  /**
+   * the expression shares the plan of another one parsed with the cache of the Parser,
+   * its literals are parameters named $0, $1 ...
+   */
+  bool is_literal_parameterized() const {
+    if (parameters_) {
+      for (auto &name : *parameters_) {
+        if (name[0] == '$') {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
  private:
   std::shared_ptr<AstNode> root_;
+  std::string expr_str_;
+  std::shared_ptr<const Variables> variables_;
+  std::shared_ptr<const Parameters> parameters_;
+  // shared by the copies of the expression until one of them binds a value
+  std::shared_ptr<std::vector<json>> values_;
+  std::shared_ptr<const PositionMap> positions_;
+
+  void unbind() {
+    if (parameters_) {
+      values_ = std::make_shared<std::vector<json>>(parameters_->size(), json(json::value_t::discarded));
+    }
+  }
+
+  size_t find_parameter(const std::string &name) const {
+    if (parameters_) {
+      auto it = std::find(parameters_->begin(), parameters_->end(), name);
+      if (it != parameters_->end()) {
+        return it - parameters_->begin();
+      }
+    }
+    CPPEL_THROW(EvaluateError("unknown parameter " + name));
+  }
+
+  Expression &bind_slot(const size_t slot, json value) {
+    if (values_.use_count() != 1) {
+      values_ = std::make_shared<std::vector<json>>(*values_);
+    }
+    (*values_)[slot] = std::move(value);
+    return *this;
+  }
+
+  size_t position_of(const size_t pos) const {
+    return positions_ ? positions_->map_start(pos) : pos;
+  }
+
+  /**
+   * the nodes of a plan shared with another expression fail at the positions of the other expression,
+   * they're evaluated without throwing so that checked reports the error at the position in this one
+   */
+  const json *evaluate_root(EvaluationContext &context) {
+    if (!positions_ || !context.is_throw_error()) {
+      return root_->evaluate(context);
+    }
+    context.set_throw_error(false);
+    context.get_status() = EvaluateStatus();
+    const json *rlt;
+    try {
+      rlt = root_->evaluate(context);
+    } catch (...) {
+      context.set_throw_error(true);
+      throw;
+    }
+    context.set_throw_error(true);
+    return rlt;
+  }
+
+  /**
+   * a non-throwing context reports errors with nullptr, which can't be returned by reference
+   */
+  const json *checked(const json *rlt, EvaluationContext &context) {
+    if (!rlt) {
+      context.clear_ref();
+      EvaluateStatus status = context.get_status();
+      status.pos = position_of(status.pos);
+      CPPEL_THROW(EvaluateError(status.to_string()));
+    }
+    return rlt;
+  }
+
+  void explain_node(std::stringstream &ss, const AstNode *node, const Profiler &profiler, const int depth) const {
+    const NodeStats &stats = profiler.get_stats(node);
+    size_t start_pos = position_of(node->get_start_pos());
+    size_t end_pos = positions_ ? positions_->map_end(node->get_end_pos()) : node->get_end_pos();
+    ss << std::string(depth * 2, ' ') << node->get_name()
+       << " [" << start_pos << ", " << end_pos << ")";
+    if (end_pos <= expr_str_.size() && start_pos < end_pos) {
+      ss << " '" << expr_str_.substr(start_pos, end_pos - start_pos) << "'";
+    }
+    ss << " calls=" << stats.calls
+       << " time=" << std::fixed << std::setprecision(3) << stats.total_time.count() / 1e6 << "ms"
+       << " refs=" << stats.refs
+       << " iterated=" << stats.iterated
+       << " allocs=" << stats.allocations.count
+       << " bytes=" << stats.allocations.bytes << "\n";
+    for (auto &child : node->get_children()) {
+      explain_node(ss, child.get(), profiler, depth + 1);
+    }
+  }
 };
 
-}  // namespace cppel
\ No newline at end of file
+}  // namespace cppel
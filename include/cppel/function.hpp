@@ -4,50 +4,392 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
-#include <sstream>
 #include "nlohmann/json.hpp"
+#include "exception.hpp"
 
 namespace cppel {
 
 using json = nlohmann::json;
 
+namespace aggregate {
+
+enum class Kind {
+  SUM,
+  AVG,
+  MIN,
+  MAX,
+  COUNT,
+};
+
+/**
+ * reductions with independent accumulators, which compilers turn into simd code.
+ * Acc is unsigned for integers so that overflow wraps instead of being undefined
+ */
+template<typename T, typename Acc>
+T sum(const T *values, const size_t size) {
+  Acc acc[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    acc[0] += static_cast<Acc>(values[i]);
+    acc[1] += static_cast<Acc>(values[i + 1]);
+    acc[2] += static_cast<Acc>(values[i + 2]);
+    acc[3] += static_cast<Acc>(values[i + 3]);
+  }
+  for (; i < size; ++i) {
+    acc[0] += static_cast<Acc>(values[i]);
+  }
+  return static_cast<T>((acc[0] + acc[1]) + (acc[2] + acc[3]));
+}
+
+template<typename T, typename Compare>
+T extreme(const T *values, const size_t size, const Compare better) {
+  T acc[4] = {values[0], values[0], values[0], values[0]};
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    acc[0] = better(values[i], acc[0]) ? values[i] : acc[0];
+    acc[1] = better(values[i + 1], acc[1]) ? values[i + 1] : acc[1];
+    acc[2] = better(values[i + 2], acc[2]) ? values[i + 2] : acc[2];
+    acc[3] = better(values[i + 3], acc[3]) ? values[i + 3] : acc[3];
+  }
+  for (; i < size; ++i) {
+    acc[0] = better(values[i], acc[0]) ? values[i] : acc[0];
+  }
+  for (int k = 1; k < 4; ++k) {
+    acc[0] = better(acc[k], acc[0]) ? acc[k] : acc[0];
+  }
+  return acc[0];
+}
+
+struct Less {
+  template<typename T>
+  bool operator()(const T lh, const T rh) const {
+    return lh < rh;
+  }
+};
+
+struct Greater {
+  template<typename T>
+  bool operator()(const T lh, const T rh) const {
+    return lh > rh;
+  }
+};
+
+/**
+ * aggregate of numbers, nulls are skipped and other values are errors except for COUNT.
+ * integers and floats are reduced separately, SUM and AVG of integers stay integers and
+ * MIN, MAX keep the type of the extreme unless integers and floats are mixed.
+ * adding returns false on an error, which get_error() describes
+ */
+class Accumulator {
+ public:
+  explicit Accumulator(const Kind kind) : kind_(kind) {}
+
+  /**
+   * aggregate the elements of an array, they are copied to contiguous buffers first so that
+   * the reduction doesn't jump between json values
+   */
+  bool add_all(const json &values) {
+    if (!values.is_array()) {
+      static const char *messages[] = {"#sum should do with array at ", "#avg should do with array at ",
+                                       "#min should do with array at ", "#max should do with array at ",
+                                       "#count should do with array at "};
+      error_ = messages[static_cast<int>(kind_)];
+      return false;
+    }
+    const json::array_t &array = values.get_ref<const json::array_t &>();
+    if (kind_ == Kind::COUNT) {
+      for (auto &value : array) {
+        count_ += value.is_null() ? 0 : 1;
+      }
+      return true;
+    }
+    thread_local std::vector<int64_t> ints;
+    thread_local std::vector<double> floats;
+    ints.clear();
+    floats.clear();
+    for (auto &value : array) {
+      switch (value.type()) {
+        case json::value_t::number_integer:ints.push_back(*value.get_ptr<const json::number_integer_t *>());
+          break;
+        case json::value_t::number_unsigned: {
+          uint64_t number = *value.get_ptr<const json::number_unsigned_t *>();
+          if (number <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+            ints.push_back(static_cast<int64_t>(number));
+          } else {
+            floats.push_back(static_cast<double>(number));
+          }
+          break;
+        }
+        case json::value_t::number_float:floats.push_back(*value.get_ptr<const json::number_float_t *>());
+          break;
+        case json::value_t::null:break;
+        default:return not_number();
+      }
+    }
+    if (!ints.empty()) {
+      add_ints(reduce(ints.data(), ints.size(), static_cast<uint64_t>(0)), ints.size());
+    }
+    if (!floats.empty()) {
+      add_floats(reduce(floats.data(), floats.size(), 0.0), floats.size());
+    }
+    return true;
+  }
+
+  bool add(const json &value) {
+    switch (value.type()) {
+      case json::value_t::number_integer:
+      case json::value_t::number_unsigned:
+        if (value.is_number_unsigned()
+            && value.get<uint64_t>() > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+          add_floats(value.get<double>(), 1);
+        } else {
+          add_ints(value.get<int64_t>(), 1);
+        }
+        break;
+      case json::value_t::number_float:add_floats(value.get<double>(), 1);
+        break;
+      case json::value_t::null:break;
+      default:
+        if (kind_ != Kind::COUNT) {
+          return not_number();
+        }
+        ++count_;
+    }
+    return true;
+  }
+
+  /**
+   * message of the last failed add, followed by the position of the call
+   */
+  const char *get_error() const {
+    return error_;
+  }
+
+  json result() const {
+    switch (kind_) {
+      case Kind::COUNT:return json(static_cast<int64_t>(count_));
+      case Kind::SUM:return has_float_ ? json(static_cast<double>(int_value_) + float_value_) : json(int_value_);
+      case Kind::AVG:
+        return count_ ? json((static_cast<double>(int_value_) + float_value_) / static_cast<double>(count_)) : json();
+      default:
+        if (!has_float_) {
+          return has_int_ ? json(int_value_) : json();
+        } else if (!has_int_) {
+          return json(float_value_);
+        }
+        double int_value = static_cast<double>(int_value_);
+        bool int_better = kind_ == Kind::MIN ? int_value < float_value_ : int_value > float_value_;
+        return json(int_better ? int_value : float_value_);
+    }
+  }
+
+ private:
+  Kind kind_;
+  size_t count_ = 0;
+  bool has_int_ = false;
+  bool has_float_ = false;
+  int64_t int_value_ = 0;
+  double float_value_ = 0;
+  const char *error_ = "";
+
+  bool not_number() {
+    static const char *messages[] = {"#sum should do with numbers at ", "#avg should do with numbers at ",
+                                     "#min should do with numbers at ", "#max should do with numbers at ",
+                                     "#count should do with numbers at "};
+    error_ = messages[static_cast<int>(kind_)];
+    return false;
+  }
+
+  template<typename T, typename Acc>
+  T reduce(const T *values, const size_t size, const Acc) const {
+    if (kind_ == Kind::MIN) {
+      return extreme(values, size, Less());
+    } else if (kind_ == Kind::MAX) {
+      return extreme(values, size, Greater());
+    }
+    return sum<T, Acc>(values, size);
+  }
+
+  /**
+   * merge the reduction of size integers
+   */
+  void add_ints(const int64_t value, const size_t size) {
+    count_ += size;
+    if (kind_ == Kind::SUM || kind_ == Kind::AVG) {
+      int_value_ = static_cast<int64_t>(static_cast<uint64_t>(int_value_) + static_cast<uint64_t>(value));
+    } else if (kind_ == Kind::MIN || kind_ == Kind::MAX) {
+      if (!has_int_ || (kind_ == Kind::MIN ? value < int_value_ : value > int_value_)) {
+        int_value_ = value;
+      }
+    }
+    has_int_ = true;
+  }
+
+  void add_floats(const double value, const size_t size) {
+    count_ += size;
+    if (kind_ == Kind::SUM || kind_ == Kind::AVG) {
+      float_value_ += value;
+    } else if (kind_ == Kind::MIN || kind_ == Kind::MAX) {
+      if (!has_float_ || (kind_ == Kind::MIN ? value < float_value_ : value > float_value_)) {
+        float_value_ = value;
+      }
+    }
+    has_float_ = true;
+  }
+};
+
+inline std::shared_ptr<json> aggregate(const Kind kind, const std::vector<const json *> &args) {
+  Accumulator accumulator(kind);
+  if (!accumulator.add_all(*args[0])) {
+    CPPEL_THROW(EvaluateError(std::string(accumulator.get_error()) + "argument 1"));
+  }
+  return std::make_shared<json>(accumulator.result());
+}
+
+} // namespace aggregate
+
 class PresetFunction {
  public:
   static std::shared_ptr<json> join(std::vector<const json *> &args) {
-    auto list = args[0];
-    std::string joiner = args[1]->get<std::string>();
-    std::stringstream ss;
+    const json *list = args[0];
+    const std::string &joiner = string_ref(*args[1]);
+    // the length of the result is known before writing it, so that it's allocated once
+    size_t length = 0;
+    size_t count = 0;
+    for (auto it = list->begin(); it != list->end(); ++it) {
+      length += string_ref(*it).size();
+      ++count;
+    }
+    if (count > 1) {
+      length += joiner.size() * (count - 1);
+    }
+    auto result = std::make_shared<json>(std::string());
+    std::string &str = result->get_ref<std::string &>();
+    str.reserve(length);
     for (auto it = list->begin(); it != list->end(); ++it) {
-      std::string str = it->get<std::string>();
       if (it != list->begin()) {
-        ss << joiner;
+        str.append(joiner);
       }
-      ss << str;
+      str.append(it->get_ref<const std::string &>());
     }
-    return std::make_shared<json>(ss.str());
+    return result;
   }
 
+  /**
+   * an empty splitter splits the source into its characters
+   */
   static std::shared_ptr<json> split(std::vector<const json *> &args) {
-    std::string source_str = args[0]->get<std::string>();
-    std::string splitter = args[1]->get<std::string>();
-    auto result = std::make_shared<json>();
-    int src_l = 0, src_r = 0;
-    while (src_r < source_str.size()) {
-      int spl_i = 0;
-      while (src_r + spl_i < source_str.size() && spl_i < splitter.size() && source_str[src_r] == splitter[spl_i])
-        ++spl_i;
-      if (spl_i == splitter.size()) {
-        result->push_back(source_str.substr(src_l, src_r - src_l));
-        src_r += spl_i;
-        src_l = src_r;
-      } else {
-        ++src_r;
-      }
-    }
-    result->push_back(source_str.substr(src_l, src_r - src_l));
+    const std::string &source_str = string_ref(*args[0]);
+    const std::string &splitter = string_ref(*args[1]);
+    const char *begin = source_str.data();
+    const char *end = begin + source_str.size();
+
+    auto result = std::make_shared<json>(json::array());
+    json::array_t &items = result->get_ref<json::array_t &>();
+    if (splitter.empty()) {
+      items.reserve(source_str.size());
+      for (const char *it = begin; it != end; ++it) {
+        items.emplace_back(std::string(it, 1));
+      }
+      return result;
+    }
+
+    // count the items first, so that the array is allocated once
+    size_t count = 1;
+    for (const char *it = find(begin, end, splitter); it != end; it = find(it + splitter.size(), end, splitter)) {
+      ++count;
+    }
+    items.reserve(count);
+    const char *item = begin;
+    for (const char *it = find(begin, end, splitter); it != end; it = find(item, end, splitter)) {
+      items.emplace_back(std::string(item, it));
+      item = it + splitter.size();
+    }
+    items.emplace_back(std::string(item, end));
     return result;
   }
+
+  static std::shared_ptr<json> sum(std::vector<const json *> &args) {
+    return aggregate::aggregate(aggregate::Kind::SUM, args);
+  }
+
+  static std::shared_ptr<json> avg(std::vector<const json *> &args) {
+    return aggregate::aggregate(aggregate::Kind::AVG, args);
+  }
+
+  static std::shared_ptr<json> min(std::vector<const json *> &args) {
+    return aggregate::aggregate(aggregate::Kind::MIN, args);
+  }
+
+  static std::shared_ptr<json> max(std::vector<const json *> &args) {
+    return aggregate::aggregate(aggregate::Kind::MAX, args);
+  }
+
+  static std::shared_ptr<json> count(std::vector<const json *> &args) {
+    return aggregate::aggregate(aggregate::Kind::COUNT, args);
+  }
+
+  using Preset = std::shared_ptr<json> (*)(std::vector<const json *> &args);
+
+  /**
+   * preset function of an aggregate, which FunctionNode may evaluate on a projection
+   * without building the projected array
+   * @param name
+   * @param kind
+   * @return nullptr when name isn't an aggregate
+   */
+  static Preset find_aggregate(const std::string &name, aggregate::Kind &kind) {
+    static const std::pair<const char *, aggregate::Kind> kinds[] = {
+        {"sum", aggregate::Kind::SUM}, {"avg", aggregate::Kind::AVG}, {"min", aggregate::Kind::MIN},
+        {"max", aggregate::Kind::MAX}, {"count", aggregate::Kind::COUNT},
+    };
+    static const Preset presets[] = {sum, avg, min, max, count};
+    for (size_t i = 0; i < 5; ++i) {
+      if (name == kinds[i].first) {
+        kind = kinds[i].second;
+        return presets[i];
+      }
+    }
+    return nullptr;
+  }
+
+ private:
+  /**
+   * string value of data, other types throw the same error as get<std::string>()
+   */
+  static const std::string &string_ref(const json &data) {
+    if (!data.is_string()) {
+      data.get<std::string>();
+    }
+    return data.get_ref<const std::string &>();
+  }
+
+  /**
+   * first occurrence of splitter in [begin, end), end when there is none. the first character
+   * is searched with memchr, which is vectorized by the c library
+   */
+  static const char *find(const char *begin, const char *end, const std::string &splitter) {
+    const char first = splitter[0];
+    while (end - begin >= static_cast<std::ptrdiff_t>(splitter.size())) {
+      const void *found = std::memchr(begin, first, end - begin - splitter.size() + 1);
+      if (!found) {
+        return end;
+      }
+      const char *it = static_cast<const char *>(found);
+      if (std::memcmp(it + 1, splitter.data() + 1, splitter.size() - 1) == 0) {
+        return it;
+      }
+      begin = it + 1;
+    }
+    return end;
+  }
 };
 
 } // namespace cppel
\ No newline at end of file
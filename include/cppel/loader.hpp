@@ -0,0 +1,134 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "exception.hpp"
+
+namespace cppel {
+
+using json = nlohmann::json;
+
+/**
+ * function resolving many calls with one request, like a lookup in a remote cache.
+ * a key is the array of the arguments of a call, the future gives one value per key.
+ * keys stay valid until the future is ready
+ */
+using BatchFunction = std::function<std::future<std::vector<json>>(const std::vector<json> &keys)>;
+
+/**
+ * values of the batch functions, loaded a batch of keys at a time
+ *
+ * a call whose value isn't loaded yet records its key and fails the evaluation with ErrorCode::PENDING,
+ * which is replayed once the pending keys are dispatched, see AsyncBatch. loaded values are kept until clear()
+ */
+class BatchLoader {
+ public:
+  void add_function(const std::pair<std::string, int> &name_args_count, const BatchFunction &function) {
+    functions_[name_args_count].function = function;
+  }
+
+  bool has_function(const std::pair<std::string, int> &name_args_count) const {
+    return functions_.find(name_args_count) != functions_.end();
+  }
+
+  /**
+   * @return loaded value of the call, nullptr when it's pending
+   */
+  const json *load(const std::pair<std::string, int> &name_args_count, const std::vector<const json *> &args) {
+    auto function = functions_.find(name_args_count);
+    if (function == functions_.end()) {
+      return nullptr;
+    }
+    Entry &entry = function->second;
+    json key = json::array();
+    for (const json *arg : args) {
+      key.push_back(*arg);
+    }
+    std::string key_str = key.dump();
+    auto it = entry.values.find(key_str);
+    if (it != entry.values.end()) {
+      return &it->second;
+    }
+    ++misses_;
+    if (entry.pending_index.emplace(key_str, entry.pending.size()).second) {
+      entry.pending.push_back(std::move(key));
+    }
+    return nullptr;
+  }
+
+  /**
+   * number of the calls found pending, grows when an evaluation has to be replayed
+   */
+  uint64_t get_misses() const {
+    return misses_;
+  }
+
+  size_t pending() const {
+    size_t count = 0;
+    for (auto &function : functions_) {
+      count += function.second.pending.size();
+    }
+    return count;
+  }
+
+  /**
+   * send the pending keys of every function as one request, the requests of the functions run
+   * concurrently when their futures are asynchronous
+   * @throw EvaluateError when a function doesn't give one value per key, or the exception of a failed request
+   */
+  void dispatch() {
+    std::vector<std::pair<Entry *, std::future<std::vector<json>>>> requests;
+    for (auto &function : functions_) {
+      Entry &entry = function.second;
+      if (!entry.pending.empty()) {
+        requests.emplace_back(&entry, entry.function(entry.pending));
+      }
+    }
+    for (auto &request : requests) {
+      Entry &entry = *request.first;
+      std::vector<json> values = request.second.get();
+      if (values.size() != entry.pending.size()) {
+        CPPEL_THROW(EvaluateError("batch function should give one value per key"));
+      }
+      for (size_t i = 0; i < values.size(); ++i) {
+        entry.values[entry.pending[i].dump()] = std::move(values[i]);
+      }
+      entry.pending.clear();
+      entry.pending_index.clear();
+    }
+  }
+
+  /**
+   * drop the loaded values, so that the next calls are loaded again
+   */
+  void clear() {
+    for (auto &function : functions_) {
+      function.second.values.clear();
+    }
+  }
+
+ private:
+  struct Entry {
+    BatchFunction function;
+    // node based, pointers to the values stay valid when others are loaded
+    std::unordered_map<std::string, json> values;
+    std::vector<json> pending;
+    std::unordered_map<std::string, size_t> pending_index;
+  };
+
+  std::map<std::pair<std::string, int>, Entry> functions_;
+  uint64_t misses_ = 0;
+};
+
+} // namespace cppel
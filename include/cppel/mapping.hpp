@@ -0,0 +1,85 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CPPEL_HAS_MMAP 1
+#endif
+#include "exception.hpp"
+
+namespace cppel {
+
+/**
+ * read only mapping of a file, shared between the processes mapping it.
+ * the data is 8 bytes aligned, it's read into memory where mmap isn't available
+ */
+class FileMapping {
+ public:
+  explicit FileMapping(const std::string &path) {
+#ifdef CPPEL_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      CPPEL_THROW(LoadError("can't open " + path));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      CPPEL_THROW(LoadError("can't stat " + path));
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    void *addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      CPPEL_THROW(LoadError("can't mmap " + path));
+    }
+    data_ = static_cast<const char *>(addr);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      CPPEL_THROW(LoadError("can't open " + path));
+    }
+    in.seekg(0, std::ios::end);
+    size_ = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    buffer_.resize(size_ / 8 + 1);
+    in.read(reinterpret_cast<char *>(buffer_.data()), size_);
+    data_ = reinterpret_cast<const char *>(buffer_.data());
+#endif
+  }
+
+  ~FileMapping() {
+#ifdef CPPEL_HAS_MMAP
+    munmap(const_cast<char *>(data_), size_);
+#endif
+  }
+
+  FileMapping(const FileMapping &) = delete;
+  FileMapping &operator=(const FileMapping &) = delete;
+
+  const char *data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+#ifndef CPPEL_HAS_MMAP
+  std::vector<uint64_t> buffer_;
+#endif
+};
+
+} // namespace cppel
@@ -0,0 +1,274 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include "nlohmann/json.hpp"
+#include "context.hpp"
+#include "exception.hpp"
+
+namespace cppel {
+
+using json = nlohmann::json;
+
+/**
+ * implementation of a method for a type of receiver, receiver is resolved and args holds
+ * as many evaluated arguments as the method takes
+ */
+using MethodImpl = const json *(*)(EvaluationContext &context,
+                                   const json *receiver,
+                                   const json *const *args,
+                                   size_t pos);
+
+/**
+ * implementations of a method name and number of arguments, indexed by the type of the receiver
+ */
+struct Method {
+  static const size_t TYPE_COUNT = static_cast<size_t>(json::value_t::discarded) + 1;
+  static const size_t MAX_ARGS = 2;
+
+  MethodImpl impls[TYPE_COUNT] = {};
+
+  MethodImpl get(const json *receiver) const {
+    return impls[static_cast<size_t>(receiver->type())];
+  }
+};
+
+namespace method {
+
+inline const json *boolean(const bool value) {
+  static const json value_true(true);
+  static const json value_false(false);
+  return value ? &value_true : &value_false;
+}
+
+inline const json *invalid_argument(EvaluationContext &context, const size_t pos) {
+  return context.fail(ErrorCode::INVALID_ARGUMENT, "unexpected method argument at ", pos);
+}
+
+inline const json *size(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                        const size_t /*pos*/) {
+  return context.push_value(json(receiver->size()));
+}
+
+inline const json *is_empty(EvaluationContext & /*context*/, const json *receiver, const json *const * /*args*/,
+                            const size_t /*pos*/) {
+  return boolean(receiver->empty());
+}
+
+inline const json *string_size(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                               const size_t /*pos*/) {
+  return context.push_value(json(receiver->get_ref<const std::string &>().size()));
+}
+
+inline const json *string_is_empty(EvaluationContext & /*context*/, const json *receiver, const json *const * /*args*/,
+                                   const size_t /*pos*/) {
+  return boolean(receiver->get_ref<const std::string &>().empty());
+}
+
+inline const json *string_contains(EvaluationContext &context, const json *receiver, const json *const *args,
+                                   const size_t pos) {
+  if (!args[0]->is_string()) {
+    return invalid_argument(context, pos);
+  }
+  return boolean(receiver->get_ref<const std::string &>().find(args[0]->get_ref<const std::string &>())
+                     != std::string::npos);
+}
+
+inline const json *starts_with(EvaluationContext &context, const json *receiver, const json *const *args,
+                               const size_t pos) {
+  if (!args[0]->is_string()) {
+    return invalid_argument(context, pos);
+  }
+  const std::string &str = receiver->get_ref<const std::string &>();
+  const std::string &prefix = args[0]->get_ref<const std::string &>();
+  return boolean(str.size() >= prefix.size() && str.compare(0, prefix.size(), prefix) == 0);
+}
+
+inline const json *ends_with(EvaluationContext &context, const json *receiver, const json *const *args,
+                             const size_t pos) {
+  if (!args[0]->is_string()) {
+    return invalid_argument(context, pos);
+  }
+  const std::string &str = receiver->get_ref<const std::string &>();
+  const std::string &suffix = args[0]->get_ref<const std::string &>();
+  return boolean(str.size() >= suffix.size()
+                     && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+inline const json *string_index_of(EvaluationContext &context, const json *receiver, const json *const *args,
+                                   const size_t pos) {
+  if (!args[0]->is_string()) {
+    return invalid_argument(context, pos);
+  }
+  size_t index = receiver->get_ref<const std::string &>().find(args[0]->get_ref<const std::string &>());
+  return context.push_value(json(index == std::string::npos ? -1 : static_cast<int64_t>(index)));
+}
+
+inline const json *to_upper_case(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                                 const size_t /*pos*/) {
+  std::string str = receiver->get<std::string>();
+  std::transform(str.begin(), str.end(), str.begin(), [](unsigned char ch) {
+    return static_cast<char>(std::toupper(ch));
+  });
+  return context.push_value(json(std::move(str)));
+}
+
+inline const json *to_lower_case(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                                 const size_t /*pos*/) {
+  std::string str = receiver->get<std::string>();
+  std::transform(str.begin(), str.end(), str.begin(), [](unsigned char ch) {
+    return static_cast<char>(std::tolower(ch));
+  });
+  return context.push_value(json(std::move(str)));
+}
+
+inline const json *trim(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                        const size_t /*pos*/) {
+  const std::string &str = receiver->get_ref<const std::string &>();
+  size_t begin = str.find_first_not_of(" \t\n\r\f\v");
+  if (begin == std::string::npos) {
+    return context.push_value(json(""));
+  }
+  size_t end = str.find_last_not_of(" \t\n\r\f\v");
+  return context.push_value(json(str.substr(begin, end - begin + 1)));
+}
+
+/**
+ * substring(begin[, end]) like java, the end is excluded
+ */
+inline const json *substring(EvaluationContext &context, const json *receiver, const json *const *args,
+                             const size_t pos) {
+  const std::string &str = receiver->get_ref<const std::string &>();
+  if (!args[0]->is_number_integer() || (args[1] && !args[1]->is_number_integer())) {
+    return invalid_argument(context, pos);
+  }
+  int64_t begin = args[0]->get<int64_t>();
+  int64_t end = args[1] ? args[1]->get<int64_t>() : static_cast<int64_t>(str.size());
+  if (begin < 0 || end < begin || end > static_cast<int64_t>(str.size())) {
+    return context.fail(ErrorCode::OUT_OF_RANGE, "substring out of index at ", pos);
+  }
+  return context.push_value(json(str.substr(begin, end - begin)));
+}
+
+inline const json *array_contains(EvaluationContext & /*context*/, const json *receiver, const json *const *args,
+                                  const size_t /*pos*/) {
+  return boolean(std::find(receiver->begin(), receiver->end(), *args[0]) != receiver->end());
+}
+
+inline const json *array_index_of(EvaluationContext &context, const json *receiver, const json *const *args,
+                                  const size_t /*pos*/) {
+  auto it = std::find(receiver->begin(), receiver->end(), *args[0]);
+  return context.push_value(json(it == receiver->end() ? -1 : static_cast<int64_t>(it - receiver->begin())));
+}
+
+inline const json *contains_key(EvaluationContext &context, const json *receiver, const json *const *args,
+                                const size_t pos) {
+  if (!args[0]->is_string()) {
+    return invalid_argument(context, pos);
+  }
+  return boolean(receiver->find(args[0]->get_ref<const std::string &>()) != receiver->end());
+}
+
+inline const json *keys(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                        const size_t /*pos*/) {
+  json result = json::array();
+  json::array_t &items = result.get_ref<json::array_t &>();
+  items.reserve(receiver->size());
+  for (auto it = receiver->begin(); it != receiver->end(); ++it) {
+    items.emplace_back(it.key());
+  }
+  return context.push_value(std::move(result));
+}
+
+inline const json *values(EvaluationContext &context, const json *receiver, const json *const * /*args*/,
+                          const size_t /*pos*/) {
+  json result = json::array();
+  json::array_t &items = result.get_ref<json::array_t &>();
+  items.reserve(receiver->size());
+  for (auto it = receiver->begin(); it != receiver->end(); ++it) {
+    items.push_back(*it);
+  }
+  return context.push_value(std::move(result));
+}
+
+} // namespace method
+
+/**
+ * builtin methods of strings, arrays and objects like name.startsWith('J') or items.size().
+ * MethodNode looks its method up by name and number of arguments once when it's built,
+ * an evaluation only indexes the implementations by the type of the receiver
+ */
+class MethodTable {
+ public:
+  static const MethodTable &instance() {
+    static const MethodTable table;
+    return table;
+  }
+
+  /**
+   * @return nullptr when there is no such method
+   */
+  const Method *find(const std::string &name, const size_t args_count) const {
+    auto it = methods_.find(std::make_pair(name, args_count));
+    return it != methods_.end() ? &it->second : nullptr;
+  }
+
+ private:
+  std::map<std::pair<std::string, size_t>, Method> methods_;
+
+  MethodTable() {
+    const json::value_t string = json::value_t::string;
+    const json::value_t array = json::value_t::array;
+    const json::value_t object = json::value_t::object;
+    add(string, "size", 0, method::string_size);
+    add(string, "length", 0, method::string_size);
+    add(string, "isEmpty", 0, method::string_is_empty);
+    add(string, "contains", 1, method::string_contains);
+    add(string, "startsWith", 1, method::starts_with);
+    add(string, "endsWith", 1, method::ends_with);
+    add(string, "indexOf", 1, method::string_index_of);
+    add(string, "toUpperCase", 0, method::to_upper_case);
+    add(string, "toLowerCase", 0, method::to_lower_case);
+    add(string, "trim", 0, method::trim);
+    add(string, "substring", 1, method::substring);
+    add(string, "substring", 2, method::substring);
+    add(array, "size", 0, method::size);
+    add(array, "isEmpty", 0, method::is_empty);
+    add(array, "contains", 1, method::array_contains);
+    add(array, "indexOf", 1, method::array_index_of);
+    add(object, "size", 0, method::size);
+    add(object, "isEmpty", 0, method::is_empty);
+    add(object, "containsKey", 1, method::contains_key);
+    add(object, "keys", 0, method::keys);
+    add(object, "values", 0, method::values);
+  }
+
+  void add(const json::value_t type, const std::string &name, const size_t args_count, const MethodImpl impl) {
+    methods_[std::make_pair(name, args_count)].impls[static_cast<size_t>(type)] = impl;
+  }
+};
+
+/**
+ * call a method on a resolved receiver which isn't null, shared by MethodNode and the generated code
+ */
+inline const json *call_method(EvaluationContext &context,
+                               const Method *method,
+                               const json *receiver,
+                               const json *const *args,
+                               const size_t pos) {
+  MethodImpl impl = method ? method->get(receiver) : nullptr;
+  if (!impl) {
+    return context.fail(ErrorCode::UNKNOWN_METHOD, "unknown method at ", pos);
+  }
+  return impl(context, receiver, args, pos);
+}
+
+} // namespace cppel
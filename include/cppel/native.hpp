@@ -0,0 +1,366 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "ast.hpp"
+#include "context.hpp"
+#include "pattern.hpp"
+#include "utils.hpp"
+
+/**
+ * natively compiled expressions
+ *
+ * cppel_codegen turns expressions into c++ functions registered in the NativeRegistry,
+ * Parser::parse uses the native function of an expression whose string matches.
+ * the helpers below are used by the generated code and mirror the evaluation of the nodes
+ */
+
+namespace cppel {
+
+using NativeFunction = const json *(*)(EvaluationContext &context);
+
+class NativeRegistry {
+ public:
+  static NativeRegistry &instance() {
+    static NativeRegistry registry;
+    return registry;
+  }
+
+  bool add(const std::string &expr_str, const NativeFunction function) {
+    functions_[expr_str] = function;
+    return true;
+  }
+
+  NativeFunction find(const std::string &expr_str) const {
+    auto it = functions_.find(expr_str);
+    return it != functions_.end() ? it->second : nullptr;
+  }
+
+  size_t size() const {
+    return functions_.size();
+  }
+
+ private:
+  std::unordered_map<std::string, NativeFunction> functions_;
+};
+
+/**
+ * root of a natively compiled expression, the interpreted tree is kept for serialization
+ */
+class NativeNode : public AstNode {
+ public:
+  NativeNode(const std::shared_ptr<AstNode> interpreted, const NativeFunction function) :
+      AstNode(interpreted->get_start_pos(), interpreted->get_end_pos()),
+      interpreted_(interpreted),
+      function_(function) {}
+
+  virtual const char *get_name() const {
+    return "NativeNode";
+  }
+
+  virtual NodeKind get_kind() const {
+    return NodeKind::NATIVE;
+  }
+
+  const std::shared_ptr<AstNode> &get_interpreted() const {
+    return interpreted_;
+  }
+
+  /**
+   * the native function only knows json and the functions of the context, native objects, variables
+   * given to the context, batch functions and budgeted evaluations are evaluated by the interpreted tree
+   */
+  virtual const json *do_evaluate(EvaluationContext &context) {
+    if (context.has_documents() || context.has_variables() || context.get_loader() || context.has_budget()) {
+      return interpreted_->evaluate(context);
+    }
+    return function_(context);
+  }
+
+ private:
+  std::shared_ptr<AstNode> interpreted_;
+  NativeFunction function_;
+};
+
+namespace native {
+
+inline const json *value_empty() {
+  static const json value;
+  return &value;
+}
+
+inline const json *value_zero() {
+  static const json value(0);
+  return &value;
+}
+
+inline const json *boolean(const bool value) {
+  static const json value_true(true);
+  static const json value_false(false);
+  return value ? &value_true : &value_false;
+}
+
+inline const json *property(EvaluationContext &context,
+                            const json *data,
+                            const std::string &name,
+                            const bool null_safe,
+                            const size_t pos) {
+  if (data->is_null()) {
+    if (null_safe) {
+      return value_empty();
+    }
+    return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", pos);
+  }
+  if (data->is_object()) {
+    auto it = data->find(name);
+    if (it != data->end()) {
+      return &(*it);
+    }
+  }
+  return value_empty();
+}
+
+inline const json *index(EvaluationContext &context, const json *data, const json *index_value, const size_t pos) {
+  if ((data->is_string() || data->is_array()) && !index_value->is_number_integer()) {
+    return context.fail(ErrorCode::INVALID_ARGUMENT, "index must be an integer at", pos);
+  } else if (data->is_object() && !index_value->is_string()) {
+    return context.fail(ErrorCode::INVALID_ARGUMENT, "key must be a string at", pos);
+  }
+  if (data->is_string()) {
+    const std::string &str = data->get_ref<const std::string &>();
+    int index = index_value->get<int>();
+    if (index < 0 || static_cast<size_t>(index) >= str.size()) {
+      return context.fail(ErrorCode::OUT_OF_RANGE, "string out of index at", pos);
+    }
+    return context.push_ref(std::make_shared<json>(str.substr(index, 1)));
+  } else if (data->is_array()) {
+    int index = index_value->get<int>();
+    if (index < 0 || static_cast<size_t>(index) >= data->size()) {
+      return context.fail(ErrorCode::OUT_OF_RANGE, "array out of index at", pos);
+    }
+    return &(*data)[index];
+  } else if (data->is_object()) {
+    auto it = data->find(index_value->get<std::string>());
+    if (it != data->end()) {
+      return &(*it);
+    }
+    return context.fail(ErrorCode::MISSING_KEY, "unexpected indexer at", pos);
+  }
+  return context.fail(ErrorCode::NOT_INDEXABLE, "can't be index at", pos);
+}
+
+struct Gt {
+  template<typename A, typename B>
+  bool operator()(const A &lh, const B &rh) const {
+    return lh > rh;
+  }
+};
+
+struct Ge {
+  template<typename A, typename B>
+  bool operator()(const A &lh, const B &rh) const {
+    return lh >= rh;
+  }
+};
+
+struct Lt {
+  template<typename A, typename B>
+  bool operator()(const A &lh, const B &rh) const {
+    return lh < rh;
+  }
+};
+
+struct Le {
+  template<typename A, typename B>
+  bool operator()(const A &lh, const B &rh) const {
+    return lh <= rh;
+  }
+};
+
+struct Eq {
+  template<typename A, typename B>
+  bool operator()(const A &lh, const B &rh) const {
+    return lh == rh;
+  }
+};
+
+struct Ne {
+  template<typename A, typename B>
+  bool operator()(const A &lh, const B &rh) const {
+    return lh != rh;
+  }
+};
+
+template<typename Op>
+const json *compare(const json *lh, const json *rh) {
+  return boolean(Op()(*lh, *rh));
+}
+
+/**
+ * compare with an integer literal, rh_value is the same literal as json for the other types
+ */
+template<typename Op>
+const json *compare(const json *lh, const int64_t rh, const json &rh_value) {
+  if (lh->is_number_integer() && !lh->is_number_unsigned()) {
+    return boolean(Op()(lh->get<int64_t>(), rh));
+  } else if (lh->is_number_float()) {
+    return boolean(Op()(lh->get<double>(), static_cast<double>(rh)));
+  }
+  return boolean(Op()(*lh, rh_value));
+}
+
+template<typename Op>
+const json *compare(const json *lh, const double rh, const json &rh_value) {
+  if (lh->is_number()) {
+    return boolean(Op()(lh->get<double>(), rh));
+  }
+  return boolean(Op()(*lh, rh_value));
+}
+
+template<typename Op>
+const json *compare(const json *lh, const std::string &rh, const json &rh_value) {
+  if (lh->is_string()) {
+    return boolean(Op()(lh->get_ref<const std::string &>(), rh));
+  }
+  return boolean(Op()(*lh, rh_value));
+}
+
+inline const json *matches(const json *lh, const Pattern &pattern) {
+  return boolean(lh->is_string() && pattern.matches(lh->get_ref<const std::string &>()));
+}
+
+inline const json *matches(EvaluationContext &context, const json *lh, const json *rh, const size_t pos) {
+  if (!rh->is_string()) {
+    return context.fail(ErrorCode::INVALID_PATTERN, "pattern should be a string at ", pos);
+  }
+  std::shared_ptr<const Pattern> pattern;
+  try {
+    pattern = PatternCache::instance().get(rh->get_ref<const std::string &>());
+  } catch (const std::regex_error &e) {
+    return context.fail(ErrorCode::INVALID_PATTERN, "invalid pattern at ", pos);
+  }
+  return matches(lh, *pattern);
+}
+
+inline const json *in(const json *lh, const JsonSet &set) {
+  return boolean(set.contains(lh));
+}
+
+inline const json *in(EvaluationContext &context, const json *lh, const json *rh, const size_t pos) {
+  if (!rh->is_array()) {
+    return context.fail(ErrorCode::NOT_ARRAY, "in should do with array at ", pos);
+  }
+  for (auto &item : *rh) {
+    if (item == *lh) {
+      return boolean(true);
+    }
+  }
+  return boolean(false);
+}
+
+inline const json *plus(EvaluationContext &context, const json *lh, const json *rh) {
+  if (lh->is_string() && rh->is_string()) {
+    return context.push_ref(std::make_shared<json>(lh->get_ref<const std::string &>() + rh->get_ref<const std::string &>()));
+  } else if (lh->is_number_integer() && rh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() + rh->get<int>()));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() + rh->get<float>()));
+}
+
+inline const json *plus(EvaluationContext &context, const json *lh, const int rh) {
+  if (lh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() + rh));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() + static_cast<float>(rh)));
+}
+
+inline const json *plus(EvaluationContext &context, const json *lh, const float rh) {
+  return context.push_ref(std::make_shared<json>(lh->get<float>() + rh));
+}
+
+inline const json *minus(EvaluationContext &context, const json *lh, const json *rh) {
+  if (lh->is_number_integer() && rh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() - rh->get<int>()));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() - rh->get<float>()));
+}
+
+inline const json *minus(EvaluationContext &context, const json *lh, const int rh) {
+  if (lh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() - rh));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() - static_cast<float>(rh)));
+}
+
+inline const json *minus(EvaluationContext &context, const json *lh, const float rh) {
+  return context.push_ref(std::make_shared<json>(lh->get<float>() - rh));
+}
+
+inline const json *multiply(EvaluationContext &context, const json *lh, const json *rh) {
+  if (lh->is_number_integer() && rh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() * rh->get<int>()));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() * rh->get<float>()));
+}
+
+inline const json *multiply(EvaluationContext &context, const json *lh, const int rh) {
+  if (lh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() * rh));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() * static_cast<float>(rh)));
+}
+
+inline const json *multiply(EvaluationContext &context, const json *lh, const float rh) {
+  return context.push_ref(std::make_shared<json>(lh->get<float>() * rh));
+}
+
+inline const json *divide(EvaluationContext &context, const json *lh, const json *rh) {
+  if (lh->is_number_integer() && rh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() / rh->get<int>()));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() / rh->get<float>()));
+}
+
+inline const json *divide(EvaluationContext &context, const json *lh, const int rh) {
+  if (lh->is_number_integer()) {
+    return context.push_ref(std::make_shared<json>(lh->get<int>() / rh));
+  }
+  return context.push_ref(std::make_shared<json>(lh->get<float>() / static_cast<float>(rh)));
+}
+
+inline const json *divide(EvaluationContext &context, const json *lh, const float rh) {
+  return context.push_ref(std::make_shared<json>(lh->get<float>() / rh));
+}
+
+inline const json *modulus(EvaluationContext &context, const json *lh, const json *rh) {
+  return context.push_ref(std::make_shared<json>(lh->get<int>() % rh->get<int>()));
+}
+
+inline const json *power(EvaluationContext &context, const json *lh, const json *rh) {
+  if (lh->is_number_integer() && rh->is_number_integer() && rh->get<int>() > 0) {
+    return context.push_ref(std::make_shared<json>(static_cast<int>(std::pow(lh->get<int>(), rh->get<int>()))));
+  }
+  return context.push_ref(std::make_shared<json>(std::pow(lh->get<float>(), rh->get<float>())));
+}
+
+inline const Function *function(EvaluationContext &context,
+                                const std::pair<std::string, int> &name_args_count,
+                                const size_t pos) {
+  const Function *function = context.find_function(name_args_count);
+  if (!function) {
+    context.fail(ErrorCode::UNKNOWN_FUNCTION, "unknown function at ", pos);
+  }
+  return function;
+}
+
+} // namespace native
+
+} // namespace cppel
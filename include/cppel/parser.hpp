@@ -4,14 +4,21 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdio>
 #include <string>
 #include <memory>
 #include <vector>
 #include <deque>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 #include "exception.hpp"
 #include "tokenizer.hpp"
 #include "ast.hpp"
+#include "cost.hpp"
 #include "expression.hpp"
+#include "native.hpp"
 
 namespace cppel {
 
@@ -19,15 +26,90 @@ class InternalParser {
  public:
   InternalParser(const std::string &expr_str) : expr_str_(expr_str), tokenizer_(expr_str) {}
 
+  /**
+   * @param parameterized start positions of the literal tokens to parse as parameters $0, $1 ..., sorted
+   */
+  InternalParser(const std::string &expr_str, const std::vector<size_t> &parameterized)
+      : expr_str_(expr_str), tokenizer_(expr_str), parameterized_(parameterized) {}
+
   std::shared_ptr<AstNode> parse() {
-    return eat_expression();
+    return eat_sequence();
+  }
+
+  static int int_value(const std::string &expr_str, const Token &token) {
+    int value = 0;
+    for (size_t pos = token.start_pos_; pos < token.end_pos_; ++pos) {
+      value = value * 10 + (expr_str[pos] - '0');
+    }
+    return value;
+  }
+
+  static float float_value(const std::string &expr_str, const Token &token) {
+    float value = 0;
+    bool dot = false;
+    int rate = 1;
+    for (size_t pos = token.start_pos_; pos < token.end_pos_; ++pos) {
+      if (expr_str[pos] == '.') {
+        dot = true;
+        continue;
+      }
+      if (dot) {
+        rate *= 10;
+        value += (expr_str[pos] - '0') / ((float) rate);
+      } else {
+        value = value * 10 + (expr_str[pos] - '0');
+      }
+    }
+    return value;
+  }
+
+  static std::string string_value(const std::string &expr_str, const Token &token) {
+    return expr_str.substr(token.start_pos_ + 1, token.end_pos_ - token.start_pos_ - 2);
+  }
+
+  /**
+   * value of an int, float or string literal token, as held by its literal node
+   */
+  static json literal_value(const std::string &expr_str, const Token &token) {
+    if (token.kind_ == Token::Kind::LITERAL_INT) {
+      return json(int_value(expr_str, token));
+    } else if (token.kind_ == Token::Kind::LITERAL_FLOAT) {
+      return json(float_value(expr_str, token));
+    }
+    return json(string_value(expr_str, token));
   }
 
  private:
   std::string expr_str_;
   Tokenizer tokenizer_;
+  std::vector<size_t> parameterized_;
   std::deque<std::shared_ptr<AstNode>> constructedNodes_;
 
+  /**
+   * handle expressions separated by ;
+   * @return
+   */
+  std::shared_ptr<AstNode> eat_sequence() {
+    std::shared_ptr<AstNode> expr = eat_expression();
+    if (!peek_token(Token::Kind::SEMICOLON)) {
+      return expr;
+    }
+    std::vector<std::shared_ptr<AstNode>> exprs = {expr};
+    while (peek_token(Token::Kind::SEMICOLON)) {
+      Token token = next_token();
+      std::shared_ptr<AstNode> next_expr = eat_expression();
+      if (!expr) {
+        CPPEL_THROW(ParseError("unexpected null before " + std::to_string(token.start_pos_)));
+      }
+      if (!next_expr) {
+        CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos_)));
+      }
+      exprs.push_back(next_expr);
+    }
+    // the sequence spans its expressions, from the start of the first one to the end of the last one
+    return std::make_shared<Sequence>(exprs.front()->get_start_pos(), exprs.back()->get_end_pos(), exprs);
+  }
+
   /**
    * handle expression
    *
@@ -40,8 +122,15 @@ class InternalParser {
       if (!expr) {
         return std::make_shared<LiteralNone>(token.start_pos_ - 1, token.end_pos_ - 1);
       }
+      const VariableNode *variable = dynamic_cast<const VariableNode *>(expr.get());
+      if (!variable || !variable->is_slot()) {
+        CPPEL_THROW(ParseError("only variables can be assigned at " + std::to_string(token.start_pos_)));
+      }
       next_token();
-      std::shared_ptr<AstNode> assigned_value = eat_logical_or_expression();
+      std::shared_ptr<AstNode> assigned_value = eat_expression();
+      if (!assigned_value) {
+        CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos_)));
+      }
       return std::make_shared<Assign>(token.start_pos_, token.end_pos_, expr, assigned_value);
     } else if (token.kind_ == Token::Kind::ELVIS) {
       if (!expr) {
@@ -64,11 +153,14 @@ class InternalParser {
   }
 
   /**
-   * handle or
+   * handle or, adjacent equalities of a same expression with literals like
+   * country == 'US' || country == 'CA' are rewritten to country in {'US', 'CA'}
    * @return
    */
   std::shared_ptr<AstNode> eat_logical_or_expression() {
     std::shared_ptr<AstNode> expr = eat_logical_and_expression();
+    std::vector<std::shared_ptr<AstNode>> exprs = {expr};
+    std::vector<Token> tokens;
     while (peek_token(Token::Kind::OR)) {
       Token token = next_token();
       std::shared_ptr<AstNode> rh_expr = eat_logical_and_expression();
@@ -78,11 +170,119 @@ class InternalParser {
       if (!rh_expr) {
         CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos_)));
       }
-      expr = std::make_shared<OpOr>(token.start_pos_, token.end_pos_, expr, rh_expr);
+      exprs.push_back(rh_expr);
+      tokens.push_back(token);
+    }
+
+    expr = nullptr;
+    for (size_t i = 0; i < exprs.size();) {
+      std::shared_ptr<AstNode> operand = exprs[i];
+      size_t end = i + 1;
+      const AstNode *subject = equality_subject(exprs[i].get());
+      while (subject && end < exprs.size() && same_expression(subject, equality_subject(exprs[end].get()))) {
+        ++end;
+      }
+      if (end - i >= 2) {
+        std::vector<std::shared_ptr<AstNode>> literals;
+        for (size_t j = i; j < end; ++j) {
+          const std::vector<std::shared_ptr<AstNode>> &children = exprs[j]->get_children();
+          literals.push_back(children[0].get() == equality_subject(exprs[j].get()) ? children[1] : children[0]);
+        }
+        std::shared_ptr<AstNode> list = std::make_shared<InlineList>(literals.front()->get_start_pos(),
+                                                                     literals.back()->get_end_pos(), literals);
+        std::shared_ptr<AstNode> subject_expr = exprs[i]->get_children()[0].get() == subject
+            ? exprs[i]->get_children()[0] : exprs[i]->get_children()[1];
+        operand = std::make_shared<OpIn>(exprs[i]->get_start_pos(), exprs[i]->get_end_pos(), subject_expr, list);
+      }
+      expr = expr ? std::make_shared<OpOr>(tokens[i - 1].start_pos_, tokens[i - 1].end_pos_, expr, operand) : operand;
+      i = end;
     }
     return expr;
   }
 
+  /**
+   * the expression compared by an equality with a literal, nullptr when node isn't one
+   */
+  static const AstNode *equality_subject(const AstNode *node) {
+    if (!dynamic_cast<const OpEQ *>(node) || node->get_children().size() != 2) {
+      return nullptr;
+    }
+    const AstNode *lh = node->get_children()[0].get();
+    const AstNode *rh = node->get_children()[1].get();
+    if (is_literal(rh) && !is_literal(lh) && is_pure(lh)) {
+      return lh;
+    } else if (is_literal(lh) && !is_literal(rh) && is_pure(rh)) {
+      return rh;
+    }
+    return nullptr;
+  }
+
+  static bool is_literal(const AstNode *node) {
+    switch (node->get_kind()) {
+      case NodeKind::LITERAL_STRING:
+      case NodeKind::LITERAL_INT:
+      case NodeKind::LITERAL_FLOAT:
+      case NodeKind::LITERAL_BOOL:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  /**
+   * evaluating the node has no effect, so it can be evaluated once instead of several times
+   */
+  static bool is_pure(const AstNode *node) {
+    switch (node->get_kind()) {
+      case NodeKind::FUNCTION:
+      case NodeKind::METHOD:
+      case NodeKind::ASSIGN:
+        return false;
+      default:
+        break;
+    }
+    for (auto &child : node->get_children()) {
+      if (!is_pure(child.get())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * nodes parsed from the same text
+   */
+  bool same_expression(const AstNode *lh, const AstNode *rh) const {
+    return lh && rh && same_tree(lh, rh) && source_of(lh) == source_of(rh);
+  }
+
+  static bool same_tree(const AstNode *lh, const AstNode *rh) {
+    if (lh->get_kind() != rh->get_kind() || lh->get_children().size() != rh->get_children().size()) {
+      return false;
+    }
+    for (size_t i = 0; i < lh->get_children().size(); ++i) {
+      if (!same_tree(lh->get_children()[i].get(), rh->get_children()[i].get())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::string source_of(const AstNode *node) const {
+    size_t start = node->get_start_pos();
+    size_t end = node->get_end_pos();
+    source_range(node, start, end);
+    return expr_str_.substr(start, end - start);
+  }
+
+  static void source_range(const AstNode *node, size_t &start, size_t &end) {
+    start = std::min(start, node->get_start_pos());
+    end = std::max(end, node->get_end_pos());
+    for (auto &child : node->get_children()) {
+      source_range(child.get(), start, end);
+    }
+  }
+
   /**
    * handle and
    * @return
@@ -104,11 +304,33 @@ class InternalParser {
   }
 
   /**
-   * handle relation like: >, >=, <, <=, ==, !=
+   * handle relation like: >, >=, <, <=, ==, !=, matches, in
    * @return
    */
   std::shared_ptr<AstNode> eat_relation_expression() {
     std::shared_ptr<AstNode> expr = eat_sum_expression();
+    if (peek_token(Token::Kind::IN)) {
+      Token token = next_token();
+      std::shared_ptr<AstNode> rh_expr = eat_sum_expression();
+      if (!expr) {
+        CPPEL_THROW(ParseError("unexpected null before " + std::to_string(token.start_pos_)));
+      }
+      if (!rh_expr) {
+        CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos_)));
+      }
+      return std::make_shared<OpIn>(token.start_pos_, token.end_pos_, expr, rh_expr);
+    }
+    if (peek_token(Token::Kind::MATCHES)) {
+      Token token = next_token();
+      std::shared_ptr<AstNode> rh_expr = eat_sum_expression();
+      if (!expr) {
+        CPPEL_THROW(ParseError("unexpected null before " + std::to_string(token.start_pos_)));
+      }
+      if (!rh_expr) {
+        CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos_)));
+      }
+      return std::make_shared<OpMatches>(token.start_pos_, token.end_pos_, expr, rh_expr);
+    }
     if (peek_token().is_numeric_relation_operator()) {
       Token token = next_token();
       std::shared_ptr<AstNode> rh_expr = eat_sum_expression();
@@ -236,6 +458,7 @@ class InternalParser {
 
   /**
    * handle start node:
+   *    parameter,
    *    literal,
    *    parenExpr,
    *    function,
@@ -248,6 +471,9 @@ class InternalParser {
    * @return
    */
   std::shared_ptr<AstNode> eat_start_node() {
+    if (maybe_eat_parameter()) {
+      return pop_node();
+    }
     if (maybe_eat_literal()) {
       return pop_node();
     }
@@ -291,48 +517,55 @@ class InternalParser {
     if (token.kind_ == Token::Kind::LITERAL_BOOL) {
       bool value = "true" == expr_str_.substr(token.start_pos_, token.end_pos_ - token.start_pos_);
       push_node(std::make_shared<LiteralBool>(token.start_pos_, token.end_pos_, value));
+    } else if (token.kind_ != Token::Kind::LITERAL_INT && token.kind_ != Token::Kind::LITERAL_FLOAT
+        && token.kind_ != Token::Kind::LITERAL_STRING) {
+      return false;
+    } else if (std::binary_search(parameterized_.begin(), parameterized_.end(), token.start_pos_)) {
+      size_t ordinal = std::lower_bound(parameterized_.begin(), parameterized_.end(), token.start_pos_)
+          - parameterized_.begin();
+      push_node(std::make_shared<ParameterNode>(token.start_pos_, token.end_pos_, "$" + std::to_string(ordinal)));
     } else if (token.kind_ == Token::Kind::LITERAL_INT) {
-      int value = 0;
-      for (int pos = token.start_pos_; pos < token.end_pos_; ++pos) {
-        value = value * 10 + (expr_str_[pos] - '0');
-      }
-      push_node(std::make_shared<LiteralInt>(token.start_pos_, token.end_pos_, value));
+      push_node(std::make_shared<LiteralInt>(token.start_pos_, token.end_pos_, int_value(expr_str_, token)));
     } else if (token.kind_ == Token::Kind::LITERAL_FLOAT) {
-      float value = 0;
-      bool dot = false;
-      int rate = 1;
-      for (int pos = token.start_pos_; pos < token.end_pos_; ++pos) {
-        if (expr_str_[pos] == '.') {
-          dot = true;
-          continue;
-        }
-        if (dot) {
-          rate *= 10;
-          value += (expr_str_[pos] - '0') / ((float) rate);
-        } else {
-          value = value * 10;
-        }
-      }
-      push_node(std::make_shared<LiteralFloat>(token.start_pos_, token.end_pos_, value));
-    } else if (token.kind_ == Token::Kind::LITERAL_STRING) {
-      push_node(std::make_shared<LiteralString>(token.start_pos_,
-                                                token.end_pos_,
-                                                expr_str_.substr(token.start_pos_ + 1,
-                                                                 token.end_pos_ - token.start_pos_ - 2)));
+      push_node(std::make_shared<LiteralFloat>(token.start_pos_, token.end_pos_, float_value(expr_str_, token)));
     } else {
-      return false;
+      push_node(std::make_shared<LiteralString>(token.start_pos_, token.end_pos_, string_value(expr_str_, token)));
     }
     next_token();
     return true;
   }
 
+  /**
+   * handle parameter:
+   *    QMARK LITERAL_INT,
+   *    COLON IDENTIFIER
+   * @return
+   */
+  bool maybe_eat_parameter() {
+    Token &pt = peek_token();
+    if (pt.kind_ != Token::Kind::QMARK && pt.kind_ != Token::Kind::COLON) {
+      return false;
+    }
+    Token token = next_token();
+    Token name_token = next_token();
+    Token::Kind name_kind = token.kind_ == Token::Kind::QMARK ? Token::Kind::LITERAL_INT : Token::Kind::IDENTIFIER;
+    if (name_token.kind_ != name_kind || name_token.start_pos_ != token.end_pos_) {
+      CPPEL_THROW(ParseError("unexpected parameter at " + std::to_string(token.start_pos_)));
+    }
+    std::string name = token.kind_ == Token::Kind::QMARK
+        ? "?" + std::to_string(int_value(expr_str_, name_token))
+        : ":" + expr_str_.substr(name_token.start_pos_, name_token.end_pos_ - name_token.start_pos_);
+    push_node(std::make_shared<ParameterNode>(token.start_pos_, name_token.end_pos_, name));
+    return true;
+  }
+
   bool maybe_eat_paren_expression() {
     if (peek_token().kind_ != Token::Kind::LPAREN) {
       return false;
     }
 
     Token token = next_token();
-    std::shared_ptr<AstNode> expr = eat_expression();
+    std::shared_ptr<AstNode> expr = eat_sequence();
     if (!expr) {
       CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos_)));
     }
@@ -379,17 +612,6 @@ class InternalParser {
     return true;
   }
 
-  bool maybe_eat_property(bool save_navi) {
-    if (peek_token().kind_ != Token::Kind::IDENTIFIER) {
-      return false;
-    }
-
-    Token token = next_token();
-    std::string name = expr_str_.substr(token.start_pos_, token.end_pos_ - token.start_pos_);
-    push_node(std::make_shared<PropertyNode>(token.start_pos_, token.end_pos_, save_navi, name));
-    return true;
-  }
-
   bool maybe_eat_method_or_function_args(std::vector<std::shared_ptr<AstNode>> &args) {
     if (peek_token().kind_ != Token::Kind::LPAREN) {
       return false;
@@ -564,7 +786,7 @@ class InternalParser {
   std::shared_ptr<AstNode> eat_dotted_node() {
     Token token = next_token();
     bool safe_navi = token.kind_ == Token::Kind::SAFE_NAVI;
-    if (maybe_eat_property(safe_navi) || maybe_eat_projection(safe_navi) || maybe_eat_selection(safe_navi) || maybe_eat_flat(safe_navi)) {
+    if (maybe_eat_method_or_property(safe_navi) || maybe_eat_projection(safe_navi) || maybe_eat_selection(safe_navi) || maybe_eat_flat(safe_navi)) {
       return pop_node();
     }
     CPPEL_THROW(ParseError("unexpected token after " + std::to_string(peek_token().start_pos_)));
@@ -616,6 +838,74 @@ class InternalParser {
 
 };
 
+/**
+ * plans of the expressions parsed by a Parser, keyed by their tokens without the literals which
+ * are parameterized, so that expressions only differing in these literals or in their spaces share one plan.
+ * least recently used plans are evicted
+ */
+class PlanCache {
+ public:
+  struct Plan {
+    std::shared_ptr<AstNode> root;
+    std::shared_ptr<const Variables> variables;
+    std::shared_ptr<const Parameters> parameters;
+    // ordinal of the literal bound to each parameter slot, npos for ?1 or :name
+    std::vector<size_t> literals;
+    // tokens of the expression the plan is parsed from, at the positions of its nodes
+    std::shared_ptr<const TokenSpans> spans;
+    // estimated when the plan is parsed with an admission policy
+    Cost cost;
+    bool costed = false;
+  };
+
+  explicit PlanCache(const size_t capacity) : capacity_(capacity) {}
+
+  std::shared_ptr<const Plan> get(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+
+  void put(const std::string &key, const std::shared_ptr<const Plan> &plan) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.find(key) == index_.end() && capacity_ > 0) {
+      entries_.emplace_front(key, plan);
+      index_[key] = entries_.begin();
+      evict();
+    }
+  }
+
+  void set_capacity(const size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    evict();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const Plan>>;
+
+  mutable std::mutex mutex_;
+  size_t capacity_;
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+
+  void evict() {
+    while (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+};
+
 class Parser {
  public:
   Parser() {}
@@ -623,12 +913,181 @@ class Parser {
     if (expr_str.empty()) {
       CPPEL_THROW(ParseError("unexpected empty string"));
     }
+    NativeFunction function = use_native_ ? NativeRegistry::instance().find(expr_str) : nullptr;
+    if (cache_ && !function) {
+      return parse_cached(expr_str);
+    }
     InternalParser internal_parser(expr_str);
     std::shared_ptr<AstNode> root = internal_parser.parse();
     if (!root) {
       CPPEL_THROW(ParseError("internal parser error"));
     }
-    return Expression(root);
+    std::shared_ptr<const Variables> variables = bind_variables(root);
+    std::shared_ptr<const Parameters> parameters = bind_parameters(root);
+    if (admission_.max_cost > 0) {
+      admit(expr_str, estimate_cost(*root, admission_.model));
+    }
+    if (function) {
+      root = std::make_shared<NativeNode>(root, function);
+    }
+    return Expression(root, expr_str, variables, parameters);
+  }
+
+  /**
+   * use the natively compiled function of an expression when one is registered, default true
+   */
+  void set_use_native(const bool use_native) {
+    use_native_ = use_native;
+  }
+
+  /**
+   * cache the plans of up to capacity expressions, 0 disables the cache which is the default.
+   * int, float and string literals are parameters of the cached plans, except patterns of matches,
+   * lists of in and the literals compared by == in an expression with ||, which are compiled with
+   * the plan. copies of the parser share the cache
+   */
+  void set_cache_capacity(const size_t capacity) {
+    if (capacity == 0) {
+      cache_ = nullptr;
+    } else if (cache_) {
+      cache_->set_capacity(capacity);
+    } else {
+      cache_ = std::make_shared<PlanCache>(capacity);
+    }
+  }
+
+  /**
+   * number of the cached plans
+   */
+  size_t cache_size() const {
+    return cache_ ? cache_->size() : 0;
+  }
+
+  /**
+   * estimate the cost of the parsed expressions, see estimate_cost. an expression whose cost at
+   * policy.array_size is above policy.max_cost is rejected with a ParseError, or flagged to
+   * policy.on_exceeded when it's set
+   */
+  void set_admission(const AdmissionPolicy &policy) {
+    admission_ = policy;
+  }
+
+ private:
+  bool use_native_ = true;
+  std::shared_ptr<PlanCache> cache_;
+  AdmissionPolicy admission_;
+
+  void admit(const std::string &expr_str, const Cost &cost) {
+    double value = cost.at(admission_.array_size);
+    if (value <= admission_.max_cost) {
+      return;
+    }
+    if (admission_.on_exceeded) {
+      admission_.on_exceeded(expr_str, cost);
+      return;
+    }
+    char message[128];
+    std::snprintf(message, sizeof(message), " is %g for arrays of %g, above %g", value, admission_.array_size,
+                  admission_.max_cost);
+    CPPEL_THROW(ParseError("expression cost " + cost.to_string() + message));
+  }
+
+  Expression parse_cached(const std::string &expr_str) {
+    std::vector<Token> literals;
+    TokenSpans spans;
+    std::string key = plan_key(expr_str, literals, spans);
+    std::shared_ptr<const PlanCache::Plan> plan = cache_->get(key);
+    if (!plan) {
+      std::vector<size_t> parameterized;
+      for (auto &literal : literals) {
+        parameterized.push_back(literal.start_pos_);
+      }
+      InternalParser internal_parser(expr_str, parameterized);
+      std::shared_ptr<AstNode> root = internal_parser.parse();
+      if (!root) {
+        CPPEL_THROW(ParseError("internal parser error"));
+      }
+      std::shared_ptr<PlanCache::Plan> parsed = std::make_shared<PlanCache::Plan>();
+      parsed->root = root;
+      parsed->spans = std::make_shared<TokenSpans>(spans);
+      parsed->variables = bind_variables(root);
+      parsed->parameters = bind_parameters(root);
+      if (parsed->parameters) {
+        for (auto &name : *parsed->parameters) {
+          parsed->literals.push_back(name[0] == '$' ? std::stoul(name.substr(1)) : std::string::npos);
+        }
+      }
+      if (admission_.max_cost > 0) {
+        parsed->cost = estimate_cost(*root, admission_.model);
+        parsed->costed = true;
+      }
+      cache_->put(key, parsed);
+      plan = parsed;
+    }
+    if (admission_.max_cost > 0) {
+      // the cost doesn't depend on the parameterized literals
+      admit(expr_str, plan->costed ? plan->cost : estimate_cost(*plan->root, admission_.model));
+    }
+    std::vector<json> values;
+    values.reserve(plan->literals.size());
+    for (size_t ordinal : plan->literals) {
+      values.push_back(ordinal != std::string::npos ? InternalParser::literal_value(expr_str, literals[ordinal])
+                                                    : json(json::value_t::discarded));
+    }
+    std::shared_ptr<const PositionMap> positions;
+    if (*plan->spans != spans) {
+      positions = std::make_shared<PositionMap>(plan->spans, std::move(spans));
+    }
+    return Expression(plan->root, expr_str, plan->variables, plan->parameters, std::move(values), positions);
+  }
+
+  /**
+   * kinds and texts of the tokens, the literals to parameterize are left out of the key and appended to literals.
+   * the positions of the tokens aren't part of the key, they're appended to spans to map the nodes of a shared plan
+   * to the expression. the literals compared by == stay in the key when the expression has ||, so that
+   * a plan keeps the rewrite of their == chains to in
+   */
+  static std::string plan_key(const std::string &expr_str, std::vector<Token> &literals, TokenSpans &spans) {
+    Tokenizer tokenizer(expr_str);
+    std::vector<Token> tokens;
+    bool has_or = false;
+    while (true) {
+      Token token = tokenizer.next_token();
+      if (token.kind_ == Token::Kind::END) {
+        break;
+      }
+      has_or = has_or || token.kind_ == Token::Kind::OR;
+      tokens.push_back(token);
+    }
+    std::string key;
+    Token::Kind previous = Token::Kind::END;
+    // depth of the braces of a list after in
+    int in_depth = 0;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      const Token &token = tokens[i];
+      if (in_depth > 0 && (token.kind_ == Token::Kind::LCURLY || token.kind_ == Token::Kind::RCURLY)) {
+        in_depth += token.kind_ == Token::Kind::LCURLY ? 1 : -1;
+      } else if (token.kind_ == Token::Kind::LCURLY && previous == Token::Kind::IN) {
+        in_depth = 1;
+      }
+      spans.emplace_back(token.start_pos_, token.end_pos_);
+      key.push_back(static_cast<char>(token.kind_));
+      bool literal = token.kind_ == Token::Kind::LITERAL_INT || token.kind_ == Token::Kind::LITERAL_FLOAT
+          || token.kind_ == Token::Kind::LITERAL_STRING;
+      bool compared = has_or && (previous == Token::Kind::EQ
+          || (i + 1 < tokens.size() && tokens[i + 1].kind_ == Token::Kind::EQ));
+      if (literal && in_depth == 0 && !compared && previous != Token::Kind::MATCHES
+          && previous != Token::Kind::QMARK) {
+        literals.push_back(token);
+        key.push_back(';');
+      } else {
+        key += std::to_string(token.end_pos_ - token.start_pos_);
+        key.push_back(':');
+        key.append(expr_str, token.start_pos_, token.end_pos_ - token.start_pos_);
+      }
+      previous = token.kind_;
+    }
+    return key;
   }
 };
 
@@ -0,0 +1,192 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace cppel {
+
+/**
+ * compiled pattern of the matches operator, the whole string has to match like std::regex_match.
+ *
+ * patterns which are a literal, optionally between ^ and $ and with a leading or trailing .*,
+ * are matched by comparing or searching the literal instead of running the regex engine
+ */
+class Pattern {
+ public:
+  /**
+   * @param pattern ECMAScript regular expression
+   * @throw std::regex_error when pattern is invalid
+   */
+  explicit Pattern(const std::string &pattern) : pattern_(pattern) {
+    if (!analyze(pattern)) {
+      kind_ = Kind::REGEX;
+      regex_ = std::make_shared<std::regex>(pattern);
+    }
+  }
+
+  const std::string &get_pattern() const {
+    return pattern_;
+  }
+
+  bool is_literal() const {
+    return kind_ != Kind::REGEX;
+  }
+
+  bool matches(const std::string &str) const {
+    switch (kind_) {
+      case Kind::EQUALS:return str == literal_;
+      case Kind::PREFIX:
+        return str.size() >= literal_.size() && str.compare(0, literal_.size(), literal_) == 0 && single_line(str);
+      case Kind::SUFFIX:
+        return str.size() >= literal_.size()
+            && str.compare(str.size() - literal_.size(), literal_.size(), literal_) == 0 && single_line(str);
+      case Kind::CONTAINS:return str.find(literal_) != std::string::npos && single_line(str);
+      default:return std::regex_match(str, *regex_);
+    }
+  }
+
+ private:
+  enum class Kind {
+    REGEX,
+    EQUALS,
+    PREFIX,
+    SUFFIX,
+    CONTAINS,
+  };
+
+  std::string pattern_;
+  Kind kind_ = Kind::REGEX;
+  std::string literal_;
+  std::shared_ptr<std::regex> regex_;
+
+  /**
+   * . doesn't match line terminators, so .* only spans strings without them
+   */
+  static bool single_line(const std::string &str) {
+    return !std::memchr(str.data(), '\n', str.size()) && !std::memchr(str.data(), '\r', str.size());
+  }
+
+  static bool is_special(const char ch) {
+    return std::strchr("^$\\.*+?()[]{}|\n\r", ch) != nullptr;
+  }
+
+  bool analyze(const std::string &pattern) {
+    size_t begin = 0;
+    size_t end = pattern.size();
+    if (begin < end && pattern[begin] == '^') {
+      ++begin;
+    }
+    if (end > begin && pattern[end - 1] == '$' && (end < 2 || pattern[end - 2] != '\\')) {
+      --end;
+    }
+    bool any_prefix = end - begin >= 2 && pattern.compare(begin, 2, ".*") == 0;
+    if (any_prefix) {
+      begin += 2;
+    }
+    bool any_suffix = end - begin >= 2 && pattern.compare(end - 2, 2, ".*") == 0
+        && (end - begin < 3 || pattern[end - 3] != '\\');
+    if (any_suffix) {
+      end -= 2;
+    }
+    std::string literal;
+    for (size_t i = begin; i < end; ++i) {
+      char ch = pattern[i];
+      if (ch == '\\') {
+        // only escaped special characters are literal, \d, \w, \n ... are classes or controls
+        if (i + 1 >= end || !is_special(pattern[i + 1]) || pattern[i + 1] == '\n' || pattern[i + 1] == '\r') {
+          return false;
+        }
+        ch = pattern[++i];
+      } else if (is_special(ch)) {
+        return false;
+      }
+      literal.push_back(ch);
+    }
+    literal_ = literal;
+    if (any_prefix && any_suffix) {
+      kind_ = Kind::CONTAINS;
+    } else if (any_prefix) {
+      kind_ = Kind::SUFFIX;
+    } else if (any_suffix) {
+      kind_ = Kind::PREFIX;
+    } else {
+      kind_ = Kind::EQUALS;
+    }
+    return true;
+  }
+};
+
+/**
+ * bounded cache of the patterns which are only known while evaluating, least recently used
+ * ones are evicted. it's shared by the threads evaluating expressions
+ */
+class PatternCache {
+ public:
+  static PatternCache &instance() {
+    static PatternCache cache;
+    return cache;
+  }
+
+  explicit PatternCache(const size_t capacity = 256) : capacity_(capacity) {}
+
+  /**
+   * @throw std::regex_error when pattern is invalid
+   */
+  std::shared_ptr<const Pattern> get(const std::string &pattern) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(pattern);
+      if (it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->second;
+      }
+    }
+    // compiled without holding the lock, a pattern compiled twice by racing threads is harmless
+    std::shared_ptr<const Pattern> compiled = std::make_shared<Pattern>(pattern);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.find(pattern) == index_.end() && capacity_ > 0) {
+      entries_.emplace_front(pattern, compiled);
+      index_[pattern] = entries_.begin();
+      evict();
+    }
+    return compiled;
+  }
+
+  void set_capacity(const size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    evict();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const Pattern>>;
+
+  mutable std::mutex mutex_;
+  size_t capacity_;
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+
+  void evict() {
+    while (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+};
+
+} // namespace cppel
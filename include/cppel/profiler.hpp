@@ -0,0 +1,170 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "allocation.hpp"
+
+namespace cppel {
+
+class AstNode;
+
+struct NodeStats {
+  const char *name = "";
+  uint64_t calls = 0;
+  std::chrono::nanoseconds total_time = std::chrono::nanoseconds(0);
+  uint64_t refs = 0;
+  uint64_t iterated = 0;
+  AllocationStats allocations;
+};
+
+/**
+ * collect per node statistics of instrumented evaluations,
+ * stats are accumulated until reset() so that several runs can be sampled
+ *
+ * time is inclusive of the children, refs, iterated elements and heap allocations
+ * are counted on the node doing them. heap allocations are only counted when
+ * the tracker of allocation.hpp is installed
+ */
+class Profiler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * record one call of node
+   */
+  class Scope {
+   public:
+    Scope(Profiler &profiler, const AstNode *node, const char *name) : profiler_(profiler) {
+      {
+        AllocationTracker::Suspend suspend;
+        Frame frame;
+        frame.node = node;
+        frame.name = name;
+        profiler_.frames_.push_back(frame);
+      }
+      Frame &frame = profiler_.frames_.back();
+      frame.allocation_start = AllocationTracker::current();
+      frame.start = Clock::now();
+    }
+
+    ~Scope() {
+      Clock::time_point end = Clock::now();
+      AllocationStats allocation_end = AllocationTracker::current();
+      AllocationTracker::Suspend suspend;
+
+      Frame frame = profiler_.frames_.back();
+      profiler_.frames_.pop_back();
+      AllocationStats inclusive = allocation_end - frame.allocation_start;
+      AllocationStats self = inclusive - frame.children_allocations;
+
+      NodeStats &stats = profiler_.stats_[frame.node];
+      stats.name = frame.name;
+      stats.calls += 1;
+      stats.total_time += std::chrono::duration_cast<std::chrono::nanoseconds>(end - frame.start);
+      stats.allocations += self;
+
+      if (!profiler_.frames_.empty()) {
+        profiler_.frames_.back().children_allocations += inclusive;
+      }
+    }
+
+   private:
+    Profiler &profiler_;
+  };
+
+  /**
+   * temporary allocated by the current node
+   */
+  void on_push_ref() {
+    if (!frames_.empty()) {
+      AllocationTracker::Suspend suspend;
+      stats_[frames_.back().node].refs += 1;
+    }
+  }
+
+  /**
+   * elements iterated by the current node
+   */
+  void on_iterate(const uint64_t count) {
+    if (!frames_.empty()) {
+      AllocationTracker::Suspend suspend;
+      stats_[frames_.back().node].iterated += count;
+    }
+  }
+
+  /**
+   * heap allocations of one whole evaluation, including the copy of the result
+   */
+  void on_evaluation(const AllocationStats &allocations) {
+    evaluations_ += 1;
+    total_allocations_ += allocations;
+  }
+
+  const NodeStats &get_stats(const AstNode *node) const {
+    auto it = stats_.find(node);
+    return it != stats_.end() ? it->second : stats_empty_;
+  }
+
+  /**
+   * stats summed over all nodes of the same type, like OpPlus
+   */
+  std::map<std::string, NodeStats> get_stats_by_type() const {
+    std::map<std::string, NodeStats> stats_by_type;
+    for (auto &item : stats_) {
+      NodeStats &stats = stats_by_type[item.second.name];
+      stats.name = item.second.name;
+      stats.calls += item.second.calls;
+      stats.total_time += item.second.total_time;
+      stats.refs += item.second.refs;
+      stats.iterated += item.second.iterated;
+      stats.allocations += item.second.allocations;
+    }
+    return stats_by_type;
+  }
+
+  /**
+   * number of profiled evaluations
+   */
+  uint64_t get_evaluations() const {
+    return evaluations_;
+  }
+
+  /**
+   * heap allocations of all profiled evaluations
+   */
+  const AllocationStats &get_total_allocations() const {
+    return total_allocations_;
+  }
+
+  void reset() {
+    stats_.clear();
+    frames_.clear();
+    evaluations_ = 0;
+    total_allocations_ = AllocationStats();
+  }
+
+ private:
+  struct Frame {
+    const AstNode *node;
+    const char *name;
+    Clock::time_point start;
+    AllocationStats allocation_start;
+    AllocationStats children_allocations;
+  };
+
+  std::unordered_map<const AstNode *, NodeStats> stats_;
+  std::vector<Frame> frames_;
+  uint64_t evaluations_ = 0;
+  AllocationStats total_allocations_;
+  const NodeStats stats_empty_ = NodeStats();
+};
+
+} // namespace cppel
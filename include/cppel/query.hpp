@@ -0,0 +1,248 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "context.hpp"
+#include "dependency.hpp"
+#include "exception.hpp"
+#include "expression.hpp"
+
+/**
+ * continuous queries
+ *
+ * expressions are subscribed as standing queries over a stream of keyed documents. documents
+ * and patches are pushed in batches, a flush evaluates the queries reading a changed path of
+ * a changed document and notifies the handlers of the results which changed
+ */
+
+namespace cppel {
+
+/**
+ * result of a query which changed for a document, initial is true for the first evaluation
+ * of the query on the document
+ */
+struct QueryEvent {
+  std::string key;
+  size_t query;
+  bool initial;
+  EvaluateResult previous;
+  EvaluateResult current;
+};
+
+using QueryHandler = std::function<void(const QueryEvent &event)>;
+
+class QueryEngine {
+ public:
+  /**
+   * the query is evaluated on the documents already pushed at the next flush
+   * @return id of the query
+   */
+  size_t subscribe(const Expression &expr, const QueryHandler &handler) {
+    size_t query = queries_.size();
+    queries_.push_back(Query{expr, handler, true});
+    for (auto &path : read_paths(expr)) {
+      index_.add(path, query);
+    }
+    subscribed_.push_back(query);
+    marks_.push_back(0);
+    return query;
+  }
+
+  /**
+   * stop evaluating a query, its id isn't reused
+   */
+  void unsubscribe(const size_t query) {
+    if (query < queries_.size()) {
+      queries_[query].active = false;
+      queries_[query].handler = nullptr;
+    }
+  }
+
+  /**
+   * add or replace a document, every query is evaluated on it at the next flush
+   */
+  void put(const std::string &key, json document) {
+    DocumentState &state = documents_[key];
+    state.data = std::move(document);
+    state.replaced = true;
+    mark_dirty(key, state);
+  }
+
+  /**
+   * apply a json patch to a document, the queries reading a patched path are evaluated at the next flush
+   * @throw EvaluateError when there is no such document or the patch can't be applied
+   */
+  void patch(const std::string &key, const json &patch) {
+    auto it = documents_.find(key);
+    if (it == documents_.end()) {
+      CPPEL_THROW(EvaluateError("unknown document " + key));
+    }
+    DocumentState &state = it->second;
+    std::vector<std::string> paths = dependency::apply_patch(state.data, patch);
+    state.changed.insert(state.changed.end(), paths.begin(), paths.end());
+    mark_dirty(key, state);
+  }
+
+  /**
+   * drop a document and the results of the queries on it, without notification
+   */
+  void remove(const std::string &key) {
+    documents_.erase(key);
+  }
+
+  /**
+   * evaluate the queries affected by the pushed documents and patches, then notify their handlers
+   * @return number of notified events
+   */
+  size_t flush() {
+    std::vector<QueryEvent> events;
+    std::vector<size_t> subscribed;
+    subscribed.swap(subscribed_);
+    std::vector<std::string> dirty;
+    dirty.swap(dirty_);
+    for (auto &key : dirty) {
+      auto it = documents_.find(key);
+      if (it != documents_.end()) {
+        evaluate(key, it->second, events);
+      }
+    }
+    if (!subscribed.empty()) {
+      // new queries on every document, the ones evaluated above are unchanged
+      for (auto &entry : documents_) {
+        evaluate(entry.first, entry.second, subscribed, events);
+      }
+    }
+    size_t notified = 0;
+    for (auto &event : events) {
+      // a handler may unsubscribe a query, itself included, or subscribe one which moves queries_
+      if (!queries_[event.query].active) {
+        continue;
+      }
+      QueryHandler handler = queries_[event.query].handler;
+      if (handler) {
+        handler(event);
+        ++notified;
+      }
+    }
+    return notified;
+  }
+
+  const json *get_document(const std::string &key) const {
+    auto it = documents_.find(key);
+    return it != documents_.end() ? &it->second.data : nullptr;
+  }
+
+  /**
+   * memoized result of a query on a document, nullptr when it wasn't evaluated yet
+   */
+  const EvaluateResult *get_result(const std::string &key, const size_t query) const {
+    auto it = documents_.find(key);
+    if (it == documents_.end() || query >= it->second.evaluated.size() || !it->second.evaluated[query]) {
+      return nullptr;
+    }
+    return &it->second.results[query];
+  }
+
+  size_t size() const {
+    return documents_.size();
+  }
+
+ private:
+  struct Query {
+    Expression expr;
+    QueryHandler handler;
+    bool active;
+  };
+
+  struct DocumentState {
+    json data;
+    std::vector<EvaluateResult> results;
+    std::vector<bool> evaluated;
+    std::vector<std::string> changed;
+    bool replaced = false;
+    bool dirty = false;
+  };
+
+  std::vector<Query> queries_;
+  PathIndex index_;
+  std::unordered_map<std::string, DocumentState> documents_;
+  std::vector<std::string> dirty_;
+  std::vector<size_t> subscribed_;
+  // queries found for a document are deduplicated by marking them with the number of the lookup
+  std::vector<uint64_t> marks_;
+  uint64_t mark_ = 0;
+
+  void mark_dirty(const std::string &key, DocumentState &state) {
+    if (!state.dirty) {
+      state.dirty = true;
+      dirty_.push_back(key);
+    }
+  }
+
+  void evaluate(const std::string &key, DocumentState &state, std::vector<QueryEvent> &events) {
+    std::vector<size_t> found;
+    if (state.replaced) {
+      found.resize(queries_.size());
+      for (size_t i = 0; i < found.size(); ++i) {
+        found[i] = i;
+      }
+    } else {
+      for (auto &pointer : state.changed) {
+        index_.find(dependency::parse_pointer(pointer), found);
+      }
+    }
+    state.replaced = false;
+    state.dirty = false;
+    state.changed.clear();
+    evaluate(key, state, found, events);
+  }
+
+  void evaluate(const std::string &key,
+                DocumentState &state,
+                const std::vector<size_t> &found,
+                std::vector<QueryEvent> &events) {
+    ++mark_;
+    std::vector<size_t> queries;
+    for (size_t query : found) {
+      if (marks_[query] != mark_ && queries_[query].active) {
+        marks_[query] = mark_;
+        queries.push_back(query);
+      }
+    }
+    if (queries.empty()) {
+      return;
+    }
+    std::sort(queries.begin(), queries.end());
+    state.results.resize(queries_.size());
+    state.evaluated.resize(queries_.size(), false);
+    EvaluationContext context(state.data);
+    for (size_t query : queries) {
+      EvaluateResult result = queries_[query].expr.try_evaluate(context);
+      EvaluateResult &previous = state.results[query];
+      bool initial = !state.evaluated[query];
+      if (initial || result.status.code != previous.status.code || result.value != previous.value) {
+        QueryEvent event;
+        event.key = key;
+        event.query = query;
+        event.initial = initial;
+        event.previous = std::move(previous);
+        event.current = result;
+        events.push_back(std::move(event));
+      }
+      previous = std::move(result);
+      state.evaluated[query] = true;
+    }
+  }
+};
+
+} // namespace cppel
@@ -0,0 +1,1083 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#pragma once
+
+#if __cplusplus < 201703L && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#error "cppel/static_expression.hpp requires c++17"
+#endif
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "context.hpp"
+#include "exception.hpp"
+#include "expression.hpp"
+#include "native.hpp"
+#include "tokenizer.hpp"
+#include "utils.hpp"
+
+/**
+ * compile time expressions
+ *
+ *    auto adult = CPPEL_EXPR("user.age >= 18");
+ *    json rlt = adult.evaluate(data);
+ *
+ * the string literal is tokenized and parsed by constexpr mirrors of Tokenizer and InternalParser,
+ * a malformed expression is a compile error. evaluation is a tree of function templates, one per node,
+ * so it's inlined by the compiler without any parsing or virtual call at runtime.
+ * inline maps, methods and assignments are not supported
+ */
+
+namespace cppel {
+
+namespace static_ast {
+
+constexpr size_t NONE = static_cast<size_t>(-1);
+
+enum class NodeKind : uint8_t {
+  LITERAL_NONE,
+  LITERAL_BOOL,
+  LITERAL_INT,
+  LITERAL_FLOAT,
+  LITERAL_STRING,
+  ELVIS,
+  TERNARY,
+  OP_NOT,
+  OP_OR,
+  OP_AND,
+  OP_GT,
+  OP_GE,
+  OP_LT,
+  OP_LE,
+  OP_EQ,
+  OP_NE,
+  OP_PLUS,
+  OP_MINUS,
+  OP_MULTIPLY,
+  OP_DIVIDE,
+  OP_MODULUS,
+  OP_POWER,
+  FUNCTION,
+  VARIABLE,
+  PROPERTY,
+  PROJECTION,
+  FLAT,
+  SELECTION,
+  SELECTION_FIRST,
+  SELECTION_LAST,
+  INDEXER,
+  INLINE_LIST,
+  COMPOUND_EXPRESSION,
+};
+
+/**
+ * children are linked through next_sibling, str_start and str_size locate the name of
+ * properties, variables and functions or the content of string literals
+ */
+struct Node {
+  NodeKind kind = NodeKind::LITERAL_NONE;
+  size_t start_pos = 0;
+  size_t end_pos = 0;
+  bool null_safe = false;
+  bool bool_value = false;
+  int int_value = 0;
+  float float_value = 0;
+  size_t str_start = 0;
+  size_t str_size = 0;
+  size_t first_child = NONE;
+  size_t next_sibling = NONE;
+  size_t child_count = 0;
+};
+
+template<size_t N>
+struct Ast {
+  Node nodes[N] = {};
+  size_t size = 0;
+  size_t root = NONE;
+};
+
+struct StaticToken {
+  Token::Kind kind = Token::Kind::END;
+  size_t start_pos = 0;
+  size_t end_pos = 0;
+};
+
+constexpr bool is_alpha(const char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+constexpr bool is_alnum(const char ch) {
+  return is_alpha(ch) || (ch >= '0' && ch <= '9');
+}
+
+constexpr bool is_blank(const char ch) {
+  return ch == ' ' || ch == '\t';
+}
+
+/**
+ * constexpr mirror of Tokenizer
+ */
+class StaticTokenizer {
+ public:
+  constexpr explicit StaticTokenizer(const std::string_view expr_str) : expr_str_(expr_str) {}
+
+  constexpr const StaticToken &peek_token() {
+    scan_token();
+    return token_;
+  }
+
+  constexpr StaticToken next_token() {
+    scan_token();
+    StaticToken token = token_;
+    if (token.kind != Token::Kind::END) {
+      scanned_ = false;
+    }
+    return token;
+  }
+
+ private:
+  std::string_view expr_str_;
+  size_t pos_ = 0;
+  StaticToken token_;
+  bool scanned_ = false;
+
+  constexpr char char_at(const size_t pos) const {
+    return pos < expr_str_.size() ? expr_str_[pos] : '\0';
+  }
+
+  constexpr void scan_token() {
+    while (!scanned_) {
+      char ch = char_at(pos_);
+      char next = char_at(pos_ + 1);
+      if (is_alpha(ch) || ch == '_') {
+        lex_identifier();
+      } else if (is_alnum(ch)) {
+        lex_numeric_literal();
+      } else if (is_blank(ch)) {
+        ++pos_;
+      } else {
+        switch (ch) {
+          case '\'':
+          case '"':lex_string_literal(ch);
+            break;
+          case '(':set_token(Token::Kind::LPAREN, 1);
+            break;
+          case ')':set_token(Token::Kind::RPAREN, 1);
+            break;
+          case '[':set_token(Token::Kind::LSQUARE, 1);
+            break;
+          case ']':set_token(Token::Kind::RSQUARE, 1);
+            break;
+          case '{':set_token(Token::Kind::LCURLY, 1);
+            break;
+          case '}':set_token(Token::Kind::RCURLY, 1);
+            break;
+          case '+':set_token(Token::Kind::PLUS, 1);
+            break;
+          case '-':next == '[' ? set_token(Token::Kind::FLAT, 2) : set_token(Token::Kind::MINUS, 1);
+            break;
+          case '*':set_token(Token::Kind::STAR, 1);
+            break;
+          case '^':next == '[' ? set_token(Token::Kind::SELECT_FIRST, 2) : set_token(Token::Kind::POWER, 1);
+            break;
+          case '/':set_token(Token::Kind::DIV, 1);
+            break;
+          case '%':set_token(Token::Kind::MOD, 1);
+            break;
+          case ':':set_token(Token::Kind::COLON, 1);
+            break;
+          case '#':set_token(Token::Kind::HASH, 1);
+            break;
+          case '.':set_token(Token::Kind::DOT, 1);
+            break;
+          case ',':set_token(Token::Kind::COMMA, 1);
+            break;
+          case '?':
+            if (next == '[') {
+              set_token(Token::Kind::SELECT, 2);
+            } else if (next == ':') {
+              set_token(Token::Kind::ELVIS, 2);
+            } else if (next == '.') {
+              set_token(Token::Kind::SAFE_NAVI, 2);
+            } else {
+              set_token(Token::Kind::QMARK, 1);
+            }
+            break;
+          case '>':next == '=' ? set_token(Token::Kind::GE, 2) : set_token(Token::Kind::GT, 1);
+            break;
+          case '<':next == '=' ? set_token(Token::Kind::LE, 2) : set_token(Token::Kind::LT, 1);
+            break;
+          case '=':next == '=' ? set_token(Token::Kind::EQ, 2) : set_token(Token::Kind::ASSIGN, 1);
+            break;
+          case '!':
+            if (next == '=') {
+              set_token(Token::Kind::NE, 2);
+            } else if (next == '[') {
+              set_token(Token::Kind::PROJECT, 2);
+            } else {
+              set_token(Token::Kind::NOT, 1);
+            }
+            break;
+          case '|':next == '|' ? set_token(Token::Kind::OR, 2) : throw_unexpected_char();
+            break;
+          case '&':next == '&' ? set_token(Token::Kind::AND, 2) : throw_unexpected_char();
+            break;
+          case '$':next == '[' ? set_token(Token::Kind::SELECT_LAST, 2) : throw_unexpected_char();
+            break;
+          case '\0':
+            token_ = StaticToken{Token::Kind::END, pos_, pos_ + 1};
+            scanned_ = true;
+            break;
+          default:throw_unexpected_char();
+            break;
+        }
+      }
+    }
+  }
+
+  constexpr void lex_identifier() {
+    size_t start = pos_;
+    while (is_alnum(char_at(pos_)) || char_at(pos_) == '_') ++pos_;
+    std::string_view identifier = expr_str_.substr(start, pos_ - start);
+    Token::Kind kind = Token::Kind::IDENTIFIER;
+    if (identifier == "true" || identifier == "false") {
+      kind = Token::Kind::LITERAL_BOOL;
+    } else if (identifier == "not") {
+      kind = Token::Kind::NOT;
+    } else if (identifier == "and") {
+      kind = Token::Kind::AND;
+    } else if (identifier == "or") {
+      kind = Token::Kind::OR;
+    }
+    token_ = StaticToken{kind, start, pos_};
+    scanned_ = true;
+  }
+
+  constexpr void lex_numeric_literal() {
+    size_t start = pos_;
+    Token::Kind kind = Token::Kind::LITERAL_INT;
+    while (is_alnum(char_at(pos_))) ++pos_;
+    if (char_at(pos_) == '.') {
+      ++pos_;
+      while (is_alnum(char_at(pos_))) ++pos_;
+      kind = Token::Kind::LITERAL_FLOAT;
+    }
+    token_ = StaticToken{kind, start, pos_};
+    scanned_ = true;
+  }
+
+  constexpr void lex_string_literal(const char quote) {
+    size_t start = pos_;
+    ++pos_;
+    while (char_at(pos_) != quote) {
+      if (pos_ >= expr_str_.size()) {
+        CPPEL_THROW(TokenError("unterminated string at " + std::to_string(start)));
+      }
+      ++pos_;
+    }
+    ++pos_;
+    token_ = StaticToken{Token::Kind::LITERAL_STRING, start, pos_};
+    scanned_ = true;
+  }
+
+  constexpr void set_token(const Token::Kind kind, const size_t size) {
+    token_ = StaticToken{kind, pos_, pos_ + size};
+    pos_ += size;
+    scanned_ = true;
+  }
+
+  void throw_unexpected_char() const {
+    CPPEL_THROW(TokenError("unexpected char at " + std::to_string(pos_)));
+  }
+};
+
+/**
+ * constexpr mirror of InternalParser, nodes are built into a fixed size array
+ * and referenced by index, NONE stands for a null node
+ */
+template<size_t N>
+class StaticParser {
+ public:
+  constexpr explicit StaticParser(const std::string_view expr_str) : expr_str_(expr_str), tokenizer_(expr_str) {}
+
+  constexpr Ast<N> parse() {
+    if (expr_str_.empty()) {
+      CPPEL_THROW(ParseError("unexpected empty string"));
+    }
+    ast_.root = eat_expression();
+    if (ast_.root == NONE) {
+      CPPEL_THROW(ParseError("internal parser error"));
+    }
+    if (peek_token().kind != Token::Kind::END) {
+      CPPEL_THROW(ParseError("unexpected token at " + std::to_string(peek_token().start_pos)));
+    }
+    return ast_;
+  }
+
+ private:
+  std::string_view expr_str_;
+  StaticTokenizer tokenizer_;
+  Ast<N> ast_;
+
+  constexpr size_t eat_expression() {
+    size_t expr = eat_logical_or_expression();
+    StaticToken token = peek_token();
+    if (token.kind == Token::Kind::ASSIGN) {
+      CPPEL_THROW(ParseError("assign is not supported by static expressions at " + std::to_string(token.start_pos)));
+    } else if (token.kind == Token::Kind::ELVIS) {
+      if (expr == NONE) {
+        return add_node(NodeKind::LITERAL_NONE, token.start_pos - 1, token.end_pos - 1);
+      }
+      next_token();
+      size_t else_value = eat_expression();
+      return add_node(NodeKind::ELVIS, token.start_pos, token.end_pos, expr, else_value);
+    } else if (token.kind == Token::Kind::QMARK) {
+      if (expr == NONE) {
+        return add_node(NodeKind::LITERAL_NONE, token.start_pos - 1, token.end_pos - 1);
+      }
+      next_token();
+      size_t if_true_value = eat_expression();
+      eat_token(Token::Kind::COLON);
+      size_t if_false_value = eat_expression();
+      return add_node(NodeKind::TERNARY, token.start_pos, token.end_pos, expr, if_true_value, if_false_value);
+    }
+    return expr;
+  }
+
+  constexpr size_t eat_logical_or_expression() {
+    size_t expr = eat_logical_and_expression();
+    while (peek_token().kind == Token::Kind::OR) {
+      StaticToken token = next_token();
+      size_t rh_expr = eat_logical_and_expression();
+      expr = add_binary_node(NodeKind::OP_OR, token, expr, rh_expr);
+    }
+    return expr;
+  }
+
+  constexpr size_t eat_logical_and_expression() {
+    size_t expr = eat_relation_expression();
+    while (peek_token().kind == Token::Kind::AND) {
+      StaticToken token = next_token();
+      size_t rh_expr = eat_relation_expression();
+      expr = add_binary_node(NodeKind::OP_AND, token, expr, rh_expr);
+    }
+    return expr;
+  }
+
+  constexpr size_t eat_relation_expression() {
+    size_t expr = eat_sum_expression();
+    Token::Kind kind = peek_token().kind;
+    NodeKind node_kind = NodeKind::LITERAL_NONE;
+    if (kind == Token::Kind::GT) {
+      node_kind = NodeKind::OP_GT;
+    } else if (kind == Token::Kind::GE) {
+      node_kind = NodeKind::OP_GE;
+    } else if (kind == Token::Kind::LT) {
+      node_kind = NodeKind::OP_LT;
+    } else if (kind == Token::Kind::LE) {
+      node_kind = NodeKind::OP_LE;
+    } else if (kind == Token::Kind::EQ) {
+      node_kind = NodeKind::OP_EQ;
+    } else if (kind == Token::Kind::NE) {
+      node_kind = NodeKind::OP_NE;
+    } else {
+      return expr;
+    }
+    StaticToken token = next_token();
+    size_t rh_expr = eat_sum_expression();
+    return add_binary_node(node_kind, token, expr, rh_expr);
+  }
+
+  constexpr size_t eat_sum_expression() {
+    size_t expr = eat_product_expression();
+    while (peek_token().kind == Token::Kind::PLUS || peek_token().kind == Token::Kind::MINUS) {
+      StaticToken token = next_token();
+      size_t rh_expr = eat_product_expression();
+      expr = add_binary_node(token.kind == Token::Kind::PLUS ? NodeKind::OP_PLUS : NodeKind::OP_MINUS,
+                             token, expr, rh_expr);
+    }
+    return expr;
+  }
+
+  constexpr size_t eat_product_expression() {
+    size_t expr = eat_power_expression();
+    while (peek_token().kind == Token::Kind::STAR || peek_token().kind == Token::Kind::DIV
+        || peek_token().kind == Token::Kind::MOD) {
+      StaticToken token = next_token();
+      size_t rh_expr = eat_power_expression();
+      NodeKind kind = token.kind == Token::Kind::STAR ? NodeKind::OP_MULTIPLY
+                                                      : token.kind == Token::Kind::DIV ? NodeKind::OP_DIVIDE
+                                                                                       : NodeKind::OP_MODULUS;
+      expr = add_binary_node(kind, token, expr, rh_expr);
+    }
+    return expr;
+  }
+
+  constexpr size_t eat_power_expression() {
+    size_t expr = eat_unary_expression();
+    if (peek_token().kind == Token::Kind::POWER) {
+      StaticToken token = next_token();
+      size_t rh_expr = eat_unary_expression();
+      return add_binary_node(NodeKind::OP_POWER, token, expr, rh_expr);
+    }
+    return expr;
+  }
+
+  constexpr size_t eat_unary_expression() {
+    Token::Kind kind = peek_token().kind;
+    if (kind == Token::Kind::PLUS || kind == Token::Kind::MINUS || kind == Token::Kind::NOT) {
+      StaticToken token = next_token();
+      size_t expr = eat_unary_expression();
+      if (expr == NONE) {
+        CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos)));
+      }
+      NodeKind node_kind = kind == Token::Kind::PLUS ? NodeKind::OP_PLUS
+                                                     : kind == Token::Kind::MINUS ? NodeKind::OP_MINUS
+                                                                                  : NodeKind::OP_NOT;
+      return add_node(node_kind, token.start_pos, token.end_pos, expr);
+    }
+    return eat_primary_expression();
+  }
+
+  constexpr size_t eat_primary_expression() {
+    size_t start = eat_start_node();
+    size_t compound = NONE;
+    while (is_node_start()) {
+      if (compound == NONE) {
+        if (start == NONE) {
+          CPPEL_THROW(ParseError("unexpected token at " + std::to_string(peek_token().start_pos)));
+        }
+        compound = add_node(NodeKind::COMPOUND_EXPRESSION, ast_.nodes[start].start_pos, ast_.nodes[start].end_pos,
+                            start);
+      }
+      append_child(compound, eat_node());
+    }
+    return compound == NONE ? start : compound;
+  }
+
+  constexpr size_t eat_start_node() {
+    StaticToken token = peek_token();
+    switch (token.kind) {
+      case Token::Kind::LITERAL_BOOL:
+      case Token::Kind::LITERAL_INT:
+      case Token::Kind::LITERAL_FLOAT:
+      case Token::Kind::LITERAL_STRING:return eat_literal();
+      case Token::Kind::LPAREN: {
+        next_token();
+        size_t expr = eat_expression();
+        if (expr == NONE) {
+          CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos)));
+        }
+        eat_token(Token::Kind::RPAREN);
+        return expr;
+      }
+      case Token::Kind::HASH:return eat_function_or_variable();
+      case Token::Kind::IDENTIFIER:return eat_property(false);
+      case Token::Kind::PROJECT:
+      case Token::Kind::FLAT:
+      case Token::Kind::SELECT:
+      case Token::Kind::SELECT_FIRST:
+      case Token::Kind::SELECT_LAST:return eat_collection(false);
+      case Token::Kind::LSQUARE:return eat_indexer();
+      case Token::Kind::LCURLY:return eat_inline_list();
+      default:return NONE;
+    }
+  }
+
+  constexpr size_t eat_literal() {
+    StaticToken token = next_token();
+    size_t node = NONE;
+    if (token.kind == Token::Kind::LITERAL_BOOL) {
+      node = add_node(NodeKind::LITERAL_BOOL, token.start_pos, token.end_pos);
+      ast_.nodes[node].bool_value = token_str(token) == "true";
+    } else if (token.kind == Token::Kind::LITERAL_INT) {
+      int value = 0;
+      for (size_t pos = token.start_pos; pos < token.end_pos; ++pos) {
+        value = value * 10 + (expr_str_[pos] - '0');
+      }
+      node = add_node(NodeKind::LITERAL_INT, token.start_pos, token.end_pos);
+      ast_.nodes[node].int_value = value;
+    } else if (token.kind == Token::Kind::LITERAL_FLOAT) {
+      float value = 0;
+      bool dot = false;
+      int rate = 1;
+      for (size_t pos = token.start_pos; pos < token.end_pos; ++pos) {
+        if (expr_str_[pos] == '.') {
+          dot = true;
+          continue;
+        }
+        if (dot) {
+          rate *= 10;
+          value += (expr_str_[pos] - '0') / ((float) rate);
+        } else {
+          value = value * 10 + (expr_str_[pos] - '0');
+        }
+      }
+      node = add_node(NodeKind::LITERAL_FLOAT, token.start_pos, token.end_pos);
+      ast_.nodes[node].float_value = value;
+    } else {
+      node = add_node(NodeKind::LITERAL_STRING, token.start_pos, token.end_pos);
+      ast_.nodes[node].str_start = token.start_pos + 1;
+      ast_.nodes[node].str_size = token.end_pos - token.start_pos - 2;
+    }
+    return node;
+  }
+
+  constexpr size_t eat_function_or_variable() {
+    next_token();
+    if (peek_token().kind != Token::Kind::IDENTIFIER) {
+      CPPEL_THROW(ParseError("unexpected token at " + std::to_string(peek_token().start_pos)));
+    }
+    StaticToken token = next_token();
+    size_t node = NONE;
+    if (peek_token().kind == Token::Kind::LPAREN) {
+      node = add_node(NodeKind::FUNCTION, token.start_pos, token.end_pos);
+      do {
+        next_token();
+        StaticToken arg_token = peek_token();
+        if (arg_token.kind == Token::Kind::END) {
+          CPPEL_THROW(ParseError("unexpected end at" + std::to_string(arg_token.start_pos)));
+        }
+        if (arg_token.kind != Token::Kind::RPAREN) {
+          append_child(node, eat_expression());
+        }
+      } while (peek_token().kind == Token::Kind::COMMA);
+      eat_token(Token::Kind::RPAREN);
+    } else {
+      node = add_node(NodeKind::VARIABLE, token.start_pos, token.end_pos);
+    }
+    ast_.nodes[node].str_start = token.start_pos;
+    ast_.nodes[node].str_size = token.end_pos - token.start_pos;
+    return node;
+  }
+
+  constexpr size_t eat_property(const bool null_safe) {
+    StaticToken token = next_token();
+    if (peek_token().kind == Token::Kind::LPAREN) {
+      CPPEL_THROW(ParseError("method is not supported by static expressions at " + std::to_string(token.start_pos)));
+    }
+    size_t node = add_node(NodeKind::PROPERTY, token.start_pos, token.end_pos);
+    ast_.nodes[node].null_safe = null_safe;
+    ast_.nodes[node].str_start = token.start_pos;
+    ast_.nodes[node].str_size = token.end_pos - token.start_pos;
+    return node;
+  }
+
+  constexpr size_t eat_collection(const bool null_safe) {
+    StaticToken token = next_token();
+    size_t expr = eat_expression();
+    if (expr == NONE) {
+      CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.end_pos)));
+    }
+    eat_token(Token::Kind::RSQUARE);
+    NodeKind kind = NodeKind::SELECTION;
+    if (token.kind == Token::Kind::PROJECT) {
+      kind = NodeKind::PROJECTION;
+    } else if (token.kind == Token::Kind::FLAT) {
+      kind = NodeKind::FLAT;
+    } else if (token.kind == Token::Kind::SELECT_FIRST) {
+      kind = NodeKind::SELECTION_FIRST;
+    } else if (token.kind == Token::Kind::SELECT_LAST) {
+      kind = NodeKind::SELECTION_LAST;
+    }
+    size_t node = add_node(kind, token.start_pos, token.end_pos, expr);
+    ast_.nodes[node].null_safe = null_safe;
+    return node;
+  }
+
+  constexpr size_t eat_indexer() {
+    StaticToken token = next_token();
+    size_t expr = eat_expression();
+    if (expr == NONE) {
+      CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.end_pos)));
+    }
+    eat_token(Token::Kind::RSQUARE);
+    return add_node(NodeKind::INDEXER, token.start_pos, token.end_pos, expr);
+  }
+
+  constexpr size_t eat_inline_list() {
+    StaticToken token = next_token();
+    size_t node = add_node(NodeKind::INLINE_LIST, token.start_pos, token.end_pos);
+    if (peek_token().kind != Token::Kind::RCURLY) {
+      append_child(node, eat_expression());
+      while (peek_token().kind == Token::Kind::COMMA) {
+        next_token();
+        append_child(node, eat_expression());
+      }
+      if (peek_token().kind == Token::Kind::COLON) {
+        CPPEL_THROW(ParseError("map is not supported by static expressions at " + std::to_string(token.start_pos)));
+      }
+    }
+    ast_.nodes[node].end_pos = eat_token(Token::Kind::RCURLY).end_pos;
+    return node;
+  }
+
+  constexpr bool is_node_start() {
+    Token::Kind kind = peek_token().kind;
+    return kind == Token::Kind::DOT || kind == Token::Kind::SAFE_NAVI || kind == Token::Kind::LSQUARE;
+  }
+
+  constexpr size_t eat_node() {
+    if (peek_token().kind == Token::Kind::LSQUARE) {
+      return eat_indexer();
+    }
+    bool null_safe = next_token().kind == Token::Kind::SAFE_NAVI;
+    switch (peek_token().kind) {
+      case Token::Kind::IDENTIFIER:return eat_property(null_safe);
+      case Token::Kind::PROJECT:
+      case Token::Kind::FLAT:
+      case Token::Kind::SELECT:
+      case Token::Kind::SELECT_FIRST:
+      case Token::Kind::SELECT_LAST:return eat_collection(null_safe);
+      default:CPPEL_THROW(ParseError("unexpected token after " + std::to_string(peek_token().start_pos)));
+    }
+  }
+
+  constexpr const StaticToken &peek_token() {
+    return tokenizer_.peek_token();
+  }
+
+  constexpr StaticToken next_token() {
+    return tokenizer_.next_token();
+  }
+
+  constexpr StaticToken eat_token(const Token::Kind expected_kind) {
+    StaticToken token = next_token();
+    if (token.kind != expected_kind) {
+      CPPEL_THROW(ParseError("expect can't be match at " + std::to_string(token.start_pos)));
+    }
+    return token;
+  }
+
+  constexpr std::string_view token_str(const StaticToken &token) const {
+    return expr_str_.substr(token.start_pos, token.end_pos - token.start_pos);
+  }
+
+  constexpr size_t add_binary_node(const NodeKind kind, const StaticToken &token, const size_t lh_expr,
+                                   const size_t rh_expr) {
+    if (lh_expr == NONE) {
+      CPPEL_THROW(ParseError("unexpected null before " + std::to_string(token.start_pos)));
+    }
+    if (rh_expr == NONE) {
+      CPPEL_THROW(ParseError("unexpected null after " + std::to_string(token.start_pos)));
+    }
+    return add_node(kind, token.start_pos, token.end_pos, lh_expr, rh_expr);
+  }
+
+  constexpr size_t add_node(const NodeKind kind, const size_t start_pos, const size_t end_pos,
+                            const size_t child_1 = NONE, const size_t child_2 = NONE,
+                            const size_t child_3 = NONE) {
+    if (ast_.size >= N) {
+      CPPEL_THROW(ParseError("too many nodes"));
+    }
+    size_t node = ast_.size++;
+    ast_.nodes[node].kind = kind;
+    ast_.nodes[node].start_pos = start_pos;
+    ast_.nodes[node].end_pos = end_pos;
+    append_child(node, child_1);
+    append_child(node, child_2);
+    append_child(node, child_3);
+    return node;
+  }
+
+  constexpr void append_child(const size_t node, const size_t child) {
+    if (child == NONE) {
+      return;
+    }
+    Node &parent = ast_.nodes[node];
+    if (parent.first_child == NONE) {
+      parent.first_child = child;
+    } else {
+      size_t last = parent.first_child;
+      while (ast_.nodes[last].next_sibling != NONE) {
+        last = ast_.nodes[last].next_sibling;
+      }
+      ast_.nodes[last].next_sibling = child;
+    }
+    ++parent.child_count;
+  }
+};
+
+/**
+ * every token takes at least one char and adds at most two nodes, a compound expression and its part
+ */
+template<typename Source>
+struct StaticAst {
+  static constexpr std::string_view expr_str = Source::str();
+  static constexpr Ast<2 * expr_str.size() + 2> value = StaticParser<2 * expr_str.size() + 2>(expr_str).parse();
+
+  static constexpr const Node &node(const size_t index) {
+    return value.nodes[index];
+  }
+
+  static constexpr size_t child(const size_t index, size_t n) {
+    size_t child = value.nodes[index].first_child;
+    while (n-- > 0) {
+      child = value.nodes[child].next_sibling;
+    }
+    return child;
+  }
+
+  static std::string str(const size_t index) {
+    return std::string(expr_str.substr(value.nodes[index].str_start, value.nodes[index].str_size));
+  }
+};
+
+template<typename Source, size_t I>
+const json *evaluate_node(EvaluationContext &context, const json *active);
+
+/**
+ * evaluate the parts of a compound expression from node I, each one on the result of the previous one
+ */
+template<typename Source, size_t I>
+const json *evaluate_chain(EvaluationContext &context, const json *active) {
+  const json *value = evaluate_node<Source, I>(context, active);
+  CPPEL_CHECK(value);
+  constexpr size_t next = StaticAst<Source>::node(I).next_sibling;
+  if constexpr (next == NONE) {
+    return value;
+  } else {
+    return evaluate_chain<Source, next>(context, value);
+  }
+}
+
+/**
+ * evaluate node I and its next siblings into values
+ */
+template<typename Source, size_t I>
+bool evaluate_siblings(EvaluationContext &context, const json *active, std::vector<const json *> &values) {
+  if constexpr (I == NONE) {
+    return true;
+  } else {
+    const json *value = evaluate_node<Source, I>(context, active);
+    if (!value) {
+      return false;
+    }
+    values.push_back(value);
+    return evaluate_siblings<Source, StaticAst<Source>::node(I).next_sibling>(context, active, values);
+  }
+}
+
+template<typename Op, typename Source, size_t I>
+const json *evaluate_compare(EvaluationContext &context, const json *active) {
+  using A = StaticAst<Source>;
+  constexpr size_t rh = A::child(I, 1);
+  const json *lh_value = evaluate_node<Source, A::child(I, 0)>(context, active);
+  CPPEL_CHECK(lh_value);
+  if constexpr (A::node(rh).kind == NodeKind::LITERAL_INT) {
+    static const json rh_value(A::node(rh).int_value);
+    return native::compare<Op>(lh_value, static_cast<int64_t>(A::node(rh).int_value), rh_value);
+  } else if constexpr (A::node(rh).kind == NodeKind::LITERAL_FLOAT) {
+    static const json rh_value(A::node(rh).float_value);
+    return native::compare<Op>(lh_value, static_cast<double>(A::node(rh).float_value), rh_value);
+  } else if constexpr (A::node(rh).kind == NodeKind::LITERAL_STRING) {
+    static const std::string rh_str = A::str(rh);
+    static const json rh_value(rh_str);
+    return native::compare<Op>(lh_value, rh_str, rh_value);
+  } else {
+    const json *rh_value = evaluate_node<Source, rh>(context, active);
+    CPPEL_CHECK(rh_value);
+    return native::compare<Op>(lh_value, rh_value);
+  }
+}
+
+/**
+ * arithmetic with a typed right operand when it's a number literal, Fn is one of the native helpers
+ */
+template<typename Source, size_t I, typename Fn>
+const json *evaluate_arithmetic(EvaluationContext &context, const json *active, const Fn &fn) {
+  using A = StaticAst<Source>;
+  const json *lh_value = native::value_zero();
+  constexpr size_t rh = A::node(I).child_count == 1 ? A::child(I, 0) : A::child(I, 1);
+  if constexpr (A::node(I).child_count == 2) {
+    lh_value = evaluate_node<Source, A::child(I, 0)>(context, active);
+    CPPEL_CHECK(lh_value);
+  }
+  if constexpr (A::node(rh).kind == NodeKind::LITERAL_INT) {
+    return fn(context, lh_value, A::node(rh).int_value);
+  } else if constexpr (A::node(rh).kind == NodeKind::LITERAL_FLOAT) {
+    return fn(context, lh_value, A::node(rh).float_value);
+  } else {
+    const json *rh_value = evaluate_node<Source, rh>(context, active);
+    CPPEL_CHECK(rh_value);
+    return fn(context, lh_value, rh_value);
+  }
+}
+
+template<typename Source, size_t I>
+const json *evaluate_node(EvaluationContext &context, const json *active) {
+  using A = StaticAst<Source>;
+  constexpr const Node &node = A::node(I);
+  constexpr NodeKind kind = node.kind;
+
+  if constexpr (kind == NodeKind::LITERAL_NONE) {
+    return native::value_empty();
+  } else if constexpr (kind == NodeKind::LITERAL_BOOL) {
+    return native::boolean(node.bool_value);
+  } else if constexpr (kind == NodeKind::LITERAL_INT) {
+    static const json value(node.int_value);
+    return &value;
+  } else if constexpr (kind == NodeKind::LITERAL_FLOAT) {
+    static const json value(node.float_value);
+    return &value;
+  } else if constexpr (kind == NodeKind::LITERAL_STRING) {
+    static const json value(A::str(I));
+    return &value;
+  } else if constexpr (kind == NodeKind::ELVIS) {
+    const json *value = evaluate_node<Source, A::child(I, 0)>(context, active);
+    CPPEL_CHECK(value);
+    return value->is_null() ? evaluate_node<Source, A::child(I, 1)>(context, active) : value;
+  } else if constexpr (kind == NodeKind::TERNARY) {
+    const json *condition = evaluate_node<Source, A::child(I, 0)>(context, active);
+    CPPEL_CHECK(condition);
+    return truthy(condition) ? evaluate_node<Source, A::child(I, 1)>(context, active)
+                             : evaluate_node<Source, A::child(I, 2)>(context, active);
+  } else if constexpr (kind == NodeKind::OP_NOT) {
+    const json *value = evaluate_node<Source, A::child(I, 0)>(context, active);
+    CPPEL_CHECK(value);
+    return native::boolean(!truthy(value));
+  } else if constexpr (kind == NodeKind::OP_OR || kind == NodeKind::OP_AND) {
+    const json *lh_value = evaluate_node<Source, A::child(I, 0)>(context, active);
+    CPPEL_CHECK(lh_value);
+    if (truthy(lh_value) == (kind == NodeKind::OP_OR)) {
+      return native::boolean(kind == NodeKind::OP_OR);
+    }
+    const json *rh_value = evaluate_node<Source, A::child(I, 1)>(context, active);
+    CPPEL_CHECK(rh_value);
+    return native::boolean(truthy(rh_value));
+  } else if constexpr (kind == NodeKind::OP_GT) {
+    return evaluate_compare<native::Gt, Source, I>(context, active);
+  } else if constexpr (kind == NodeKind::OP_GE) {
+    return evaluate_compare<native::Ge, Source, I>(context, active);
+  } else if constexpr (kind == NodeKind::OP_LT) {
+    return evaluate_compare<native::Lt, Source, I>(context, active);
+  } else if constexpr (kind == NodeKind::OP_LE) {
+    return evaluate_compare<native::Le, Source, I>(context, active);
+  } else if constexpr (kind == NodeKind::OP_EQ) {
+    return evaluate_compare<native::Eq, Source, I>(context, active);
+  } else if constexpr (kind == NodeKind::OP_NE) {
+    return evaluate_compare<native::Ne, Source, I>(context, active);
+  } else if constexpr (kind == NodeKind::OP_PLUS) {
+    return evaluate_arithmetic<Source, I>(context, active, [](EvaluationContext &c, const json *lh, auto rh) {
+      return native::plus(c, lh, rh);
+    });
+  } else if constexpr (kind == NodeKind::OP_MINUS) {
+    return evaluate_arithmetic<Source, I>(context, active, [](EvaluationContext &c, const json *lh, auto rh) {
+      return native::minus(c, lh, rh);
+    });
+  } else if constexpr (kind == NodeKind::OP_MULTIPLY) {
+    return evaluate_arithmetic<Source, I>(context, active, [](EvaluationContext &c, const json *lh, auto rh) {
+      return native::multiply(c, lh, rh);
+    });
+  } else if constexpr (kind == NodeKind::OP_DIVIDE) {
+    return evaluate_arithmetic<Source, I>(context, active, [](EvaluationContext &c, const json *lh, auto rh) {
+      return native::divide(c, lh, rh);
+    });
+  } else if constexpr (kind == NodeKind::OP_MODULUS || kind == NodeKind::OP_POWER) {
+    const json *lh_value = evaluate_node<Source, A::child(I, 0)>(context, active);
+    CPPEL_CHECK(lh_value);
+    const json *rh_value = evaluate_node<Source, A::child(I, 1)>(context, active);
+    CPPEL_CHECK(rh_value);
+    return kind == NodeKind::OP_MODULUS ? native::modulus(context, lh_value, rh_value)
+                                        : native::power(context, lh_value, rh_value);
+  } else if constexpr (kind == NodeKind::FUNCTION) {
+    static const std::pair<std::string, int> key(A::str(I), static_cast<int>(node.child_count));
+    const Function *function = native::function(context, key, node.start_pos);
+    CPPEL_CHECK(function);
+    std::vector<const json *> args;
+    if (!evaluate_siblings<Source, node.first_child>(context, active, args)) {
+      return nullptr;
+    }
+    return context.push_ref((*function)(args));
+  } else if constexpr (kind == NodeKind::VARIABLE) {
+    constexpr std::string_view name = A::expr_str.substr(node.str_start, node.str_size);
+    if constexpr (name == "root") {
+      return context.get_root_data();
+    } else if constexpr (name == "this") {
+      return active;
+    } else {
+      // static expressions can't assign, their variables are the ones given to the context
+      static const std::string variable_name(name);
+      const json *value = context.get_variable(variable_name);
+      if (!value) {
+        return context.fail(ErrorCode::UNKNOWN_VARIABLE, "unexpected variable at", node.start_pos);
+      }
+      return value;
+    }
+  } else if constexpr (kind == NodeKind::PROPERTY) {
+    static const std::string name = A::str(I);
+    return native::property(context, active, name, node.null_safe, node.start_pos);
+  } else if constexpr (kind == NodeKind::INDEXER) {
+    if (active->is_null()) {
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", node.start_pos);
+    }
+    const json *index_value = evaluate_node<Source, node.first_child>(context, active);
+    CPPEL_CHECK(index_value);
+    return native::index(context, active, index_value, node.start_pos);
+  } else if constexpr (kind == NodeKind::INLINE_LIST) {
+    std::vector<const json *> items;
+    if (!evaluate_siblings<Source, node.first_child>(context, active, items)) {
+      return nullptr;
+    }
+    std::shared_ptr<json> array = std::make_shared<json>();
+    for (const json *item : items) {
+      array->push_back(*item);
+    }
+    return context.push_ref(array);
+  } else if constexpr (kind == NodeKind::COMPOUND_EXPRESSION) {
+    if (active->is_null()) {
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at ", node.start_pos);
+    }
+    return evaluate_chain<Source, node.first_child>(context, active);
+  } else {
+    if (active->is_null()) {
+      if (node.null_safe) {
+        return native::value_empty();
+      }
+      return context.fail(ErrorCode::UNEXPECTED_NULL, "unexpected null at", node.start_pos);
+    }
+    if constexpr (kind == NodeKind::SELECTION_FIRST) {
+      for (auto it = active->begin(); it != active->end(); ++it) {
+        const json *matched = evaluate_node<Source, node.first_child>(context, &(*it));
+        CPPEL_CHECK(matched);
+        if (truthy(matched)) {
+          return &(*it);
+        }
+      }
+      return native::value_empty();
+    } else if constexpr (kind == NodeKind::SELECTION_LAST) {
+      for (auto it = active->rbegin(); it != active->rend(); ++it) {
+        const json *matched = evaluate_node<Source, node.first_child>(context, &(*it));
+        CPPEL_CHECK(matched);
+        if (truthy(matched)) {
+          return &(*it);
+        }
+      }
+      return native::value_empty();
+    } else {
+      std::shared_ptr<json> result = std::make_shared<json>();
+      for (auto it = active->begin(); it != active->end(); ++it) {
+        const json *value = evaluate_node<Source, node.first_child>(context, &(*it));
+        CPPEL_CHECK(value);
+        if constexpr (kind == NodeKind::PROJECTION) {
+          result->push_back(*value);
+        } else if constexpr (kind == NodeKind::FLAT) {
+          if (!value->is_array()) {
+            return context.fail(ErrorCode::NOT_ARRAY, "flat should do with array", node.start_pos);
+          }
+          for (auto &sub_item : *value) {
+            result->push_back(sub_item);
+          }
+        } else if (truthy(value)) {
+          result->push_back(*it);
+        }
+      }
+      return context.push_ref(result);
+    }
+  }
+}
+
+} // namespace static_ast
+
+/**
+ * expression parsed at compile time, see CPPEL_EXPR
+ */
+template<typename Source>
+class StaticExpression {
+ public:
+  static_assert(static_ast::StaticAst<Source>::value.root != static_ast::NONE, "empty expression");
+
+  json evaluate(const json &data) const {
+    EvaluationContext context = EvaluationContext(data);
+    return evaluate(context);
+  }
+
+  json evaluate(EvaluationContext &context) const {
+    json rlt = context.take_ref(checked(evaluate_root(context), context));
+    context.clear_ref();
+    return rlt;
+  }
+
+  /**
+   * same as Expression::evaluate_ref
+   */
+  const json &evaluate_ref(EvaluationContext &context) const {
+    context.clear_ref();
+    return *checked(evaluate_root(context), context);
+  }
+
+  /**
+   * same as Expression::try_evaluate
+   */
+  EvaluateResult try_evaluate(EvaluationContext &context) const {
+    EvaluateResult result;
+    bool throw_error = context.is_throw_error();
+    context.set_throw_error(false);
+    context.get_status() = EvaluateStatus();
+    try {
+      const json *rlt = evaluate_root(context);
+      if (rlt) {
+        result.value = context.take_ref(rlt);
+      } else {
+        result.status = context.get_status();
+      }
+    } catch (const std::exception &e) {
+      result.status.code = ErrorCode::EXCEPTION;
+      result.status.detail = e.what();
+    }
+    context.set_throw_error(throw_error);
+    context.reset();
+    return result;
+  }
+
+  EvaluateResult try_evaluate(const json &data) const {
+    EvaluationContext context = EvaluationContext(data);
+    return try_evaluate(context);
+  }
+
+  /**
+   * the evaluation as a native function, NativeRegistry::instance().add(expr.get_expr_str(), expr.get_function())
+   * makes Parser::parse use it for the same string
+   */
+  static constexpr NativeFunction get_function() {
+    return &evaluate_root;
+  }
+
+  static constexpr std::string_view get_expr_str() {
+    return static_ast::StaticAst<Source>::expr_str;
+  }
+
+ private:
+  static const json *evaluate_root(EvaluationContext &context) {
+    return static_ast::evaluate_node<Source, static_ast::StaticAst<Source>::value.root>(
+        context, context.get_active_data());
+  }
+
+  static const json *checked(const json *rlt, EvaluationContext &context) {
+    if (!rlt) {
+      context.clear_ref();
+      CPPEL_THROW(EvaluateError(context.get_status().to_string()));
+    }
+    return rlt;
+  }
+};
+
+} // namespace cppel
+
+/**
+ * expression parsed at compile time from a string literal, like:
+ *    auto rule = CPPEL_EXPR("user.age >= 18");
+ */
+#define CPPEL_EXPR(expr_str)                                              \
+  ([] {                                                                   \
+    struct CppelSource {                                                  \
+      static constexpr std::string_view str() {                           \
+        return expr_str;                                                  \
+      }                                                                   \
+    };                                                                    \
+    return ::cppel::StaticExpression<CppelSource>();                      \
+  }())
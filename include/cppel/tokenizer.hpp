@@ -27,6 +27,7 @@ class Token {
     RCURLY,          // }
     COMMA,           // ,
     COLON,           // :
+    SEMICOLON,       // ;
     HASH,            // #
     DOT,             // .
     PLUS,            // +
@@ -42,6 +43,8 @@ class Token {
     LE,              // <=
     EQ,              // ==
     NE,              // !=
+    MATCHES,         // matches
+    IN,              // in
     NOT,             // !
     AND,             // &&
     OR,              // ||
@@ -162,6 +165,8 @@ class Tokenizer {
             break;
           case ':':enqueue_token(Token::Kind::COLON, 1);
             break;
+          case ';':enqueue_token(Token::Kind::SEMICOLON, 1);
+            break;
           case '#':enqueue_token(Token::Kind::HASH, 1);
             break;
           case '.':enqueue_token(Token::Kind::DOT, 1);
@@ -251,6 +256,10 @@ class Tokenizer {
       token_queue_.emplace(Token::Kind::AND, start, pos_);
     } else if (identifier == "or") {
       token_queue_.emplace(Token::Kind::OR, start, pos_);
+    } else if (identifier == "matches") {
+      token_queue_.emplace(Token::Kind::MATCHES, start, pos_);
+    } else if (identifier == "in") {
+      token_queue_.emplace(Token::Kind::IN, start, pos_);
     } else {
       token_queue_.emplace(Token::Kind::IDENTIFIER, start, pos_);
     }
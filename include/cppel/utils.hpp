@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <unordered_set>
 #include "nlohmann/json.hpp"
 
 namespace cppel {
@@ -23,4 +25,53 @@ static bool truthy(const json *data) {
   return !data->empty();
 }
 
-} // namespace cppel
\ No newline at end of file
+/**
+ * hash of json values for hash tables keyed by pointers to them, numbers are hashed
+ * by their value since 1 == 1.0
+ */
+struct JsonHash {
+  size_t operator()(const json *data) const {
+    if (data->is_number()) {
+      return std::hash<double>()(data->get<double>());
+    }
+    return std::hash<json>()(*data);
+  }
+};
+
+struct JsonEqual {
+  bool operator()(const json *lh, const json *rh) const {
+    return *lh == *rh;
+  }
+};
+
+/**
+ * hash set of the items of an array, for the in operator
+ */
+class JsonSet {
+ public:
+  explicit JsonSet(const json &values) : values_(values) {
+    index_.reserve(values_.size());
+    for (auto &value : values_) {
+      index_.insert(&value);
+    }
+  }
+
+  // the index points into the items, which move along with the array
+  JsonSet(JsonSet &&) = default;
+  JsonSet(const JsonSet &) = delete;
+  JsonSet &operator=(const JsonSet &) = delete;
+
+  bool contains(const json *value) const {
+    return index_.find(value) != index_.end();
+  }
+
+  const json &get_values() const {
+    return values_;
+  }
+
+ private:
+  json values_;
+  std::unordered_set<const json *, JsonHash, JsonEqual> index_;
+};
+
+} // namespace cppel
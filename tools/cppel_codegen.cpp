@@ -0,0 +1,69 @@
+//
+// Created by dycaly on 22-10-3.
+//
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <cppel/codegen.hpp>
+#include <cppel/parser.hpp>
+
+/**
+ * usage:
+ *    cppel_codegen <rules file> <output file>
+ *
+ * every non empty line of the rules file is an expression, lines starting with // are comments.
+ * expressions which can't be compiled are reported and stay interpreted
+ */
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::cerr << "usage: cppel_codegen <rules file> <output file>" << std::endl;
+    return 2;
+  }
+
+  std::ifstream in(argv[1]);
+  if (!in) {
+    std::cerr << "can't read " << argv[1] << std::endl;
+    return 1;
+  }
+
+  cppel::Parser parser;
+  parser.set_use_native(false);
+  cppel::CodeGenerator generator;
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line)) {
+    ++line_number;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line.compare(0, 2, "//") == 0) {
+      continue;
+    }
+    std::string error;
+    try {
+      if (!generator.add(parser.parse(line), error)) {
+        std::cerr << argv[1] << ":" << line_number << ": warning: " << error << std::endl;
+      }
+    } catch (const cppel::CppelError &e) {
+      std::cerr << argv[1] << ":" << line_number << ": error: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  std::string source = generator.to_source();
+  std::ifstream previous(argv[2]);
+  std::string previous_source((std::istreambuf_iterator<char>(previous)), std::istreambuf_iterator<char>());
+  if (previous_source == source) {
+    return 0;
+  }
+  std::ofstream out(argv[2], std::ios::trunc);
+  out << source;
+  if (!out) {
+    std::cerr << "can't write " << argv[2] << std::endl;
+    return 1;
+  }
+  return 0;
+}